@@ -0,0 +1,138 @@
+#include <pthread.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+#include "crc32c.h"
+
+#define CRC32C_POLY 0x82F63B78u     //reflected
+#define CRC32C_LANE 8192            //bytes per lane of the interleaved hardware loop
+
+static uint32_t table[8][256];
+static uint32_t powers[32];         //x^(2^n) modulo the polynomial
+static uint32_t laneShift;          //moves a CRC past CRC32C_LANE bytes
+static uint32_t (*update)(uint32_t, const uint8_t*, size_t);
+static const char* kind;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+//SOFTWARE: eight bytes a step through eight tables
+static uint32_t updateSoftware(uint32_t pCrc, const uint8_t* pData, size_t pSize) {
+    while (pSize >= 8) {
+        pCrc ^= (uint32_t) pData[0] | (uint32_t) pData[1] << 8 | (uint32_t) pData[2] << 16 | (uint32_t) pData[3] << 24;
+        pCrc = table[7][pCrc & 0xFF] ^ table[6][(pCrc >> 8) & 0xFF] ^ table[5][(pCrc >> 16) & 0xFF] ^
+               table[4][pCrc >> 24] ^ table[3][pData[4]] ^ table[2][pData[5]] ^ table[1][pData[6]] ^ table[0][pData[7]];
+        pData += 8;
+        pSize -= 8;
+    }
+    while (pSize-- > 0)
+        pCrc = table[0][(pCrc ^ *pData++) & 0xFF] ^ (pCrc >> 8);
+    return pCrc;
+}
+
+//Product of two polynomials modulo the CRC polynomial, bit 31 holding x^0
+static uint32_t multiply(uint32_t pA, uint32_t pB) {
+    uint32_t product = 0;
+
+    for (uint32_t bit = 1u << 31; bit != 0; bit >>= 1) {
+        if (pA & bit)
+            product ^= pB;
+        pB = pB & 1 ? (pB >> 1) ^ CRC32C_POLY : pB >> 1;
+    }
+    return product;
+}
+
+#if defined(__x86_64__)
+//One crc32 instruction waits for the one before, so three lanes run side by side and are joined after
+__attribute__((target("sse4.2")))
+static uint32_t updateSse(uint32_t pCrc, const uint8_t* pData, size_t pSize) {
+    uint64_t crc = pCrc;
+
+    for (; pSize > 0 && ((uintptr_t) pData & 7) != 0; --pSize)
+        crc = _mm_crc32_u8((uint32_t) crc, *pData++);
+    for (; pSize >= 3 * CRC32C_LANE; pSize -= 3 * CRC32C_LANE, pData += 3 * CRC32C_LANE) {
+        const uint64_t* words = (const uint64_t*) pData;
+        uint64_t second = 0;
+        uint64_t third = 0;
+        for (uint32_t i = 0; i < CRC32C_LANE / 8; ++i) {
+            crc = _mm_crc32_u64(crc, words[i]);
+            second = _mm_crc32_u64(second, words[i + CRC32C_LANE / 8]);
+            third = _mm_crc32_u64(third, words[i + 2 * CRC32C_LANE / 8]);
+        }
+        crc = multiply(laneShift, multiply(laneShift, (uint32_t) crc) ^ (uint32_t) second) ^ (uint32_t) third;
+    }
+    for (; pSize >= 8; pSize -= 8, pData += 8)
+        crc = _mm_crc32_u64(crc, *(const uint64_t*) pData);
+    for (; pSize > 0; --pSize)
+        crc = _mm_crc32_u8((uint32_t) crc, *pData++);
+    return (uint32_t) crc;
+}
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+static uint32_t updateArm(uint32_t pCrc, const uint8_t* pData, size_t pSize) {
+    for (; pSize > 0 && ((uintptr_t) pData & 7) != 0; --pSize)
+        pCrc = __crc32cb(pCrc, *pData++);
+    for (; pSize >= 8; pSize -= 8, pData += 8)
+        pCrc = __crc32cd(pCrc, *(const uint64_t*) pData);
+    for (; pSize > 0; --pSize)
+        pCrc = __crc32cb(pCrc, *pData++);
+    return pCrc;
+}
+#endif
+
+//x^(8 * pBytes) modulo the polynomial
+static uint32_t shift(uint64_t pBytes) {
+    uint32_t result = 1u << 31;
+
+    for (int n = 3; pBytes != 0; pBytes >>= 1, n = (n + 1) & 31)
+        if (pBytes & 1)
+            result = multiply(powers[n], result);
+    return result;
+}
+
+static void setup(void) {
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit)
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; ++i)
+        for (int slice = 1; slice < 8; ++slice)
+            table[slice][i] = table[0][table[slice - 1][i] & 0xFF] ^ (table[slice - 1][i] >> 8);
+
+    powers[0] = 1u << 30;   //x
+    for (int n = 1; n < 32; ++n)
+        powers[n] = multiply(powers[n - 1], powers[n - 1]);
+    laneShift = shift(CRC32C_LANE);
+
+    update = updateSoftware;
+    kind = "software";
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) {
+        update = updateSse;
+        kind = "sse4.2";
+    }
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+    update = updateArm;
+    kind = "armv8";
+#endif
+}
+
+uint32_t crc32c(uint32_t pCrc, const void* pData, size_t pSize) {
+    pthread_once(&once, setup);
+    return ~update(~pCrc, pData, pSize);
+}
+
+//Moving the first CRC past pSecondSize zero bytes is multiplying it by x^(8 * pSecondSize)
+uint32_t crc32cCombine(uint32_t pFirst, uint32_t pSecond, uint64_t pSecondSize) {
+    pthread_once(&once, setup);
+    return multiply(shift(pSecondSize), pFirst) ^ pSecond;
+}
+
+const char* crc32cKind(void) {
+    pthread_once(&once, setup);
+    return kind;
+}
@@ -0,0 +1,17 @@
+#ifndef FS_CRC32C_H
+#define FS_CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//CRC32C (Castagnoli) of pSize bytes, continuing pCrc; 0 starts a new one. SSE 4.2 or ARMv8 CRC instructions
+//where the CPU has them.
+uint32_t crc32c(uint32_t pCrc, const void* pData, size_t pSize);
+
+//The CRC of two pieces back to back, from the CRC of each and the size of the second
+uint32_t crc32cCombine(uint32_t pFirst, uint32_t pSecond, uint64_t pSecondSize);
+
+//"sse4.2", "armv8" or "software"
+const char* crc32cKind(void);
+
+#endif //FS_CRC32C_H
@@ -4,14 +4,51 @@
 #define FS_MAX_NAME 32
 #define FS_ALLOC_UNITS 32
 #define FS_DIRECTORY_FILES 16
+#define FS_INLINE_MAX 64   //files up to this size live in their entry
+#define FS_CHUNK_SIZE 65536 //plain bytes per compressed chunk
+#define FS_DEDUP_MIN 2048   //content-defined chunks, 8 KiB on average
+#define FS_DEDUP_MAX 65536
+#define FS_DEDUP_MASK 0xFFF8000000000000ull
+#define FS_CHAIN_WALK 8     //extents walked before a chain's offset map is used instead
+#define FS_CHAIN_SLOTS 64   //offset maps kept, by first block
+#define FS_IO_DEPTH 32      //requests the I/O engine keeps in flight
+#define FS_IO_THREADS 8     //workers of the thread pool engine
+#define FS_SCRUB_PIECE 1048576  //most bytes of one extent a scrub worker checks at once
+#define FS_SCRUB_WINDOW 4194304 //most bytes a scrub reads at once
+#define FS_SCRUB_THREADS 32
+#define FS_METRIC_PHASES 16
+#define FS_METRIC_COUNTERS 5
+#define FS_METRIC_BUCKETS 40    //latency histogram, bucket n counts calls under 2^n nanoseconds
+#define FS_TREE_RECORDS 56  //names per B+tree node, which is about as large as a directory table
+#define FS_TREE_DEPTH 16    //levels a directory's B+tree may have
+#define FS_MAX_DEPTH 64     //directories a path may lead through
 
 #define FS_FREE 0x01
 #define FS_UNUSED 0x02
 #define FS_OCCUPIED 0x04
 #define FS_SYSTEM 0x08
 
+#define FS_UNIT_CHECKED 0x01    //checksum holds the CRC32C of the extent
+
 #define FS_ENDPOINT 0xFFFFFFFF
 
+#define FS_ENTRY_INLINE 0x01
+#define FS_ENTRY_COMPRESSED 0x02   //extents hold FS_chunk_header framed chunks, size is the plain size
+#define FS_ENTRY_DEDUP 0x04        //extents hold FS_dedup_ref entries naming shared chunks
+#define FS_ENTRY_DIRECTORY 0x08    //also inline and empty, the names in it are in the B+tree at tree
+
+#define FS_FORMAT 8
+
+#define FS_JOURNAL_MAGIC 0x4A534647 //GFSJ
+#define FS_JOURNAL_MIN 65536
+#define FS_JOURNAL_MAX 1048576
+#define FS_JOURNAL_FREED 0x8000000000000000ULL //in a record size: the range went free, no image follows
+
+#define FS_INDEX_EMPTY 0xFFFFFFFF
+#define FS_INDEX_DELETED 0xFFFFFFFE
+#define FS_INDEX_INITIAL 64
+#define FS_INDEX_CHUNK 512   //slots per dirty mark
+
 #define FS_INFO_OFFSET 0
 #define FS_ALLOCATION_OFFSET sizeof(FS_info)
 #define FS_DIRECTORY_OFFSET FS_ALLOCATION_OFFSET + sizeof(FS_allocation_table)
@@ -20,44 +57,310 @@
 typedef struct {
     uint8_t magic[3];   //GFS
     uint8_t version[5]; //x.x.x
-    uint32_t size;      //size in bytes
-    uint32_t free;      //free space
     uint32_t allocation_tables;
     uint32_t directory_tables;
+    uint32_t name_index;
+    uint32_t journal_size;  //bytes, the journal follows the data region
+    uint32_t format;    //FS_FORMAT, 24 bytes in as in every earlier format so old images are recognised
+    uint32_t policy;    //POLICY_*, how adds place files unless the handle says otherwise
+    uint64_t size;      //size in bytes
+    uint64_t free;      //free space
+    uint32_t dedup_index;   //block of the FS_dedup_index, FS_ENDPOINT until the first deduplicated add
+    uint32_t root;      //B+tree node of the top directory, FS_ENDPOINT while it is empty
 } FS_info;
 
 typedef struct {
     uint8_t type;
-    uint32_t offset;
-    uint32_t size;
     uint32_t next_block;
+    uint64_t offset;
+    uint64_t size;
+    uint8_t flags;      //FS_UNIT_*
+    uint32_t checksum;
 } FS_allocation_unit;
 
 typedef struct {
     FS_allocation_unit units[FS_ALLOC_UNITS];
     uint32_t unused_units;
     uint32_t offset_next;
+    uint32_t checksum;  //CRC32C of everything before it, set as the table is saved
 } FS_allocation_table;
 
 typedef struct {
     uint8_t name[FS_MAX_NAME]; //truncated
     uint8_t flags;
-    uint32_t size;
     uint32_t block;
+    uint64_t size;
     uint64_t created;
+    uint32_t parent;    //entry of the directory holding it, FS_ENDPOINT in the top one
+    uint32_t tree;      //B+tree node of a directory's names, FS_ENDPOINT while it is empty
+    uint8_t data[FS_INLINE_MAX];    //contents when FS_ENTRY_INLINE, block is FS_ENDPOINT then
 } FS_file_entry;
 
+typedef struct {
+    uint32_t stored;    //bytes that follow, equal to size when the chunk did not compress
+    uint32_t size;
+} FS_chunk_header;
+
 typedef struct {
     uint16_t files_flags;
     FS_file_entry files[16];
     uint32_t offset_next;
+    uint32_t checksum;  //the same
 } FS_directory_table;
 
+typedef struct {
+    uint8_t name[FS_MAX_NAME];
+    uint32_t target;    //the entry in a leaf, the child node otherwise
+} FS_tree_record;
+
+//One node of a directory's B+tree, in a system block of its own. Leaves hold the names in order and are chained
+//through next; record i of an inner node leads to the names from its name on, the name of the first is not used.
+typedef struct {
+    uint16_t leaf;
+    uint16_t count;
+    uint32_t next;      //the following leaf, FS_ENDPOINT after the last
+    FS_tree_record records[FS_TREE_RECORDS];
+    uint32_t checksum;
+} FS_tree_node;
+
+typedef struct {
+    uint32_t hash;      //of the directory and the name
+    uint32_t file;      //directory table * FS_DIRECTORY_FILES + position
+} FS_index_slot;
+
+typedef struct {
+    uint32_t capacity;  //power of two
+    uint32_t count;
+    uint32_t deleted;
+    uint32_t checksum;  //CRC32C of the fields before it folded with that of every chunk of slots
+    FS_index_slot slots[];
+} FS_name_index;
+
+typedef struct {
+    uint64_t hash;
+    uint32_t block;     //first extent of the chunk, FS_INDEX_EMPTY or FS_INDEX_DELETED
+    uint32_t refs;
+} FS_dedup_slot;
+
+typedef struct {
+    uint32_t capacity;  //power of two
+    uint32_t count;
+    uint32_t deleted;
+    uint32_t checksum;  //the same as the name index's
+    FS_dedup_slot slots[];
+} FS_dedup_index;
+
+typedef struct {
+    uint64_t hash;
+    uint32_t block;
+    uint32_t size;
+} FS_dedup_ref;
+
+typedef struct {
+    uint32_t left;
+    uint32_t right;
+    uint64_t size;
+    uint32_t height;    //0 when the block is not in the tree
+    uint32_t prev;      //neighbours by offset, free or not
+    uint32_t next;
+    uint32_t offset_left;   //the same FS_FREE units again, in a tree by offset
+    uint32_t offset_right;
+    uint32_t offset_height;
+    uint64_t offset;
+    uint64_t largest;   //size of the largest unit in the subtree by offset
+} FS_extent_node;
+
+typedef struct {
+    FS_extent_node* nodes;  //trees of FS_FREE units by size and by offset and offset order of all units, by block
+    uint32_t root;
+    uint32_t offset_root;
+    uint32_t first;         //lowest offset
+    uint32_t* unused;       //stack of FS_UNUSED blocks
+    uint32_t unused_count;
+    uint32_t capacity;
+} FS_extent_map;
+
+typedef struct {
+    uint32_t magic;     //FS_JOURNAL_MAGIC
+    uint32_t epoch;     //bumped on every checkpoint, older transactions are stale
+} FS_journal_header;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t epoch;
+    uint32_t length;    //bytes of records that follow
+    uint32_t checksum;
+} FS_journal_txn;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t size;      //bytes of table image that follow, or FS_JOURNAL_FREED and the bytes that went free
+} FS_journal_record;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t size;
+    uint32_t txn;       //the transaction that freed it, images older than it are stale
+} FS_journal_freed;
+
+typedef struct {
+    off_t offset;
+    void* table;        //NULL: the range went free, only the journal hears of it
+    size_t size;
+} FS_table_write;
+
+typedef struct {
+    void* data;
+    size_t size;
+    off_t offset;       //in the drive
+    uint8_t write;
+} FS_io_request;
+
+typedef struct FS_io_engine FS_io_engine;
+
+//System blocks read ahead while the table chains load, by block
+typedef struct {
+    void** tables;
+    uint8_t* fetched;
+    uint32_t capacity;
+} FS_table_cache;
+
+typedef struct {
+    uint32_t block;     //FS_ENDPOINT past the last extent
+    uint64_t offset;    //within the block
+} FS_extent_cursor;
+
+typedef struct {
+    FS_tree_node* leaf; //NULL past the last name
+    uint32_t slot;
+} FS_tree_cursor;
+
+//fsck's walk through the B+tree of one directory
+typedef struct {
+    uint32_t directory;
+    uint32_t records;
+    uint32_t nodes;
+    uint32_t leaf;      //the last one reached, FS_ENDPOINT before the first
+    uint8_t last[FS_MAX_NAME];  //name of the last record
+    char what[FS_MAX_NAME + 16];
+} FS_tree_check;
+
+typedef struct {
+    uint64_t start;     //stored offset of the block's first byte
+    uint32_t block;
+} FS_chain_mark;
+
+//Where each extent of one chain starts, valid while the allocation tables are at generation
+typedef struct {
+    uint32_t block;     //first of the chain
+    uint32_t count;
+    uint64_t generation;
+    FS_chain_mark marks[];
+} FS_chain_map;
+
+//Up to FS_SCRUB_PIECE bytes of one extent, the CRC of each is folded into the extent's once all are read
+typedef struct {
+    uint64_t offset;    //in the data region
+    uint32_t block;
+    uint32_t size;
+    uint32_t crc;
+    uint8_t failed;     //could not be read
+} FS_scrub_piece;
+
+//Pieces read front to back in windows of adjacent ones, slot = window % slots, verified by the workers
+typedef struct {
+    FS_scrub_piece* pieces;
+    uint32_t* windows;  //first piece of each, and one past the last
+    uint32_t count;
+    uint8_t** buffers;
+    uint8_t* held;      //per slot, until its window is verified
+    uint32_t slots;
+    uint32_t read;      //windows in their slots so far
+    uint32_t taken;     //windows a worker took
+    uint8_t* map;       //windows are verified in place when the drive is mapped
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    pthread_cond_t freed;
+} FS_scrub_job;
+
+typedef struct {
+    uint64_t calls;
+    uint64_t nanos;
+    uint64_t max;
+    uint64_t buckets[FS_METRIC_BUCKETS];
+} FS_metric;
+
+//Latency of every operation and phase with what they cost, METRIC_* and COUNT_* in metrics.h. Each thread collects
+//its operation's share alone and merges it in as the operation ends.
+typedef struct {
+    FS_metric phases[FS_METRIC_PHASES];
+    uint64_t counters[FS_METRIC_COUNTERS];
+    pthread_mutex_t lock;
+    FILE* trace;        //a line per operation when not NULL
+} FS_metrics;
+
+//One thread's operation so far
+typedef struct {
+    FS_metric phases[FS_METRIC_PHASES];
+    uint64_t counters[FS_METRIC_COUNTERS];
+    uint32_t touched;   //bit per phase with calls
+} FS_metric_frame;
+
+typedef struct {
+    uint64_t deadline;  //CLOCK_MONOTONIC nanoseconds, 0 for none
+    uint64_t freed_from;    //moved out of since the last commit, committed metadata still points here
+    uint64_t freed_to;
+    uint64_t moved;
+    uint32_t moves;
+    uint8_t expired;
+} FS_defrag_state;
+
 typedef struct {
     FS_info* info_block;
-    FS_allocation_table* allocation_table;
-    FS_directory_table* directory_table;
+    FS_allocation_table** allocation_table;
+    FS_directory_table** directory_table;
+    FS_name_index* name_index;
+    FS_dedup_index* dedup_index;
+    FS_extent_map extents;
+    uint32_t allocation_capacity;
+    uint32_t directory_capacity;
+    uint8_t* allocation_dirty;  //per table, cleared by saveDescriptors
+    uint8_t* directory_dirty;
+    uint32_t directory_free;    //no table before this one has a free entry
+    FS_tree_node** nodes;       //B+tree nodes by block, each read the first time a lookup reaches it
+    uint8_t* nodes_dirty;       //as many as the allocation tables have units
+    uint32_t nodes_touched;     //dirty ones
+    uint32_t* held;             //system blocks freed since the last save, committed metadata may still point there
+    uint32_t held_count;
+    uint32_t held_capacity;
+    pthread_mutex_t nodes_lock; //readers load nodes side by side
+    uint8_t* index_dirty;       //per FS_INDEX_CHUNK slots
+    uint32_t index_chunks;
+    uint32_t* index_sums;       //CRC32C per FS_INDEX_CHUNK slots, a save only sums the chunks it writes
+    size_t dirty_bytes;         //metadata the next save will write
+    uint8_t index_fresh;        //index moved to a new block since the last save
+    uint8_t* dedup_dirty;       //the same for the dedup index
+    uint32_t dedup_chunks;
+    uint32_t* dedup_sums;
+    uint8_t dedup_fresh;
+    uint64_t generation;        //bumped by every change to the allocation tables
+    FS_chain_map* chains[FS_CHAIN_SLOTS];
+    pthread_mutex_t chains_lock;    //readers fill chains side by side
+    FS_io_engine* io;           //batched copies, NULL for one at a time
+    FS_metrics metrics;
+    uint32_t journal_epoch;
+    uint32_t journal_used;      //bytes of committed transactions after the header
+    uint8_t policy;             //the image's unless changed for this handle
+    uint8_t compress;           //adds through this handle compress what pays
+    uint8_t dedup;              //adds through this handle share chunks already stored
+    uint8_t checksum;           //adds through this handle record the CRC32C of each extent
+    uint8_t checking;           //loaded by fsck: damage is reported to check_out and loading goes on
+    FILE* check_out;
+    uint32_t damaged;           //problems found
     FILE* drive;
+    uint8_t* map;       //whole image when opened with --mmap, NULL otherwise
+    size_t map_size;
+    uint8_t sync;
 } FS_descriptors;
 
 #endif //FS_DESCRIPTORS_H
@@ -0,0 +1,370 @@
+#include <stdlib.h>
+#include <string.h>
+#include "extents.h"
+
+//AVL tree over FS_FREE units keyed by (size, block). Nodes live in an array indexed by block,
+//height 0 marks a block that is not in the tree.
+
+static uint32_t nodeHeight(FS_extent_map* pMap, uint32_t pNode) {
+    return pNode == FS_ENDPOINT ? 0 : pMap->nodes[pNode].height;
+}
+
+static int nodeLess(FS_extent_map* pMap, uint32_t pA, uint32_t pB) {
+    if (pMap->nodes[pA].size != pMap->nodes[pB].size)
+        return pMap->nodes[pA].size < pMap->nodes[pB].size;
+    return pA < pB;
+}
+
+static void nodeUpdate(FS_extent_map* pMap, uint32_t pNode) {
+    uint32_t left = nodeHeight(pMap, pMap->nodes[pNode].left);
+    uint32_t right = nodeHeight(pMap, pMap->nodes[pNode].right);
+    pMap->nodes[pNode].height = 1 + (left > right ? left : right);
+}
+
+static uint32_t rotateRight(FS_extent_map* pMap, uint32_t pNode) {
+    uint32_t left = pMap->nodes[pNode].left;
+    pMap->nodes[pNode].left = pMap->nodes[left].right;
+    pMap->nodes[left].right = pNode;
+    nodeUpdate(pMap, pNode);
+    nodeUpdate(pMap, left);
+    return left;
+}
+
+static uint32_t rotateLeft(FS_extent_map* pMap, uint32_t pNode) {
+    uint32_t right = pMap->nodes[pNode].right;
+    pMap->nodes[pNode].right = pMap->nodes[right].left;
+    pMap->nodes[right].left = pNode;
+    nodeUpdate(pMap, pNode);
+    nodeUpdate(pMap, right);
+    return right;
+}
+
+static uint32_t rebalance(FS_extent_map* pMap, uint32_t pNode) {
+    FS_extent_node* node = &pMap->nodes[pNode];
+    int balance;
+
+    nodeUpdate(pMap, pNode);
+    balance = (int) nodeHeight(pMap, node->left) - (int) nodeHeight(pMap, node->right);
+    if (balance > 1) {
+        FS_extent_node* left = &pMap->nodes[node->left];
+        if (nodeHeight(pMap, left->left) < nodeHeight(pMap, left->right))
+            node->left = rotateLeft(pMap, node->left);
+        return rotateRight(pMap, pNode);
+    }
+    if (balance < -1) {
+        FS_extent_node* right = &pMap->nodes[node->right];
+        if (nodeHeight(pMap, right->right) < nodeHeight(pMap, right->left))
+            node->right = rotateRight(pMap, node->right);
+        return rotateLeft(pMap, pNode);
+    }
+    return pNode;
+}
+
+static uint32_t insertNode(FS_extent_map* pMap, uint32_t pRoot, uint32_t pNode) {
+    if (pRoot == FS_ENDPOINT)
+        return pNode;
+    if (nodeLess(pMap, pNode, pRoot))
+        pMap->nodes[pRoot].left = insertNode(pMap, pMap->nodes[pRoot].left, pNode);
+    else
+        pMap->nodes[pRoot].right = insertNode(pMap, pMap->nodes[pRoot].right, pNode);
+    return rebalance(pMap, pRoot);
+}
+
+static uint32_t removeMin(FS_extent_map* pMap, uint32_t pRoot, uint32_t* pMin) {
+    if (pMap->nodes[pRoot].left == FS_ENDPOINT) {
+        *pMin = pRoot;
+        return pMap->nodes[pRoot].right;
+    }
+    pMap->nodes[pRoot].left = removeMin(pMap, pMap->nodes[pRoot].left, pMin);
+    return rebalance(pMap, pRoot);
+}
+
+static uint32_t removeNode(FS_extent_map* pMap, uint32_t pRoot, uint32_t pNode) {
+    if (pRoot == FS_ENDPOINT)
+        return FS_ENDPOINT;
+    if (pRoot == pNode) {
+        uint32_t left = pMap->nodes[pRoot].left;
+        uint32_t right = pMap->nodes[pRoot].right;
+        uint32_t min;
+        if (right == FS_ENDPOINT)
+            return left;
+        right = removeMin(pMap, right, &min);
+        pMap->nodes[min].left = left;
+        pMap->nodes[min].right = right;
+        return rebalance(pMap, min);
+    }
+    if (nodeLess(pMap, pNode, pRoot))
+        pMap->nodes[pRoot].left = removeNode(pMap, pMap->nodes[pRoot].left, pNode);
+    else
+        pMap->nodes[pRoot].right = removeNode(pMap, pMap->nodes[pRoot].right, pNode);
+    return rebalance(pMap, pRoot);
+}
+
+//The same units in a second AVL tree keyed by (offset, block). Each node knows the largest size below it, so the lowest unit
+//that holds a size is found without visiting the ones before it.
+
+static uint32_t offsetHeight(FS_extent_map* pMap, uint32_t pNode) {
+    return pNode == FS_ENDPOINT ? 0 : pMap->nodes[pNode].offset_height;
+}
+
+static uint64_t offsetLargest(FS_extent_map* pMap, uint32_t pNode) {
+    return pNode == FS_ENDPOINT ? 0 : pMap->nodes[pNode].largest;
+}
+
+//a damaged image fsck loads may hold units at the same offset
+static int offsetLess(FS_extent_map* pMap, uint32_t pA, uint32_t pB) {
+    if (pMap->nodes[pA].offset != pMap->nodes[pB].offset)
+        return pMap->nodes[pA].offset < pMap->nodes[pB].offset;
+    return pA < pB;
+}
+
+static void offsetUpdate(FS_extent_map* pMap, uint32_t pNode) {
+    FS_extent_node* node = &pMap->nodes[pNode];
+    uint32_t left = offsetHeight(pMap, node->offset_left);
+    uint32_t right = offsetHeight(pMap, node->offset_right);
+    uint64_t leftLargest = offsetLargest(pMap, node->offset_left);
+    uint64_t rightLargest = offsetLargest(pMap, node->offset_right);
+
+    node->offset_height = 1 + (left > right ? left : right);
+    node->largest = node->size;
+    if (leftLargest > node->largest)
+        node->largest = leftLargest;
+    if (rightLargest > node->largest)
+        node->largest = rightLargest;
+}
+
+static uint32_t offsetRotateRight(FS_extent_map* pMap, uint32_t pNode) {
+    uint32_t left = pMap->nodes[pNode].offset_left;
+    pMap->nodes[pNode].offset_left = pMap->nodes[left].offset_right;
+    pMap->nodes[left].offset_right = pNode;
+    offsetUpdate(pMap, pNode);
+    offsetUpdate(pMap, left);
+    return left;
+}
+
+static uint32_t offsetRotateLeft(FS_extent_map* pMap, uint32_t pNode) {
+    uint32_t right = pMap->nodes[pNode].offset_right;
+    pMap->nodes[pNode].offset_right = pMap->nodes[right].offset_left;
+    pMap->nodes[right].offset_left = pNode;
+    offsetUpdate(pMap, pNode);
+    offsetUpdate(pMap, right);
+    return right;
+}
+
+static uint32_t offsetRebalance(FS_extent_map* pMap, uint32_t pNode) {
+    FS_extent_node* node = &pMap->nodes[pNode];
+    int balance;
+
+    offsetUpdate(pMap, pNode);
+    balance = (int) offsetHeight(pMap, node->offset_left) - (int) offsetHeight(pMap, node->offset_right);
+    if (balance > 1) {
+        FS_extent_node* left = &pMap->nodes[node->offset_left];
+        if (offsetHeight(pMap, left->offset_left) < offsetHeight(pMap, left->offset_right))
+            node->offset_left = offsetRotateLeft(pMap, node->offset_left);
+        return offsetRotateRight(pMap, pNode);
+    }
+    if (balance < -1) {
+        FS_extent_node* right = &pMap->nodes[node->offset_right];
+        if (offsetHeight(pMap, right->offset_right) < offsetHeight(pMap, right->offset_left))
+            node->offset_right = offsetRotateRight(pMap, node->offset_right);
+        return offsetRotateLeft(pMap, pNode);
+    }
+    return pNode;
+}
+
+static uint32_t offsetInsert(FS_extent_map* pMap, uint32_t pRoot, uint32_t pNode) {
+    if (pRoot == FS_ENDPOINT)
+        return pNode;
+    if (offsetLess(pMap, pNode, pRoot))
+        pMap->nodes[pRoot].offset_left = offsetInsert(pMap, pMap->nodes[pRoot].offset_left, pNode);
+    else
+        pMap->nodes[pRoot].offset_right = offsetInsert(pMap, pMap->nodes[pRoot].offset_right, pNode);
+    return offsetRebalance(pMap, pRoot);
+}
+
+static uint32_t offsetRemoveMin(FS_extent_map* pMap, uint32_t pRoot, uint32_t* pMin) {
+    if (pMap->nodes[pRoot].offset_left == FS_ENDPOINT) {
+        *pMin = pRoot;
+        return pMap->nodes[pRoot].offset_right;
+    }
+    pMap->nodes[pRoot].offset_left = offsetRemoveMin(pMap, pMap->nodes[pRoot].offset_left, pMin);
+    return offsetRebalance(pMap, pRoot);
+}
+
+static uint32_t offsetRemove(FS_extent_map* pMap, uint32_t pRoot, uint32_t pNode) {
+    if (pRoot == FS_ENDPOINT)
+        return FS_ENDPOINT;
+    if (pRoot == pNode) {
+        uint32_t left = pMap->nodes[pRoot].offset_left;
+        uint32_t right = pMap->nodes[pRoot].offset_right;
+        uint32_t min;
+        if (right == FS_ENDPOINT)
+            return left;
+        right = offsetRemoveMin(pMap, right, &min);
+        pMap->nodes[min].offset_left = left;
+        pMap->nodes[min].offset_right = right;
+        return offsetRebalance(pMap, min);
+    }
+    if (offsetLess(pMap, pNode, pRoot))
+        pMap->nodes[pRoot].offset_left = offsetRemove(pMap, pMap->nodes[pRoot].offset_left, pNode);
+    else
+        pMap->nodes[pRoot].offset_right = offsetRemove(pMap, pMap->nodes[pRoot].offset_right, pNode);
+    return offsetRebalance(pMap, pRoot);
+}
+
+int extentInit(FS_extent_map* pMap, uint32_t pCapacity) {
+    memset(pMap, 0, sizeof(FS_extent_map));
+    pMap->root = FS_ENDPOINT;
+    pMap->offset_root = FS_ENDPOINT;
+    pMap->first = FS_ENDPOINT;
+    return extentGrow(pMap, pCapacity);
+}
+
+int extentGrow(FS_extent_map* pMap, uint32_t pCapacity) {
+    FS_extent_node* nodes;
+    uint32_t* unused;
+
+    if (pCapacity <= pMap->capacity)
+        return 0;
+    nodes = realloc(pMap->nodes, pCapacity * sizeof(FS_extent_node));
+    if (nodes == NULL)
+        return -1;
+    pMap->nodes = nodes;
+    unused = realloc(pMap->unused, pCapacity * sizeof(uint32_t));
+    if (unused == NULL)
+        return -1;
+    pMap->unused = unused;
+    memset(&pMap->nodes[pMap->capacity], 0, (pCapacity - pMap->capacity) * sizeof(FS_extent_node));
+    for (uint32_t block = pMap->capacity; block < pCapacity; ++block) {
+        pMap->nodes[block].prev = FS_ENDPOINT;
+        pMap->nodes[block].next = FS_ENDPOINT;
+    }
+    pMap->capacity = pCapacity;
+    return 0;
+}
+
+void extentRelease(FS_extent_map* pMap) {
+    free(pMap->nodes);
+    free(pMap->unused);
+    memset(pMap, 0, sizeof(FS_extent_map));
+    pMap->root = FS_ENDPOINT;
+    pMap->offset_root = FS_ENDPOINT;
+    pMap->first = FS_ENDPOINT;
+}
+
+void extentInsertFree(FS_extent_map* pMap, uint32_t pBlock, uint64_t pOffset, uint64_t pSize) {
+    FS_extent_node* node = &pMap->nodes[pBlock];
+    if (node->height != 0)
+        return;
+    node->size = pSize;
+    node->left = FS_ENDPOINT;
+    node->right = FS_ENDPOINT;
+    node->height = 1;
+    pMap->root = insertNode(pMap, pMap->root, pBlock);
+    node->offset = pOffset;
+    node->largest = pSize;
+    node->offset_left = FS_ENDPOINT;
+    node->offset_right = FS_ENDPOINT;
+    node->offset_height = 1;
+    pMap->offset_root = offsetInsert(pMap, pMap->offset_root, pBlock);
+}
+
+void extentRemoveFree(FS_extent_map* pMap, uint32_t pBlock) {
+    if (pMap->nodes[pBlock].height == 0)
+        return;
+    pMap->root = removeNode(pMap, pMap->root, pBlock);
+    pMap->nodes[pBlock].height = 0;
+    pMap->offset_root = offsetRemove(pMap, pMap->offset_root, pBlock);
+    pMap->nodes[pBlock].offset_height = 0;
+}
+
+//smallest free unit that still holds pSize bytes
+uint32_t extentBestFit(FS_extent_map* pMap, uint64_t pSize) {
+    uint32_t node = pMap->root;
+    uint32_t best = FS_ENDPOINT;
+    while (node != FS_ENDPOINT) {
+        if (pMap->nodes[node].size >= pSize) {
+            best = node;
+            node = pMap->nodes[node].left;
+        } else {
+            node = pMap->nodes[node].right;
+        }
+    }
+    return best;
+}
+
+uint32_t extentLargest(FS_extent_map* pMap) {
+    uint32_t node = pMap->root;
+    if (node == FS_ENDPOINT)
+        return FS_ENDPOINT;
+    while (pMap->nodes[node].right != FS_ENDPOINT)
+        node = pMap->nodes[node].right;
+    return node;
+}
+
+//lowest free unit that still holds pSize bytes
+uint32_t extentFirstFit(FS_extent_map* pMap, uint64_t pSize) {
+    uint32_t node = pMap->offset_root;
+    while (node != FS_ENDPOINT && pMap->nodes[node].largest >= pSize) {
+        FS_extent_node* at = &pMap->nodes[node];
+        if (at->offset_left != FS_ENDPOINT && pMap->nodes[at->offset_left].largest >= pSize)
+            node = at->offset_left;
+        else if (at->size >= pSize)
+            return node;
+        else
+            node = at->offset_right;
+    }
+    return FS_ENDPOINT;
+}
+
+void extentPushUnused(FS_extent_map* pMap, uint32_t pBlock) {
+    pMap->unused[pMap->unused_count++] = pBlock;
+}
+
+uint32_t extentPopUnused(FS_extent_map* pMap) {
+    if (pMap->unused_count == 0)
+        return FS_ENDPOINT;
+    return pMap->unused[--pMap->unused_count];
+}
+
+uint32_t extentPeekUnused(FS_extent_map* pMap) {
+    if (pMap->unused_count == 0)
+        return FS_ENDPOINT;
+    return pMap->unused[pMap->unused_count - 1];
+}
+
+//Offset order: pAfter == FS_ENDPOINT links pBlock as the first extent
+void extentLinkAfter(FS_extent_map* pMap, uint32_t pBlock, uint32_t pAfter) {
+    uint32_t next = pAfter == FS_ENDPOINT ? pMap->first : pMap->nodes[pAfter].next;
+
+    pMap->nodes[pBlock].prev = pAfter;
+    pMap->nodes[pBlock].next = next;
+    if (pAfter == FS_ENDPOINT)
+        pMap->first = pBlock;
+    else
+        pMap->nodes[pAfter].next = pBlock;
+    if (next != FS_ENDPOINT)
+        pMap->nodes[next].prev = pBlock;
+}
+
+void extentUnlink(FS_extent_map* pMap, uint32_t pBlock) {
+    uint32_t prev = pMap->nodes[pBlock].prev;
+    uint32_t next = pMap->nodes[pBlock].next;
+
+    if (prev == FS_ENDPOINT)
+        pMap->first = next;
+    else
+        pMap->nodes[prev].next = next;
+    if (next != FS_ENDPOINT)
+        pMap->nodes[next].prev = prev;
+    pMap->nodes[pBlock].prev = FS_ENDPOINT;
+    pMap->nodes[pBlock].next = FS_ENDPOINT;
+}
+
+uint32_t extentPrev(FS_extent_map* pMap, uint32_t pBlock) {
+    return pMap->nodes[pBlock].prev;
+}
+
+uint32_t extentNext(FS_extent_map* pMap, uint32_t pBlock) {
+    return pMap->nodes[pBlock].next;
+}
@@ -0,0 +1,39 @@
+#ifndef FS_EXTENTS_H
+#define FS_EXTENTS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "descriptors.h"
+
+int extentInit(FS_extent_map* pMap, uint32_t pCapacity);
+
+int extentGrow(FS_extent_map* pMap, uint32_t pCapacity);
+
+void extentRelease(FS_extent_map* pMap);
+
+void extentInsertFree(FS_extent_map* pMap, uint32_t pBlock, uint64_t pOffset, uint64_t pSize);
+
+void extentRemoveFree(FS_extent_map* pMap, uint32_t pBlock);
+
+uint32_t extentBestFit(FS_extent_map* pMap, uint64_t pSize);
+
+uint32_t extentLargest(FS_extent_map* pMap);
+
+uint32_t extentFirstFit(FS_extent_map* pMap, uint64_t pSize);
+
+void extentPushUnused(FS_extent_map* pMap, uint32_t pBlock);
+
+uint32_t extentPopUnused(FS_extent_map* pMap);
+
+uint32_t extentPeekUnused(FS_extent_map* pMap);
+
+void extentLinkAfter(FS_extent_map* pMap, uint32_t pBlock, uint32_t pAfter);
+
+void extentUnlink(FS_extent_map* pMap, uint32_t pBlock);
+
+uint32_t extentPrev(FS_extent_map* pMap, uint32_t pBlock);
+
+uint32_t extentNext(FS_extent_map* pMap, uint32_t pBlock);
+
+#endif //FS_EXTENTS_H
@@ -0,0 +1,4686 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/sendfile.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef GFS_COMPRESSION
+#include <zlib.h>
+#endif
+#include "gfs.h"
+#include "descriptors.h"
+#include "extents.h"
+#include "io.h"
+#include "crc32c.h"
+#include "metrics.h"
+#include "version.h"
+
+#define STR_HELPER(x) #x
+#define STR(x) STR_HELPER(x)
+#define FS_VERSION  STR(MAJOR_VERSION)"."STR(MINOR_VERSION)
+
+#define DIR_FROM_FILE 0x01
+#define DIR_TO_FILE 0x02
+
+#define ZERO_CHUNK (1024 * 1024)
+#define COPY_CHUNK (1024 * 1024)
+#define COPY_ALIGN 4096
+
+int createFS(FILE* pDrive, uint64_t pBytes, uint8_t pMode, uint8_t pPolicy);
+
+int findFile(FS_file_entry* pFile, uint32_t* pIndex, FS_descriptors* pDesc, const char* pFilename);
+
+int findEntry(FS_descriptors* pDesc, const char* pPath, uint32_t* pFile);
+
+int findParent(FS_descriptors* pDesc, const char* pPath, uint8_t pCreate, uint32_t* pParent, char* pName);
+
+const char* nextPart(const char* pPath, char* pPart);
+
+int childFind(FS_descriptors* pDesc, uint32_t pParent, const char* pName, uint32_t* pFile);
+
+int liveEntry(FS_descriptors* pDesc, uint32_t pFile);
+
+int blockCopy(FS_descriptors* pDesc, FILE* pFile, FS_allocation_unit* pUnit, uint64_t pSize, uint8_t pDirection);
+
+int bufferCopy(FS_descriptors* pDesc, uint8_t* pBuffer, FS_allocation_unit* pUnit, uint8_t pDirection);
+
+int queueCopy(FS_descriptors* pDesc, FS_io_request* pRequests, uint32_t* pCount, uint8_t* pBuffer,
+              FS_allocation_unit* pUnit, uint8_t pDirection);
+
+int flushCopies(FS_descriptors* pDesc, FS_io_request* pRequests, uint32_t* pCount);
+
+int streamCopy(FILE* pFile, uint8_t* pData, uint64_t pSize, uint8_t pDirection);
+
+uint8_t* packChunks(const uint8_t* pData, uint64_t pSize, uint64_t* pStored);
+
+int unpackRange(FS_descriptors* pDesc, FS_file_entry* pFile, uint64_t pOffset, uint64_t pSize, FILE* pDest,
+                uint8_t* pBuffer);
+
+int cursorCopy(FS_descriptors* pDesc, FS_extent_cursor* pCursor, uint64_t pSize, FILE* pDest, uint8_t* pBuffer);
+
+int chainSeek(FS_descriptors* pDesc, uint32_t pBlock, uint64_t pOffset, FS_extent_cursor* pCursor);
+
+FS_chain_map* chainMap(FS_descriptors* pDesc, uint32_t pBlock);
+
+uint64_t storedSize(FS_descriptors* pDesc, FS_file_entry* pFile);
+
+int writeChain(FS_descriptors* pDesc, FILE* pFile, const uint8_t* pData, uint64_t pSize, uint32_t* pFirst);
+
+void releaseChain(FS_descriptors* pDesc, uint32_t pBlock);
+
+int copyChain(FS_descriptors* pDesc, uint32_t pBlock, FILE* pDest, uint8_t* pBuffer);
+
+int dedupStore(FS_descriptors* pDesc, FS_file_entry* pFile, const uint8_t* pData, uint64_t pSize);
+
+int dedupRange(FS_descriptors* pDesc, FS_file_entry* pFile, uint64_t pOffset, uint64_t pSize, FILE* pDest,
+               uint8_t* pBuffer);
+
+void dedupDrop(FS_descriptors* pDesc, FS_file_entry* pFile);
+
+FS_dedup_ref* dedupRefs(FS_descriptors* pDesc, FS_file_entry* pFile, uint32_t* pCount);
+
+uint32_t dedupCut(const uint8_t* pData, uint64_t pSize);
+
+void dedupGears(void);
+
+uint64_t dedupHash(const uint8_t* pData, uint32_t pSize);
+
+int dedupTake(FS_descriptors* pDesc, const uint8_t* pData, FS_dedup_ref* pRef);
+
+void dedupRelease(FS_descriptors* pDesc, FS_dedup_ref* pRef);
+
+int sameChunk(FS_descriptors* pDesc, uint32_t pBlock, const uint8_t* pData, uint64_t pSize);
+
+size_t dedupSize(uint32_t pCapacity);
+
+int dedupReserve(FS_descriptors* pDesc);
+
+int dedupRebuild(FS_descriptors* pDesc, uint32_t pCapacity);
+
+void dedupCheck(FS_descriptors* pDesc);
+
+uint32_t dedupPlace(FS_dedup_index* pIndex, uint64_t pHash, uint32_t pBlock, uint32_t pRefs);
+
+void touchDedup(FS_descriptors* pDesc, uint32_t pSlot);
+
+int dedupTrack(FS_descriptors* pDesc, uint32_t pCapacity);
+
+int loadDescriptors(FILE* pDrive, FS_descriptors* pDest, uint8_t pMap);
+
+int discardDescriptors(FS_descriptors* pDest);
+
+off_t fsize(FILE* pFile);
+
+int createDirectoryBlock(FS_descriptors* pDesc);
+
+uint32_t findBlock(FS_descriptors* pDesc, uint8_t pType);
+
+uint32_t findBlockSize(FS_descriptors* pDesc, uint8_t pType, uint64_t pSize);
+
+uint32_t allocateSystemBlock(FS_descriptors* pDesc, uint32_t pSize);
+
+int createAllocationBlock(FS_descriptors* pDesc);
+
+int reserveTables(FS_descriptors* pDesc, uint32_t pAllocation, uint32_t pDirectory);
+
+void* loadTable(FS_descriptors* pDesc, off_t pOffset, size_t pSize);
+
+void* copyTable(FS_descriptors* pDesc, off_t pOffset, size_t pSize);
+
+int systemBlock(FS_descriptors* pDesc, uint32_t pBlock, uint32_t pUnits, uint64_t pSize);
+
+void* chainedTable(FS_descriptors* pDesc, FS_table_cache* pCache, uint32_t pBlock, uint32_t pUnits, size_t pSize);
+
+int prefetchTables(FS_descriptors* pDesc, FS_table_cache* pCache, uint32_t pUnits, size_t pSize);
+
+int compareRequests(const void* pLeft, const void* pRight);
+
+void releaseTables(FS_table_cache* pCache);
+
+void* newTable(FS_descriptors* pDesc, off_t pOffset, size_t pSize);
+
+void saveTable(FS_descriptors* pDesc, void* pTable, off_t pOffset, size_t pSize);
+
+int isMapped(FS_descriptors* pDesc, void* pTable);
+
+void touchAllocation(FS_descriptors* pDesc, uint32_t pBlock);
+
+void touchDirectory(FS_descriptors* pDesc, uint32_t pFile);
+
+void touchIndex(FS_descriptors* pDesc, uint32_t pSlot);
+
+int indexTrack(FS_descriptors* pDesc, uint32_t pCapacity);
+
+uint32_t indexSum(const void* pHeader, size_t pHeaderSize, const void* pSlots, size_t pSlotSize, uint32_t pCapacity,
+                  uint32_t* pSums, const uint8_t* pDirty);
+
+int compareWrites(const void* pLeft, const void* pRight);
+
+off_t journalOffset(FS_info* pInfo);
+
+uint32_t journalChecksum(uint32_t pSeed, const void* pData, size_t pSize);
+
+int journalReplay(FS_descriptors* pDesc, FS_info* pInfo);
+
+int journalCommit(FS_descriptors* pDesc, FS_table_write* pWrites, uint32_t pCount);
+
+int journalCheckpoint(FS_descriptors* pDesc);
+
+int journalGrow(FS_descriptors* pDesc, size_t pLength);
+
+int journalSync(FS_descriptors* pDesc);
+
+FS_allocation_unit* getUnit(FS_descriptors* pDesc, uint32_t pBlock);
+
+FS_file_entry* getEntry(FS_descriptors* pDesc, uint32_t pFile);
+
+void releaseBlock(FS_descriptors* pDesc, uint32_t pBlock);
+
+int holdBlock(FS_descriptors* pDesc, uint32_t pBlock);
+
+void freeBlock(FS_descriptors* pDesc, uint32_t pBlock);
+
+void takeBlock(FS_descriptors* pDesc, uint32_t pBlock, uint64_t pSize, uint8_t pType);
+
+void mergeBlocks(FS_descriptors* pDesc, uint32_t pLeft, uint32_t pRight);
+
+uint32_t pickBlock(FS_descriptors* pDesc, uint64_t pSize);
+
+void sortBlocks(FS_descriptors* pDesc, uint32_t* pBlocks, uint32_t pCount);
+
+uint32_t hashName(uint32_t pParent, const char* pName);
+
+int sameName(const uint8_t* pEntryName, const char* pName);
+
+size_t indexSize(uint32_t pCapacity);
+
+int indexFind(FS_descriptors* pDesc, uint32_t pParent, const char* pName, uint32_t* pFile);
+
+void indexCheck(FS_descriptors* pDesc);
+
+int indexReserve(FS_descriptors* pDesc);
+
+int indexRebuild(FS_descriptors* pDesc, uint32_t pCapacity);
+
+uint32_t indexPlace(FS_name_index* pIndex, uint32_t pHash, uint32_t pFile);
+
+void indexInsert(FS_descriptors* pDesc, uint32_t pFile);
+
+void indexRemove(FS_descriptors* pDesc, uint32_t pFile);
+
+FS_tree_node* treeNode(FS_descriptors* pDesc, uint32_t pBlock);
+
+uint32_t treeAlloc(FS_descriptors* pDesc, uint16_t pLeaf);
+
+void treeFree(FS_descriptors* pDesc, uint32_t pBlock);
+
+void touchNode(FS_descriptors* pDesc, uint32_t pBlock);
+
+uint32_t treeRoot(FS_descriptors* pDesc, uint32_t pDirectory);
+
+void setRoot(FS_descriptors* pDesc, uint32_t pDirectory, uint32_t pNode);
+
+int compareName(const uint8_t* pRecordName, const char* pName);
+
+uint32_t treeSearch(FS_tree_node* pNode, const char* pName);
+
+int treePath(FS_descriptors* pDesc, uint32_t pRoot, const char* pName, uint32_t* pPath, uint32_t* pSlots,
+             uint32_t* pDepth);
+
+int treeFind(FS_descriptors* pDesc, uint32_t pDirectory, const char* pName, uint32_t* pFile);
+
+int treeInsert(FS_descriptors* pDesc, uint32_t pDirectory, const char* pName, uint32_t pFile);
+
+int treeRemove(FS_descriptors* pDesc, uint32_t pDirectory, const char* pName);
+
+int treeSeek(FS_descriptors* pDesc, uint32_t pDirectory, const char* pAfter, FS_tree_cursor* pCursor);
+
+int treeStep(FS_descriptors* pDesc, FS_tree_cursor* pCursor, FS_tree_record** pRecord);
+
+int saveDescriptors(FS_descriptors* pDesc);
+
+int status(FS_descriptors* pDesc, FILE* pOut);
+
+int list(FS_descriptors* pDesc, FS_list_callback pEach, void* pContext);
+
+int listTree(FS_descriptors* pDesc, uint32_t pDirectory, char* pPath, size_t pLength, uint32_t pDepth,
+             FS_list_callback pEach, void* pContext);
+
+int listDirectory(FS_descriptors* pDesc, const char* pPath, const char* pAfter, uint32_t pCount,
+                  FS_list_callback pEach, void* pContext);
+
+int makeDirectory(FS_descriptors* pDesc, const char* pPath);
+
+int addFile(FS_descriptors* pDesc, const char* pFilename);
+
+int addStream(FS_descriptors* pDesc, FILE* pFile, const uint8_t* pData, uint64_t pSize, const char* pName);
+
+int addPipe(FS_descriptors* pDesc, FILE* pFile, const char* pName);
+
+int newEntry(FS_descriptors* pDesc, const char* pName, uint32_t* pFile);
+
+int addEntry(FS_descriptors* pDesc, uint32_t pParent, const char* pName, uint8_t pFlags, uint32_t* pFile);
+
+ssize_t readFull(int pFd, uint8_t* pBuffer, size_t pSize);
+
+int getFile(FS_descriptors* pDesc, const char* pDest, const char* pFilename);
+
+int getStream(FS_descriptors* pDesc, FILE* pDest, FS_file_entry* pFile);
+
+int readFile(FS_descriptors* pDesc, uint8_t* pBuffer, FS_file_entry* pFile);
+
+int readRange(FS_descriptors* pDesc, FS_file_entry* pFile, uint64_t pOffset, uint64_t pSize, FILE* pDest,
+              uint8_t* pBuffer);
+
+int removeFile(FS_descriptors* pDesc, const char* pFile);
+
+void dropFile(FS_descriptors* pDesc, uint32_t pFile);
+
+uint32_t defragBlock(FS_descriptors* pDesc, uint32_t pBlock);
+
+int defragment(FS_descriptors* pDesc, uint32_t pMillis, FS_defrag_report* pReport);
+
+void fragmentation(FS_descriptors* pDesc, FS_fragmentation* pOut);
+
+int compact(FS_descriptors* pDesc, FS_defrag_state* pState);
+
+int rejoinFiles(FS_descriptors* pDesc, FS_defrag_state* pState);
+
+int moveBlock(FS_descriptors* pDesc, uint32_t pBlock, uint32_t pFree, FS_defrag_state* pState);
+
+int repointTable(FS_descriptors* pDesc, uint32_t pBlock, uint64_t pOffset);
+
+void splitBlock(FS_descriptors* pDesc, uint32_t pBlock, uint64_t pSize);
+
+void joinBlock(FS_descriptors* pDesc, uint32_t pBlock);
+
+uint32_t lowestFree(FS_descriptors* pDesc, uint32_t pAfter);
+
+int spareUnit(FS_descriptors* pDesc, FS_defrag_state* pState);
+
+int defragClaim(FS_descriptors* pDesc, FS_defrag_state* pState, uint64_t pOffset, uint64_t pSize);
+
+void defragFreed(FS_defrag_state* pState, uint64_t pOffset, uint64_t pSize);
+
+int defragCommit(FS_descriptors* pDesc, FS_defrag_state* pState);
+
+int defragExpired(FS_defrag_state* pState);
+
+int rangeCopy(FS_descriptors* pDesc, off_t pFrom, off_t pTo, uint64_t pSize);
+
+void sealBlock(FS_descriptors* pDesc, uint32_t pBlock, const uint8_t* pData);
+
+int extentChecksum(FS_descriptors* pDesc, uint64_t pOffset, uint64_t pSize, uint32_t* pCrc);
+
+void damage(FS_descriptors* pDesc, const char* pFormat, ...);
+
+int check(FS_descriptors* pDesc, FS_check_report* pReport);
+
+uint64_t claimChain(FS_descriptors* pDesc, uint8_t* pOwned, uint32_t pBlock, uint8_t pType, const char* pWhat);
+
+uint32_t claimTree(FS_descriptors* pDesc, uint8_t* pOwned, uint32_t pDirectory, FS_check_report* pReport);
+
+void claimNode(FS_descriptors* pDesc, uint8_t* pOwned, uint32_t pBlock, uint32_t pDepth, const uint8_t* pLow,
+               const uint8_t* pHigh, FS_tree_check* pWalk);
+
+int scrubDrive(FS_descriptors* pDesc, FILE* pOut, FS_scrub_report* pReport);
+
+void* scrubWorker(void* pJob);
+
+void scrubWindow(FS_scrub_job* pJob, uint32_t pWindow);
+
+const char* extentOwner(FS_descriptors* pDesc, uint32_t pBlock);
+
+int commitIfFull(FS_handle* pHandle);
+
+static uint64_t gears[256];
+static pthread_once_t gearsOnce = PTHREAD_ONCE_INIT;
+
+//HANDLE: readers share the lock and never move the stdio position of the drive, writers hold it alone
+struct FS_handle {
+    FS_descriptors desc;
+    pthread_rwlock_t lock;
+};
+
+int gfsCreate(const char* pPath, uint64_t pBytes, uint8_t pMode, uint8_t pPolicy) {
+    FILE* drive = fopen(pPath, "wb+");
+    int result;
+
+    if (drive == NULL)
+        return ST_CANT_OPEN;
+    result = createFS(drive, pBytes, pMode, pPolicy);
+    if (fclose(drive) != 0 && result == ST_OK)
+        result = ST_IO_ERROR;
+    return result;
+}
+
+FS_handle* gfsOpen(const char* pPath, uint8_t pMap, uint8_t pIo, int* pStatus) {
+    uint64_t start = metricBegin();
+    FS_handle* handle = calloc(1, sizeof(FS_handle));
+    FILE* drive;
+    int result;
+
+    if (handle == NULL) {
+        *pStatus = ST_NOT_ENOUGH_SPACE;
+        return NULL;
+    }
+    drive = fopen(pPath, "rb+");
+    if (drive == NULL) {
+        free(handle);
+        *pStatus = ST_CANT_OPEN;
+        return NULL;
+    }
+    handle->desc.io = pMap == MMAP_OFF ? ioStart(pIo) : NULL;
+    result = loadDescriptors(drive, &handle->desc, pMap);
+    metricTime(METRIC_LOAD, start);
+    if (result == ST_OK && (pthread_rwlock_init(&handle->lock, NULL) != 0 ||
+                            pthread_mutex_init(&handle->desc.chains_lock, NULL) != 0 ||
+                            pthread_mutex_init(&handle->desc.nodes_lock, NULL) != 0 ||
+                            metricInit(&handle->desc.metrics) != ST_OK))
+        result = ST_NOT_ENOUGH_SPACE;
+    if (result != ST_OK) {
+        discardDescriptors(&handle->desc);
+        ioStop(handle->desc.io);
+        fclose(drive);
+        free(handle);
+        handle = NULL;
+    } else
+        metricEnd(&handle->desc.metrics, METRIC_OPEN, start, pPath);
+    *pStatus = result;
+    return handle;
+}
+
+int gfsClose(FS_handle* pHandle) {
+    int result = gfsFlush(pHandle);
+
+    discardDescriptors(&pHandle->desc);
+    ioStop(pHandle->desc.io);
+    if (fclose(pHandle->desc.drive) != 0 && result == ST_OK)
+        result = ST_IO_ERROR;
+    pthread_rwlock_destroy(&pHandle->lock);
+    pthread_mutex_destroy(&pHandle->desc.chains_lock);
+    pthread_mutex_destroy(&pHandle->desc.nodes_lock);
+    metricRelease(&pHandle->desc.metrics);
+    free(pHandle);
+    return result;
+}
+
+int gfsPolicy(FS_handle* pHandle, uint8_t pPolicy) {
+    if (pPolicy != POLICY_CONTIGUOUS && pPolicy != POLICY_FIRST)
+        return ST_INVALID_COMMAND;
+    pthread_rwlock_wrlock(&pHandle->lock);
+    pHandle->desc.policy = pPolicy;
+    pthread_rwlock_unlock(&pHandle->lock);
+    return ST_OK;
+}
+
+int gfsCompression(FS_handle* pHandle, uint8_t pOn) {
+#ifndef GFS_COMPRESSION
+    if (pOn)
+        return ST_INVALID_COMMAND;
+#endif
+    pthread_rwlock_wrlock(&pHandle->lock);
+    pHandle->desc.compress = pOn != 0;
+    pthread_rwlock_unlock(&pHandle->lock);
+    return ST_OK;
+}
+
+int gfsDedup(FS_handle* pHandle, uint8_t pOn) {
+    pthread_rwlock_wrlock(&pHandle->lock);
+    pHandle->desc.dedup = pOn != 0;
+    pthread_rwlock_unlock(&pHandle->lock);
+    return ST_OK;
+}
+
+int gfsChecksums(FS_handle* pHandle, uint8_t pOn) {
+    pthread_rwlock_wrlock(&pHandle->lock);
+    pHandle->desc.checksum = pOn != 0;
+    pthread_rwlock_unlock(&pHandle->lock);
+    return ST_OK;
+}
+
+int gfsFlush(FS_handle* pHandle) {
+    uint64_t start = metricBegin();
+    int result = ST_OK;
+
+    pthread_rwlock_wrlock(&pHandle->lock);
+    if (pHandle->desc.dirty_bytes > 0) {
+        uint64_t saving = metricClock();
+        result = saveDescriptors(&pHandle->desc);
+        metricTime(METRIC_SAVE, saving);
+    }
+    pthread_rwlock_unlock(&pHandle->lock);
+    metricEnd(&pHandle->desc.metrics, METRIC_FLUSH, start, NULL);
+    return result;
+}
+
+int gfsAdd(FS_handle* pHandle, const char* pName, const void* pData, uint64_t pSize) {
+    uint64_t start = metricBegin();
+    int result;
+
+    pthread_rwlock_wrlock(&pHandle->lock);
+    result = addStream(&pHandle->desc, NULL, pData, pSize, pName);
+    if (result == ST_OK)
+        result = commitIfFull(pHandle);
+    pthread_rwlock_unlock(&pHandle->lock);
+    metricEnd(&pHandle->desc.metrics, METRIC_ADD, start, pName);
+    return result;
+}
+
+int gfsAddFile(FS_handle* pHandle, const char* pPath) {
+    uint64_t start = metricBegin();
+    int result;
+
+    pthread_rwlock_wrlock(&pHandle->lock);
+    result = addFile(&pHandle->desc, pPath);
+    if (result == ST_OK)
+        result = commitIfFull(pHandle);
+    pthread_rwlock_unlock(&pHandle->lock);
+    metricEnd(&pHandle->desc.metrics, METRIC_ADD, start, pPath);
+    return result;
+}
+
+int gfsAddStream(FS_handle* pHandle, FILE* pFile, uint64_t pSize, const char* pName) {
+    uint64_t start = metricBegin();
+    int result;
+
+    pthread_rwlock_wrlock(&pHandle->lock);
+    result = addStream(&pHandle->desc, pFile, NULL, pSize, pName);
+    if (result == ST_OK)
+        result = commitIfFull(pHandle);
+    pthread_rwlock_unlock(&pHandle->lock);
+    metricEnd(&pHandle->desc.metrics, METRIC_ADD, start, pName);
+    return result;
+}
+
+int gfsAddPipe(FS_handle* pHandle, FILE* pFile, const char* pName) {
+    uint64_t start = metricBegin();
+    int result;
+
+    pthread_rwlock_wrlock(&pHandle->lock);
+    result = addPipe(&pHandle->desc, pFile, pName);
+    if (result == ST_OK)
+        result = commitIfFull(pHandle);
+    pthread_rwlock_unlock(&pHandle->lock);
+    metricEnd(&pHandle->desc.metrics, METRIC_ADD, start, pName);
+    return result;
+}
+
+int gfsRemove(FS_handle* pHandle, const char* pName) {
+    uint64_t start = metricBegin();
+    int result;
+
+    pthread_rwlock_wrlock(&pHandle->lock);
+    result = removeFile(&pHandle->desc, pName);
+    if (result == ST_OK)
+        result = commitIfFull(pHandle);
+    pthread_rwlock_unlock(&pHandle->lock);
+    metricEnd(&pHandle->desc.metrics, METRIC_REMOVE, start, pName);
+    return result;
+}
+
+int gfsMakeDir(FS_handle* pHandle, const char* pPath) {
+    uint64_t start = metricBegin();
+    int result;
+
+    pthread_rwlock_wrlock(&pHandle->lock);
+    result = makeDirectory(&pHandle->desc, pPath);
+    if (result == ST_OK)
+        result = commitIfFull(pHandle);
+    pthread_rwlock_unlock(&pHandle->lock);
+    metricEnd(&pHandle->desc.metrics, METRIC_MKDIR, start, pPath);
+    return result;
+}
+
+int gfsDefrag(FS_handle* pHandle, uint32_t pMillis, FS_defrag_report* pReport) {
+    uint64_t start = metricBegin();
+    int result;
+
+    pthread_rwlock_wrlock(&pHandle->lock);
+    result = defragment(&pHandle->desc, pMillis, pReport);
+    pthread_rwlock_unlock(&pHandle->lock);
+    metricEnd(&pHandle->desc.metrics, METRIC_DEFRAG, start, NULL);
+    return result;
+}
+
+int gfsRead(FS_handle* pHandle, const char* pName, void* pBuffer, uint64_t pCapacity, uint64_t* pSize) {
+    uint64_t start = metricBegin();
+    FS_file_entry file;
+    int result;
+
+    pthread_rwlock_rdlock(&pHandle->lock);
+    result = findFile(&file, NULL, &pHandle->desc, pName);
+    if (result == ST_OK) {
+        *pSize = file.size;
+        if (file.size > pCapacity)
+            result = ST_NOT_ENOUGH_SPACE;
+        else
+            result = readFile(&pHandle->desc, pBuffer, &file);
+    }
+    pthread_rwlock_unlock(&pHandle->lock);
+    metricEnd(&pHandle->desc.metrics, METRIC_READ, start, pName);
+    return result;
+}
+
+int gfsPread(FS_handle* pHandle, const char* pName, void* pBuffer, uint64_t pSize, uint64_t pOffset, uint64_t* pRead) {
+    uint64_t start = metricBegin();
+    FS_file_entry file;
+    int result;
+
+    *pRead = 0;
+    pthread_rwlock_rdlock(&pHandle->lock);
+    result = findFile(&file, NULL, &pHandle->desc, pName);
+    if (result == ST_OK && pOffset < file.size) {
+        *pRead = file.size - pOffset < pSize ? file.size - pOffset : pSize;
+        result = readRange(&pHandle->desc, &file, pOffset, *pRead, NULL, pBuffer);
+    }
+    pthread_rwlock_unlock(&pHandle->lock);
+    metricEnd(&pHandle->desc.metrics, METRIC_READ, start, pName);
+    return result;
+}
+
+int gfsSize(FS_handle* pHandle, const char* pName, uint64_t* pSize) {
+    FS_file_entry file;
+    int result;
+
+    pthread_rwlock_rdlock(&pHandle->lock);
+    result = findFile(&file, NULL, &pHandle->desc, pName);
+    if (result == ST_OK)
+        *pSize = file.size;
+    pthread_rwlock_unlock(&pHandle->lock);
+    return result;
+}
+
+int gfsGetFile(FS_handle* pHandle, const char* pName, const char* pDest) {
+    uint64_t start = metricBegin();
+    int result;
+
+    pthread_rwlock_rdlock(&pHandle->lock);
+    result = getFile(&pHandle->desc, pDest, pName);
+    pthread_rwlock_unlock(&pHandle->lock);
+    metricEnd(&pHandle->desc.metrics, METRIC_READ, start, pName);
+    return result;
+}
+
+int gfsGetStream(FS_handle* pHandle, const char* pName, FILE* pDest) {
+    uint64_t start = metricBegin();
+    FS_file_entry file;
+    int result;
+
+    pthread_rwlock_rdlock(&pHandle->lock);
+    result = findFile(&file, NULL, &pHandle->desc, pName);
+    if (result == ST_OK)
+        result = getStream(&pHandle->desc, pDest, &file);
+    pthread_rwlock_unlock(&pHandle->lock);
+    metricEnd(&pHandle->desc.metrics, METRIC_READ, start, pName);
+    return result;
+}
+
+int gfsGetRange(FS_handle* pHandle, const char* pName, uint64_t pOffset, uint64_t pSize, FILE* pDest) {
+    uint64_t start = metricBegin();
+    FS_file_entry file;
+    int result;
+
+    pthread_rwlock_rdlock(&pHandle->lock);
+    result = findFile(&file, NULL, &pHandle->desc, pName);
+    if (result == ST_OK && pOffset < file.size)
+        result = readRange(&pHandle->desc, &file, pOffset, file.size - pOffset < pSize ? file.size - pOffset : pSize,
+                           pDest, NULL);
+    pthread_rwlock_unlock(&pHandle->lock);
+    metricEnd(&pHandle->desc.metrics, METRIC_READ, start, pName);
+    return result;
+}
+
+int gfsList(FS_handle* pHandle, FS_list_callback pEach, void* pContext) {
+    uint64_t start = metricBegin();
+    int result;
+
+    pthread_rwlock_rdlock(&pHandle->lock);
+    result = list(&pHandle->desc, pEach, pContext);
+    pthread_rwlock_unlock(&pHandle->lock);
+    metricEnd(&pHandle->desc.metrics, METRIC_LIST, start, NULL);
+    return result;
+}
+
+int gfsListDir(FS_handle* pHandle, const char* pPath, const char* pAfter, uint32_t pCount, FS_list_callback pEach,
+               void* pContext) {
+    uint64_t start = metricBegin();
+    int result;
+
+    pthread_rwlock_rdlock(&pHandle->lock);
+    result = listDirectory(&pHandle->desc, pPath, pAfter, pCount, pEach, pContext);
+    pthread_rwlock_unlock(&pHandle->lock);
+    metricEnd(&pHandle->desc.metrics, METRIC_LIST, start, pPath);
+    return result;
+}
+
+int gfsStatus(FS_handle* pHandle, FILE* pOut) {
+    int result;
+
+    pthread_rwlock_rdlock(&pHandle->lock);
+    result = status(&pHandle->desc, pOut);
+    pthread_rwlock_unlock(&pHandle->lock);
+    return result;
+}
+
+int gfsFragmentation(FS_handle* pHandle, FS_fragmentation* pOut) {
+    pthread_rwlock_rdlock(&pHandle->lock);
+    fragmentation(&pHandle->desc, pOut);
+    pthread_rwlock_unlock(&pHandle->lock);
+    return ST_OK;
+}
+
+int gfsTrace(FS_handle* pHandle, FILE* pOut) {
+    pthread_mutex_lock(&pHandle->desc.metrics.lock);
+    pHandle->desc.metrics.trace = pOut;
+    pthread_mutex_unlock(&pHandle->desc.metrics.lock);
+    return ST_OK;
+}
+
+int gfsStats(FS_handle* pHandle, FILE* pOut, uint8_t pFormat) {
+    if (pFormat != STATS_TEXT && pFormat != STATS_JSON)
+        return ST_INVALID_COMMAND;
+    metricWrite(&pHandle->desc.metrics, pOut, pFormat);
+    return ST_OK;
+}
+
+//Loads the drive to look at it: damage is reported rather than refused. The journal replay is the only write, the
+//same one the next open would make; nothing else is saved.
+int gfsCheck(const char* pPath, FILE* pOut, FS_check_report* pReport) {
+    FS_descriptors desc;
+    FILE* drive = fopen(pPath, "rb+");
+    int result;
+
+    memset(pReport, 0, sizeof(FS_check_report));
+    if (drive == NULL)
+        return ST_CANT_OPEN;
+    memset(&desc, 0, sizeof(desc));
+    desc.checking = 1;
+    desc.check_out = pOut;
+    desc.io = ioStart(IO_AUTO);
+    pthread_mutex_init(&desc.nodes_lock, NULL);
+    result = loadDescriptors(drive, &desc, MMAP_OFF);
+    if (result == ST_OK)
+        result = check(&desc, pReport);
+    pReport->problems = desc.damaged;
+    if (result == ST_OK && desc.damaged > 0)
+        result = ST_CORRUPT;
+    discardDescriptors(&desc);
+    pthread_mutex_destroy(&desc.nodes_lock);
+    ioStop(desc.io);
+    fclose(drive);
+    return result;
+}
+
+int gfsScrub(FS_handle* pHandle, FILE* pOut, FS_scrub_report* pReport) {
+    uint64_t start = metricBegin();
+    int result;
+
+    pthread_rwlock_rdlock(&pHandle->lock);
+    result = scrubDrive(&pHandle->desc, pOut, pReport);
+    pthread_rwlock_unlock(&pHandle->lock);
+    metricEnd(&pHandle->desc.metrics, METRIC_SCRUB, start, NULL);
+    return result;
+}
+
+//Commits early rather than outgrow the journal; the caller holds the lock for writing
+int commitIfFull(FS_handle* pHandle) {
+    FS_descriptors* desc = &pHandle->desc;
+    uint64_t start = metricClock();
+    int result;
+
+    if (desc->dirty_bytes <= desc->info_block->journal_size / 2)
+        return ST_OK;
+    result = saveDescriptors(desc);
+    metricTime(METRIC_SAVE, start);
+    return result;
+}
+
+int createFS(FILE* pDrive, uint64_t pBytes, uint8_t pMode, uint8_t pPolicy) {
+    FS_info header;
+    FS_directory_table directoryTable;
+    FS_allocation_table allocationTable;
+    FS_journal_header journal;
+    int fd = fileno(pDrive);
+    uint32_t journalSize = pBytes / 256 > FS_JOURNAL_MAX ? FS_JOURNAL_MAX : (uint32_t) (pBytes / 256);
+
+    if (journalSize < FS_JOURNAL_MIN)
+        journalSize = FS_JOURNAL_MIN;
+    off_t total = (off_t) (FS_DATA_OFFSET) + pBytes + journalSize;
+
+    header.magic[0] = 'G';
+    header.magic[1] = 'F';
+    header.magic[2] = 'S';
+    strncpy((char*) header.version, FS_VERSION, 5);
+    header.size = pBytes;
+    header.free = pBytes;
+    header.allocation_tables = 1;
+    header.directory_tables = 1;
+    header.format = FS_FORMAT;
+    header.name_index = FS_ENDPOINT;
+    header.dedup_index = FS_ENDPOINT;
+    header.root = FS_ENDPOINT;
+    header.journal_size = journalSize;
+    header.policy = pPolicy;
+
+    memset(&allocationTable, 0, sizeof(allocationTable));
+    memset(&directoryTable, 0, sizeof(directoryTable));
+    allocationTable.offset_next = FS_ENDPOINT;
+    allocationTable.unused_units = FS_ALLOC_UNITS - 1;
+    allocationTable.units[0].type = FS_FREE;
+    allocationTable.units[0].offset = 0;
+    allocationTable.units[0].size = pBytes;
+    allocationTable.units[0].next_block = FS_ENDPOINT;
+    for (uint32_t i = 1; i < FS_ALLOC_UNITS; ++i)
+        allocationTable.units[i].type = FS_UNUSED;
+
+    allocationTable.checksum = crc32c(0, &allocationTable, offsetof(FS_allocation_table, checksum));
+    directoryTable.offset_next = FS_ENDPOINT;
+    directoryTable.checksum = crc32c(0, &directoryTable, offsetof(FS_directory_table, checksum));
+
+    fwrite(&header, sizeof(header), 1, pDrive);
+    fwrite(&allocationTable, sizeof(allocationTable), 1, pDrive);
+    fwrite(&directoryTable, sizeof(directoryTable), 1, pDrive);
+    if (fflush(pDrive) != 0)
+        return ST_IO_ERROR;
+
+    //SIZE THE DATA REGION
+    if (pMode == CREATE_SPARSE) {
+        if (ftruncate(fd, total) != 0)
+            return ST_IO_ERROR;
+    } else if (pMode == CREATE_PREALLOC) {
+        if (posix_fallocate(fd, 0, total) != 0)
+            return ST_IO_ERROR;
+    } else {
+        uint8_t* zeros = calloc(1, ZERO_CHUNK);
+        uint64_t left = (uint64_t) pBytes + journalSize;
+        if (zeros == NULL)
+            return ST_IO_ERROR;
+        while (left > 0) {
+            size_t chunk = left > ZERO_CHUNK ? ZERO_CHUNK : left;
+            if (fwrite(zeros, 1, chunk, pDrive) != chunk) {
+                free(zeros);
+                return ST_IO_ERROR;
+            }
+            left -= chunk;
+        }
+        free(zeros);
+    }
+
+    //EMPTY JOURNAL
+    journal.magic = FS_JOURNAL_MAGIC;
+    journal.epoch = 0;
+    fseeko(pDrive, journalOffset(&header), SEEK_SET);
+    if (fwrite(&journal, sizeof(journal), 1, pDrive) != 1 || fflush(pDrive) != 0)
+        return ST_IO_ERROR;
+
+    return ST_OK;
+}
+
+int addFile(FS_descriptors* pDesc, const char* pFilename) {
+    FILE* file;
+    off_t size;
+    int result;
+
+    file = fopen(pFilename, "rb");
+    if (file == NULL)
+        return ST_CANT_OPEN;
+
+    size = fsize(file);
+    result = size < 0 ? ST_IO_ERROR : addStream(pDesc, file, NULL, (uint64_t) size, pFilename);
+    fclose(file);
+    return result;
+}
+
+//Stores pSize bytes from pData, or read from pFile's current position when pData is NULL, as pName
+int addStream(FS_descriptors* pDesc, FILE* pFile, const uint8_t* pData, uint64_t pSize, const char* pName) {
+    uint64_t size = pSize;
+    uint32_t file_idx = 0;
+    FS_file_entry* file_entry = NULL;
+    uint8_t* plain = NULL;
+    uint8_t* packed = NULL;
+    int result;
+
+    //a compressed or deduplicated file may fit where the plain one would not
+    if (pDesc->info_block->free < size && size > FS_INLINE_MAX && !pDesc->compress && !pDesc->dedup)
+        return ST_NOT_ENOUGH_SPACE;
+
+    if ((result = newEntry(pDesc, pName, &file_idx)) != ST_OK)
+        return result;
+    file_entry = getEntry(pDesc, file_idx);
+    file_entry->size = size;
+    file_entry->flags = size <= FS_INLINE_MAX ? FS_ENTRY_INLINE : 0;
+
+    //INLINE: no unit, no extent split, and the directory table already being saved carries the data
+    if (file_entry->flags & FS_ENTRY_INLINE) {
+        if (pData != NULL)
+            memcpy(file_entry->data, pData, size);
+        else if (streamCopy(pFile, file_entry->data, size, DIR_FROM_FILE) != ST_OK) {
+            dropFile(pDesc, file_idx);
+            return ST_IO_ERROR;
+        }
+        return ST_OK;
+    }
+
+    //a stream is read whole first when compression has to find out whether it pays, or dedup has to cut it
+    if ((pDesc->compress || pDesc->dedup) && pData == NULL) {
+        plain = malloc(pSize);
+        if (plain == NULL || streamCopy(pFile, plain, pSize, DIR_FROM_FILE) != ST_OK) {
+            free(plain);
+            dropFile(pDesc, file_idx);
+            return ST_IO_ERROR;
+        }
+        pData = plain;
+    }
+
+    if (pDesc->dedup) {
+        file_entry->flags |= FS_ENTRY_DEDUP;
+        result = dedupStore(pDesc, file_entry, pData, pSize);
+    } else {
+        if (pDesc->compress && (packed = packChunks(pData, pSize, &size)) != NULL) {
+            file_entry->flags |= FS_ENTRY_COMPRESSED;
+            pData = packed;
+        }
+        result = writeChain(pDesc, pFile, pData, size, &file_entry->block);
+    }
+    free(plain);
+    free(packed);
+
+    //ROLL BACK, so a failed add leaves neither the entry nor its blocks behind
+    if (result != ST_OK) {
+        dropFile(pDesc, file_idx);
+        return result;
+    }
+    return ST_OK;
+}
+
+//Stores everything read from pFile until its end as pName, taking extents as the data arrives and only as much of the
+//last one as it filled. Compression and dedup need the whole file, so with them it is read in first.
+int addPipe(FS_descriptors* pDesc, FILE* pFile, const char* pName) {
+    int fd = fileno(pFile);
+    size_t capacity = COPY_CHUNK;
+    uint8_t* buffer = malloc(capacity);
+    ssize_t held = buffer != NULL ? readFull(fd, buffer, FS_INLINE_MAX + 1) : -1;
+    uint64_t total = 0;
+    uint32_t last = FS_ENDPOINT;
+    uint32_t file;
+    int result;
+
+    if (held < 0) {
+        free(buffer);
+        return ST_IO_ERROR;
+    }
+
+    //WHOLE: small enough to inline, or compressed or deduplicated
+    if (held <= FS_INLINE_MAX || pDesc->compress || pDesc->dedup) {
+        ssize_t got = held;
+        while (got > 0) {
+            if ((size_t) held == capacity) {
+                uint8_t* grown = capacity < SIZE_MAX / 2 ? realloc(buffer, capacity * 2) : NULL;
+                if (grown == NULL) {
+                    free(buffer);
+                    return ST_NOT_ENOUGH_SPACE;
+                }
+                buffer = grown;
+                capacity *= 2;
+            }
+            got = readFull(fd, buffer + held, capacity - held);
+            held += got;
+        }
+        result = got < 0 ? ST_IO_ERROR : addStream(pDesc, NULL, buffer, (uint64_t) held, pName);
+        free(buffer);
+        return result;
+    }
+
+    if ((result = newEntry(pDesc, pName, &file)) != ST_OK) {
+        free(buffer);
+        return result;
+    }
+
+    //EXTENTS the policy picks for a file of unknown size, each filled before the next is taken
+    while (result == ST_OK && held > 0) {
+        uint32_t block;
+        FS_allocation_unit* unit;
+        uint64_t used = 0;
+        uint32_t crc = 0;
+
+        if (findBlock(pDesc, FS_UNUSED) == FS_ENDPOINT && createAllocationBlock(pDesc) != ST_OK) {
+            result = ST_NOT_ENOUGH_SPACE;
+            break;
+        }
+        if ((block = pickBlock(pDesc, UINT64_MAX)) == FS_ENDPOINT) {
+            result = ST_NOT_ENOUGH_SPACE;
+            break;
+        }
+        unit = getUnit(pDesc, block);
+        while (held > 0 && used < unit->size) {
+            uint64_t size = (uint64_t) held < unit->size - used ? (uint64_t) held : unit->size - used;
+            FS_allocation_unit part = {FS_OCCUPIED, FS_ENDPOINT, unit->offset + used, size};
+            if (bufferCopy(pDesc, buffer, &part, DIR_FROM_FILE) != ST_OK) {
+                result = ST_IO_ERROR;
+                break;
+            }
+            crc = crc32c(crc, buffer, size);
+            used += size;
+            held -= size;
+            if (held > 0)
+                memmove(buffer, buffer + size, held);
+            else if ((held = readFull(fd, buffer, capacity)) < 0)
+                result = ST_IO_ERROR;
+        }
+        if (used == 0)
+            continue;
+
+        takeBlock(pDesc, block, used, FS_OCCUPIED);
+        if (pDesc->checksum) {
+            getUnit(pDesc, block)->flags = FS_UNIT_CHECKED;
+            getUnit(pDesc, block)->checksum = crc;
+        }
+        if (last != FS_ENDPOINT) {
+            getUnit(pDesc, last)->next_block = block;
+            touchAllocation(pDesc, last);
+        } else
+            getEntry(pDesc, file)->block = block;
+        last = block;
+        total += used;
+    }
+    free(buffer);
+
+    if (result != ST_OK) {
+        dropFile(pDesc, file);
+        return result;
+    }
+    getEntry(pDesc, file)->size = total;
+    touchDirectory(pDesc, file);
+    return ST_OK;
+}
+
+//Takes a free directory record for pName, empty until the caller fills it in; the directories it is in are made first
+int newEntry(FS_descriptors* pDesc, const char* pName, uint32_t* pFile) {
+    char name[FS_MAX_NAME];
+    uint32_t parent;
+    int result;
+
+    if ((result = findParent(pDesc, pName, 1, &parent, name)) != ST_OK)
+        return result;
+    if ((result = childFind(pDesc, parent, name, pFile)) != ST_NOT_FOUND)
+        return result == ST_OK ? ST_EXISTS : result;
+    return addEntry(pDesc, parent, name, 0, pFile);
+}
+
+//Takes a free directory record for pName in directory pParent and files it in the name index and the B+tree
+int addEntry(FS_descriptors* pDesc, uint32_t pParent, const char* pName, uint8_t pFlags, uint32_t* pFile) {
+    FS_file_entry* file_entry = NULL;
+    int result;
+
+    if (indexReserve(pDesc) != ST_OK)
+        return ST_NOT_ENOUGH_SPACE;
+
+    //FIND EMPTY FILE RECORD, no table before directory_free has one
+    for (uint32_t dir_block = pDesc->directory_free; dir_block < pDesc->info_block->directory_tables; ++dir_block) {
+        if (file_entry != NULL)
+            break;
+        if (pDesc->directory_table[dir_block]->files_flags == (1 << FS_DIRECTORY_FILES) - 1)
+            continue;
+        metricCount(COUNT_TABLES, 1);
+        for (uint32_t dir_position = 0; dir_position < FS_DIRECTORY_FILES; ++dir_position)
+            if (((~pDesc->directory_table[dir_block]->files_flags) >> (dir_position)) & 1) {
+                file_entry = &pDesc->directory_table[dir_block]->files[dir_position];
+                *pFile = dir_block * FS_DIRECTORY_FILES + dir_position;
+                pDesc->directory_table[dir_block]->files_flags |= (1 << dir_position);
+                pDesc->directory_free = dir_block;
+                touchDirectory(pDesc, *pFile);
+                break;
+            }
+    }
+
+    if (file_entry == NULL) {
+        if (createDirectoryBlock(pDesc) != ST_OK)
+            return ST_NOT_ENOUGH_SPACE;
+        FS_directory_table* dir = pDesc->directory_table[pDesc->info_block->directory_tables - 1];
+        file_entry = &dir->files[0];
+        *pFile = (pDesc->info_block->directory_tables - 1) * FS_DIRECTORY_FILES;
+        dir->files_flags |= 1;
+        pDesc->directory_free = pDesc->info_block->directory_tables - 1;
+        touchDirectory(pDesc, *pFile);
+    }
+
+    file_entry->size = 0;
+    file_entry->block = FS_ENDPOINT;
+    file_entry->flags = pFlags;
+    file_entry->created = (uint64_t) time(NULL);
+    file_entry->parent = pParent;
+    file_entry->tree = FS_ENDPOINT;
+    strncpy((char*) file_entry->name, pName, FS_MAX_NAME - 1);
+    file_entry->name[FS_MAX_NAME - 1] = 0;
+    memset(file_entry->data, 0, FS_INLINE_MAX);
+    indexInsert(pDesc, *pFile);
+
+    if ((result = treeInsert(pDesc, pParent, (const char*) file_entry->name, *pFile)) != ST_OK) {
+        indexRemove(pDesc, *pFile);
+        pDesc->directory_table[*pFile / FS_DIRECTORY_FILES]->files_flags &= ~(1 << (*pFile % FS_DIRECTORY_FILES));
+        return result;
+    }
+    return ST_OK;
+}
+
+//Reads until pSize bytes or the end of the input, whichever comes first
+ssize_t readFull(int pFd, uint8_t* pBuffer, size_t pSize) {
+    size_t done = 0;
+
+    while (done < pSize) {
+        ssize_t got = read(pFd, pBuffer + done, pSize - done);
+        if (got < 0)
+            return -1;
+        if (got == 0)
+            break;
+        done += (size_t) got;
+    }
+    return (ssize_t) done;
+}
+
+//Stores pSize bytes from pData, or read from pFile's current position when pData is NULL, in the extents the policy
+//picks, linked from *pFirst on. Nothing stays taken on failure.
+int writeChain(FS_descriptors* pDesc, FILE* pFile, const uint8_t* pData, uint64_t pSize, uint32_t* pFirst) {
+    uint64_t size = pSize;
+    uint32_t freeBlock;
+    FS_allocation_unit* fsUnit;
+    FS_allocation_unit* lastUnit = NULL;
+    FS_io_request requests[FS_IO_DEPTH];
+    uint32_t queued = 0;
+    int result = ST_OK;
+
+    *pFirst = FS_ENDPOINT;
+    while (size != 0) {
+        freeBlock = pickBlock(pDesc, size);
+        if (freeBlock == FS_ENDPOINT) {
+            result = ST_NOT_ENOUGH_SPACE;
+            break;
+        }
+
+        fsUnit = getUnit(pDesc, freeBlock);
+        if (fsUnit->size > size) {
+            if (findBlock(pDesc, FS_UNUSED) == FS_ENDPOINT) {
+                if (createAllocationBlock(pDesc) != ST_OK) {
+                    result = ST_NOT_ENOUGH_SPACE;
+                    break;
+                }
+                freeBlock = pickBlock(pDesc, size);
+                if (freeBlock == FS_ENDPOINT) {
+                    result = ST_NOT_ENOUGH_SPACE;
+                    break;
+                }
+                fsUnit = getUnit(pDesc, freeBlock);
+            }
+        }
+
+        takeBlock(pDesc, freeBlock, fsUnit->size > size ? size : fsUnit->size, FS_OCCUPIED);
+
+        if (lastUnit != NULL)
+            lastUnit->next_block = freeBlock;   //its table is dirty since takeBlock
+        else
+            *pFirst = freeBlock;
+        lastUnit = fsUnit;
+
+        if ((pData != NULL ? queueCopy(pDesc, requests, &queued, (uint8_t*) pData + (pSize - size), fsUnit, DIR_FROM_FILE)
+                           : blockCopy(pDesc, pFile, fsUnit, fsUnit->size, DIR_FROM_FILE)) != ST_OK) {
+            result = ST_IO_ERROR;
+            break;
+        }
+        if (pDesc->checksum)
+            sealBlock(pDesc, freeBlock, pData != NULL ? pData + (pSize - size) : NULL);
+        size -= fsUnit->size;
+    }
+    if (flushCopies(pDesc, requests, &queued) != ST_OK)
+        result = ST_IO_ERROR;
+
+    if (result != ST_OK) {
+        releaseChain(pDesc, *pFirst);
+        *pFirst = FS_ENDPOINT;
+    }
+    return result;
+}
+
+void releaseChain(FS_descriptors* pDesc, uint32_t pBlock) {
+    while (pBlock != FS_ENDPOINT) {
+        uint32_t next = getUnit(pDesc, pBlock)->next_block;
+        releaseBlock(pDesc, pBlock);
+        pBlock = next;
+    }
+}
+
+//Writes the extents from pBlock on at pDest's file position, or into pBuffer when pDest is NULL
+int copyChain(FS_descriptors* pDesc, uint32_t pBlock, FILE* pDest, uint8_t* pBuffer) {
+    FS_io_request requests[FS_IO_DEPTH];
+    uint32_t queued = 0;
+
+    while (pBlock != FS_ENDPOINT) {
+        FS_allocation_unit* unit = getUnit(pDesc, pBlock);
+        if ((pDest != NULL ? blockCopy(pDesc, pDest, unit, unit->size, DIR_TO_FILE)
+                           : queueCopy(pDesc, requests, &queued, pBuffer, unit, DIR_TO_FILE)) != ST_OK)
+            return ST_IO_ERROR;
+        pBuffer += unit->size;
+        pBlock = unit->next_block;
+    }
+    return flushCopies(pDesc, requests, &queued);
+}
+
+int getFile(FS_descriptors* pDesc, const char* pDest, const char* pFilename) {
+    FS_file_entry file;
+    FILE* dest;
+    int result;
+
+    if ((result = findFile(&file, NULL, pDesc, pFilename)) != ST_OK)
+        return result;
+
+    dest = fopen(pDest, "wb+");
+    if (dest == NULL)
+        return ST_CANT_OPEN;
+
+    result = getStream(pDesc, dest, &file);
+    fclose(dest);
+    return result;
+}
+
+//Writes the contents of pFile at pDest's current position
+int getStream(FS_descriptors* pDesc, FILE* pDest, FS_file_entry* pFile) {
+    return readRange(pDesc, pFile, 0, pFile->size, pDest, NULL);
+}
+
+//Copies the contents of pFile into pBuffer, which holds at least pFile->size bytes
+int readFile(FS_descriptors* pDesc, uint8_t* pBuffer, FS_file_entry* pFile) {
+    return readRange(pDesc, pFile, 0, pFile->size, NULL, pBuffer);
+}
+
+//Writes pSize plain bytes of pFile from pOffset on at pDest's file position, or into pBuffer when pDest is NULL.
+//The range must lie within the file.
+int readRange(FS_descriptors* pDesc, FS_file_entry* pFile, uint64_t pOffset, uint64_t pSize, FILE* pDest,
+              uint8_t* pBuffer) {
+    FS_extent_cursor cursor;
+
+    if (pFile->flags & FS_ENTRY_INLINE) {
+        if (pDest != NULL)
+            return streamCopy(pDest, pFile->data + pOffset, pSize, DIR_TO_FILE);
+        memcpy(pBuffer, pFile->data + pOffset, pSize);
+        return ST_OK;
+    }
+    if (pFile->flags & FS_ENTRY_COMPRESSED)
+        return unpackRange(pDesc, pFile, pOffset, pSize, pDest, pBuffer);
+    if (pFile->flags & FS_ENTRY_DEDUP)
+        return dedupRange(pDesc, pFile, pOffset, pSize, pDest, pBuffer);
+    if (chainSeek(pDesc, pFile->block, pOffset, &cursor) != ST_OK)
+        return ST_IO_ERROR;
+    return cursorCopy(pDesc, &cursor, pSize, pDest, pBuffer);
+}
+
+//A directory goes only once it is empty
+int removeFile(FS_descriptors* pDesc, const char* pFile) {
+    uint32_t file_idx;
+    int result;
+
+    if ((result = findEntry(pDesc, pFile, &file_idx)) != ST_OK)
+        return result;
+    if (getEntry(pDesc, file_idx)->flags & FS_ENTRY_DIRECTORY && getEntry(pDesc, file_idx)->tree != FS_ENDPOINT)
+        return ST_NOT_EMPTY;
+
+    dropFile(pDesc, file_idx);
+
+    return ST_OK;
+}
+
+void dropFile(FS_descriptors* pDesc, uint32_t pFile) {
+    FS_file_entry* entry = getEntry(pDesc, pFile);
+
+    if (entry->flags & FS_ENTRY_DEDUP)
+        dedupDrop(pDesc, entry);
+    releaseChain(pDesc, entry->block);
+    indexRemove(pDesc, pFile);
+    treeRemove(pDesc, entry->parent, (const char*) entry->name);
+    pDesc->directory_table[pFile / FS_DIRECTORY_FILES]->files_flags &= ~(1 << (pFile % FS_DIRECTORY_FILES));
+    touchDirectory(pDesc, pFile);
+    if (pFile / FS_DIRECTORY_FILES < pDesc->directory_free)
+        pDesc->directory_free = pFile / FS_DIRECTORY_FILES;
+}
+
+int makeDirectory(FS_descriptors* pDesc, const char* pPath) {
+    uint32_t file;
+    int result = newEntry(pDesc, pPath, &file);
+
+    if (result != ST_OK)
+        return result;
+    getEntry(pDesc, file)->flags = FS_ENTRY_INLINE | FS_ENTRY_DIRECTORY;
+    return ST_OK;
+}
+
+int list(FS_descriptors* pDesc, FS_list_callback pEach, void* pContext) {
+    char path[(FS_MAX_DEPTH + 1) * FS_MAX_NAME];
+    int result = listTree(pDesc, FS_ENDPOINT, path, 0, 0, pEach, pContext);
+
+    return result > 0 ? ST_OK : result;
+}
+
+//Every file under pDirectory, whose path takes the first pLength bytes of pPath, depth first in name order. A positive
+//result once pEach stopped it.
+int listTree(FS_descriptors* pDesc, uint32_t pDirectory, char* pPath, size_t pLength, uint32_t pDepth,
+             FS_list_callback pEach, void* pContext) {
+    FS_tree_cursor cursor;
+    FS_tree_record* record;
+    int result;
+
+    if (pDepth > FS_MAX_DEPTH)
+        return ST_CORRUPT;
+    result = treeSeek(pDesc, pDirectory, NULL, &cursor);
+    while (result == ST_OK && (result = treeStep(pDesc, &cursor, &record)) == ST_OK && record != NULL) {
+        FS_file_entry* entry = getEntry(pDesc, record->target);
+        size_t length = strnlen((const char*) entry->name, FS_MAX_NAME - 1);
+
+        memcpy(pPath + pLength, entry->name, length);
+        if (entry->flags & FS_ENTRY_DIRECTORY) {
+            pPath[pLength + length] = '/';
+            result = listTree(pDesc, record->target, pPath, pLength + length + 1, pDepth + 1, pEach, pContext);
+            continue;
+        }
+        pPath[pLength + length] = 0;
+        if (pEach(pPath, entry->size, entry->created, pContext) != 0)
+            return 1;
+    }
+    return result;
+}
+
+//PAGE: the B+tree is entered at the first name after pAfter and its leaves are followed from there
+int listDirectory(FS_descriptors* pDesc, const char* pPath, const char* pAfter, uint32_t pCount,
+                  FS_list_callback pEach, void* pContext) {
+    char name[FS_MAX_NAME + 1];
+    uint32_t directory = FS_ENDPOINT;
+    FS_tree_cursor cursor;
+    FS_tree_record* record;
+    int result;
+
+    if (pPath != NULL && nextPart(pPath, name) != NULL) {
+        if ((result = findEntry(pDesc, pPath, &directory)) != ST_OK)
+            return result;
+        if (!(getEntry(pDesc, directory)->flags & FS_ENTRY_DIRECTORY))
+            return ST_NOT_VALID_FILE;
+    }
+    result = treeSeek(pDesc, directory, pAfter, &cursor);
+    for (uint32_t listed = 0; result == ST_OK && (pCount == 0 || listed < pCount); ++listed) {
+        if ((result = treeStep(pDesc, &cursor, &record)) != ST_OK || record == NULL)
+            break;
+        FS_file_entry* entry = getEntry(pDesc, record->target);
+        snprintf(name, sizeof(name), "%.*s%s", FS_MAX_NAME - 1, (const char*) entry->name,
+                 entry->flags & FS_ENTRY_DIRECTORY ? "/" : "");
+        if (pEach(name, entry->size, entry->created, pContext) != 0)
+            break;
+    }
+    return result;
+}
+
+int status(FS_descriptors* pDesc, FILE* pOut) {
+    uint8_t version[6];
+    uint32_t files = 0;
+    uint32_t inlined = 0;
+    uint32_t compressed = 0;
+    uint32_t deduplicated = 0;
+    uint32_t directories = 0;
+    uint32_t extents = 0;
+
+    memcpy(version, pDesc->info_block->version, 5);
+    version[5] = 0;
+
+    fprintf(pOut, "GFS File System\n");
+    fprintf(pOut, "API Version: %s\n", FS_VERSION);
+
+    fprintf(pOut, "\nINFO SECTION\n");
+    fprintf(pOut, "VERSION: %s\nSIZE: %llu\nFREE: %llu\nALLOCATION TABLES: %d\nDIRECTORY TABLES: %d\n", version,
+           (unsigned long long) pDesc->info_block->size, (unsigned long long) pDesc->info_block->free, pDesc->info_block->allocation_tables,
+           pDesc->info_block->directory_tables);
+    fprintf(pOut, "ROOT: %d\n", pDesc->info_block->root);
+    if (pDesc->name_index != NULL)
+        fprintf(pOut, "NAME INDEX: %d\tSLOTS: %d\tFILES: %d\tDELETED: %d\n", pDesc->info_block->name_index,
+               pDesc->name_index->capacity, pDesc->name_index->count, pDesc->name_index->deleted);
+    if (pDesc->dedup_index != NULL)
+        fprintf(pOut, "DEDUP INDEX: %d\tSLOTS: %d\tCHUNKS: %d\tDELETED: %d\n", pDesc->info_block->dedup_index,
+               pDesc->dedup_index->capacity, pDesc->dedup_index->count, pDesc->dedup_index->deleted);
+    fprintf(pOut, "JOURNAL: %d\tUSED: %d\tEPOCH: %d\n", pDesc->info_block->journal_size, pDesc->journal_used,
+           pDesc->journal_epoch);
+    fprintf(pOut, "IO: %s\n", ioKind(pDesc->io) == IO_URING ? "io_uring" :
+                              ioKind(pDesc->io) == IO_THREADS ? "threads" : "sync");
+    fprintf(pOut, "CRC32C: %s\n", crc32cKind());
+
+    for (uint32_t i = 0; i < pDesc->info_block->directory_tables; ++i) {
+        for (uint32_t file = 0; file < FS_DIRECTORY_FILES; ++file) {
+            if (!((pDesc->directory_table[i]->files_flags >> file) & 1))
+                continue;
+            if (pDesc->directory_table[i]->files[file].flags & FS_ENTRY_DIRECTORY) {
+                directories += 1;
+                continue;
+            }
+            if (pDesc->directory_table[i]->files[file].flags & FS_ENTRY_INLINE) {
+                inlined += 1;
+                continue;
+            }
+            files += 1;
+            if (pDesc->directory_table[i]->files[file].flags & FS_ENTRY_COMPRESSED)
+                compressed += 1;
+            if (pDesc->directory_table[i]->files[file].flags & FS_ENTRY_DEDUP)
+                deduplicated += 1;
+            for (uint32_t block = pDesc->directory_table[i]->files[file].block; block != FS_ENDPOINT;
+                 block = getUnit(pDesc, block)->next_block)
+                extents += 1;
+        }
+    }
+    fprintf(pOut, "POLICY: %s\tFILES: %d\tEXTENTS: %d\tPER FILE: %.2f\tINLINE: %d\tCOMPRESSED: %d\tDEDUP: %d\t"
+                  "DIRECTORIES: %d\n", pDesc->info_block->policy == POLICY_FIRST ? "first" : "contiguous", files,
+           extents, files > 0 ? (double) extents / files : 0.0, inlined, compressed, deduplicated, directories);
+
+    for (uint32_t i = 0; i < pDesc->info_block->allocation_tables; ++i) {
+        fprintf(pOut, "\nALLOCATION SECTION %d\n", i);
+        fprintf(pOut, "UNITS: %d\tUNUSED_UNITS: %d\tNEXT: %d\n", FS_ALLOC_UNITS, pDesc->allocation_table[i]->unused_units,
+               pDesc->allocation_table[i]->offset_next);
+    }
+
+    for (uint32_t i = 0; i < pDesc->info_block->directory_tables; ++i) {
+        fprintf(pOut, "\nDIRECTORY SECTION %d\n", i);
+        fprintf(pOut, "FLAGS: 0x%04x\tNEXT: %d\n", pDesc->directory_table[i]->files_flags,
+               pDesc->directory_table[i]->offset_next);
+
+        fprintf(pOut, "%-4s %-20s %-5s %-5s\n", "ID", "NAME", "SIZE", "BLOCK");
+
+        for (uint32_t file = 0; file < FS_DIRECTORY_FILES; ++file) {
+            if ((pDesc->directory_table[i]->files_flags >> file) & 1)
+                fprintf(pOut, "%-4d %-20s %-5llu %-5d\n", file, pDesc->directory_table[i]->files[file].name,
+                       (unsigned long long) pDesc->directory_table[i]->files[file].size,
+                       pDesc->directory_table[i]->files[file].block);
+        }
+    }
+    for (uint32_t i = 0; i < pDesc->info_block->allocation_tables; ++i) {
+        fprintf(pOut, "\nDATA SECTION \n");
+        fprintf(pOut, "%-6s %-16s %-10s %-6s %-6s\n", "TYPE", "BLOCK", "OFFSET", "SIZE", "NEXT");
+        for (uint32_t unit = 0; unit < FS_ALLOC_UNITS; ++unit) {
+            if (pDesc->allocation_table[i]->units[unit].type & FS_SYSTEM) {
+                fprintf(pOut, "%-6s %-3d[%3d, %3d]    0x%04llx   %6llu\n", "SYS", FS_ALLOC_UNITS * i + unit, i, unit,
+                       (unsigned long long) pDesc->allocation_table[i]->units[unit].offset,
+                       (unsigned long long) pDesc->allocation_table[i]->units[unit].size);
+
+            } else if (pDesc->allocation_table[i]->units[unit].type & FS_FREE) {
+                fprintf(pOut, "%-6s %-3d[%3d, %3d]    0x%04llx   %6llu\n", "FREE", FS_ALLOC_UNITS * i + unit, i, unit,
+                       (unsigned long long) pDesc->allocation_table[i]->units[unit].offset,
+                       (unsigned long long) pDesc->allocation_table[i]->units[unit].size);
+
+            } else if (pDesc->allocation_table[i]->units[unit].type & FS_OCCUPIED) {
+                if (pDesc->allocation_table[i]->units[unit].next_block != FS_ENDPOINT)
+                    fprintf(pOut, "%-6s %-3d[%3d, %3d]    0x%04llx   %6llu %6d\n", "DATA", FS_ALLOC_UNITS * i + unit, i, unit,
+                           (unsigned long long) pDesc->allocation_table[i]->units[unit].offset,
+                           (unsigned long long) pDesc->allocation_table[i]->units[unit].size,
+                           pDesc->allocation_table[i]->units[unit].next_block);
+                else
+                    fprintf(pOut, "%-6s %-3d[%3d, %3d]    0x%04llx   %6llu\n", "DATA", FS_ALLOC_UNITS * i + unit, i, unit,
+                           (unsigned long long) pDesc->allocation_table[i]->units[unit].offset,
+                           (unsigned long long) pDesc->allocation_table[i]->units[unit].size);
+            }
+        }
+    }
+    return ST_OK;
+}
+
+//The file at path pFilename, ST_NOT_VALID_FILE for a directory
+int findFile(FS_file_entry* pFile, uint32_t* pIndex, FS_descriptors* pDesc, const char* pFilename) {
+    uint32_t found;
+    int result = findEntry(pDesc, pFilename, &found);
+
+    if (result == ST_OK && getEntry(pDesc, found)->flags & FS_ENTRY_DIRECTORY)
+        result = ST_NOT_VALID_FILE;
+    if (result == ST_OK) {
+        if (pFile != NULL)
+            *pFile = *getEntry(pDesc, found);
+        if (pIndex != NULL)
+            *pIndex = found;
+    }
+    return result;
+}
+
+//The file or directory at pPath
+int findEntry(FS_descriptors* pDesc, const char* pPath, uint32_t* pFile) {
+    uint64_t start = metricClock();
+    char name[FS_MAX_NAME];
+    uint32_t parent;
+    int result = findParent(pDesc, pPath, 0, &parent, name);
+
+    if (result == ST_OK)
+        result = childFind(pDesc, parent, name, pFile);
+    metricTime(METRIC_FIND, start);
+    return result;
+}
+
+//Walks the directories pPath leads through, leaving the last of them in *pParent and the last part in pName. With
+//pCreate those missing are made, otherwise ST_NOT_FOUND; ST_NOT_VALID_FILE when one is a file or there are too many.
+int findParent(FS_descriptors* pDesc, const char* pPath, uint8_t pCreate, uint32_t* pParent, char* pName) {
+    char part[FS_MAX_NAME];
+    const char* next;
+    uint32_t depth = 0;
+    int result;
+
+    *pParent = FS_ENDPOINT;
+    if ((pPath = nextPart(pPath, pName)) == NULL)
+        return ST_NOT_VALID_FILE;
+    for (; (next = nextPart(pPath, part)) != NULL; pPath = next) {
+        uint32_t file;
+        if (!strcmp(pName, "..") || ++depth > FS_MAX_DEPTH)
+            return ST_NOT_VALID_FILE;
+        result = childFind(pDesc, *pParent, pName, &file);
+        if (result == ST_NOT_FOUND && pCreate)
+            result = addEntry(pDesc, *pParent, pName, FS_ENTRY_INLINE | FS_ENTRY_DIRECTORY, &file);
+        else if (result == ST_OK && !(getEntry(pDesc, file)->flags & FS_ENTRY_DIRECTORY))
+            result = ST_NOT_VALID_FILE;
+        if (result != ST_OK)
+            return result;
+        *pParent = file;
+        strcpy(pName, part);
+    }
+    return strcmp(pName, "..") ? ST_OK : ST_NOT_VALID_FILE;
+}
+
+//Copies the next part of pPath, cut to FS_MAX_NAME - 1 bytes, to pPart and returns what follows it; NULL when only
+//slashes and "." parts are left
+const char* nextPart(const char* pPath, char* pPart) {
+    size_t length;
+
+    for (;; ++pPath) {
+        pPath += strspn(pPath, "/");
+        length = strcspn(pPath, "/");
+        if (length != 1 || pPath[0] != '.')
+            break;
+    }
+    if (length == 0)
+        return NULL;
+    memcpy(pPart, pPath, length < FS_MAX_NAME - 1 ? length : FS_MAX_NAME - 1);
+    pPart[length < FS_MAX_NAME - 1 ? length : FS_MAX_NAME - 1] = 0;
+    return pPath + length;
+}
+
+//pName in directory pParent, through the name index or else the directory's B+tree
+int childFind(FS_descriptors* pDesc, uint32_t pParent, const char* pName, uint32_t* pFile) {
+    if (pDesc->name_index != NULL)
+        return indexFind(pDesc, pParent, pName, pFile);
+    return treeFind(pDesc, pParent, pName, pFile);
+}
+
+int liveEntry(FS_descriptors* pDesc, uint32_t pFile) {
+    return pFile < pDesc->info_block->directory_tables * FS_DIRECTORY_FILES &&
+           (pDesc->directory_table[pFile / FS_DIRECTORY_FILES]->files_flags >> (pFile % FS_DIRECTORY_FILES)) & 1;
+}
+
+int loadDescriptors(FILE* pDrive, FS_descriptors* pDest, uint8_t pMap) {
+    FS_info info;
+
+    pDest->drive = pDrive;
+    pDest->sync = pMap;
+    if (fread(&info, sizeof(FS_info), 1, pDrive) != 1 || memcmp(info.magic, "GFS", 3))
+        return ST_NOT_VALID_FILE;
+    //0.x images predate the format field; older formats are told apart as it never moved
+    if (info.version[0] == '0' || info.format < FS_FORMAT)
+        return ST_OLD_FORMAT;
+    if (info.format != FS_FORMAT)
+        return ST_NOT_VALID_FILE;
+
+    //RECOVERY: redo committed metadata, then read the info block it may have changed
+    if (journalReplay(pDest, &info) != ST_OK)
+        return ST_NOT_VALID_FILE;
+    fseeko(pDrive, FS_INFO_OFFSET, SEEK_SET);
+    if (fread(&info, sizeof(FS_info), 1, pDrive) != 1)
+        return ST_NOT_VALID_FILE;
+
+    if (pMap != MMAP_OFF) {
+        struct stat st;
+        void* map;
+        pDest->map_size = (size_t) (FS_DATA_OFFSET) + info.size;
+        if (fstat(fileno(pDrive), &st) != 0 || (size_t) st.st_size < pDest->map_size)
+            return ST_NOT_VALID_FILE;
+        map = mmap(NULL, pDest->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(pDrive), 0);
+        if (map == MAP_FAILED)
+            return ST_CANT_OPEN;
+        pDest->map = map;
+    }
+
+    pDest->info_block = loadTable(pDest, FS_INFO_OFFSET, sizeof(FS_info));
+    pDest->policy = (uint8_t) info.policy;
+    if (reserveTables(pDest, info.allocation_tables, info.directory_tables) != ST_OK)
+        return ST_NOT_ENOUGH_SPACE;
+
+    //CHAINS: without a map, the tables each chain leads to are read ahead in batches, not one read per link
+    FS_table_cache cache = {NULL, NULL, info.allocation_tables * FS_ALLOC_UNITS};
+    if (pDest->io != NULL && pDest->map == NULL) {
+        cache.tables = calloc(cache.capacity, sizeof(void*));
+        cache.fetched = calloc(cache.capacity, 1);
+        if (cache.tables == NULL || cache.fetched == NULL)
+            releaseTables(&cache);
+    }
+    //every table is checked against its checksum and every link of a chain against the units; fsck goes on past
+    //damage, with a chain cut where it breaks
+    for (uint32_t i = 0; i < pDest->info_block->allocation_tables; ++i) {
+        uint32_t link = i == 0 ? 0 : pDest->allocation_table[i - 1]->offset_next;
+        if (i > 0 && !systemBlock(pDest, link, i * FS_ALLOC_UNITS, sizeof(FS_allocation_table))) {
+            damage(pDest, "ALLOCATION TABLE %u: the chain leads to unit %u, which holds no table\n", i, link);
+            if (!pDest->checking) {
+                releaseTables(&cache);
+                return ST_CORRUPT;
+            }
+            pDest->info_block->allocation_tables = i;
+            break;
+        }
+        pDest->allocation_table[i] = i == 0 ? copyTable(pDest, FS_ALLOCATION_OFFSET, sizeof(FS_allocation_table))
+                                            : chainedTable(pDest, &cache, link, i * FS_ALLOC_UNITS,
+                                                           sizeof(FS_allocation_table));
+        if (pDest->allocation_table[i] == NULL) {
+            releaseTables(&cache);
+            return ST_NOT_ENOUGH_SPACE;
+        }
+        if (crc32c(0, pDest->allocation_table[i], offsetof(FS_allocation_table, checksum)) !=
+            pDest->allocation_table[i]->checksum)
+            damage(pDest, "ALLOCATION TABLE %u: checksum mismatch\n", i);
+    }
+
+    //EXTENT MAP: free space by size, every extent by offset
+    uint32_t units = pDest->info_block->allocation_tables * FS_ALLOC_UNITS;
+    uint32_t* order = malloc(units * sizeof(uint32_t));
+    uint32_t used = 0;
+    if (pDest->damaged > 0 && !pDest->checking) {
+        free(order);
+        releaseTables(&cache);
+        return ST_CORRUPT;
+    }
+    if (order == NULL || extentInit(&pDest->extents, units) != 0) {
+        free(order);
+        releaseTables(&cache);
+        return ST_NOT_ENOUGH_SPACE;
+    }
+    for (uint32_t block = units; block-- > 0;) {
+        FS_allocation_unit* unit = getUnit(pDest, block);
+        if (unit->type == FS_UNUSED) {
+            extentPushUnused(&pDest->extents, block);
+            continue;
+        }
+        if (unit->type == FS_FREE)
+            extentInsertFree(&pDest->extents, block, unit->offset, unit->size);
+        order[used++] = block;
+    }
+    sortBlocks(pDest, order, used);
+    for (uint32_t i = 0; i < used; ++i)
+        extentLinkAfter(&pDest->extents, order[i], i == 0 ? FS_ENDPOINT : order[i - 1]);
+    free(order);
+
+    for (uint32_t i = 0; i < pDest->info_block->directory_tables; ++i) {
+        uint32_t link = i == 0 ? 0 : pDest->directory_table[i - 1]->offset_next;
+        if (i > 0 && !systemBlock(pDest, link, units, sizeof(FS_directory_table))) {
+            damage(pDest, "DIRECTORY TABLE %u: the chain leads to unit %u, which holds no table\n", i, link);
+            if (!pDest->checking) {
+                releaseTables(&cache);
+                return ST_CORRUPT;
+            }
+            pDest->info_block->directory_tables = i;
+            break;
+        }
+        pDest->directory_table[i] = i == 0 ? copyTable(pDest, FS_DIRECTORY_OFFSET, sizeof(FS_directory_table))
+                                           : chainedTable(pDest, &cache, link, units, sizeof(FS_directory_table));
+        if (pDest->directory_table[i] == NULL) {
+            releaseTables(&cache);
+            return ST_NOT_ENOUGH_SPACE;
+        }
+        if (crc32c(0, pDest->directory_table[i], offsetof(FS_directory_table, checksum)) !=
+            pDest->directory_table[i]->checksum)
+            damage(pDest, "DIRECTORY TABLE %u: checksum mismatch\n", i);
+    }
+    releaseTables(&cache);
+
+    if (pDest->info_block->name_index != FS_ENDPOINT) {
+        uint32_t block = pDest->info_block->name_index;
+        FS_allocation_unit* unit = block < units ? getUnit(pDest, block) : NULL;
+        FS_name_index header = {0, 0, 0};
+        if (unit != NULL && unit->size >= sizeof(header) && systemBlock(pDest, block, units, unit->size)) {
+            if (pDest->map != NULL)
+                memcpy(&header, pDest->map + FS_DATA_OFFSET + unit->offset, sizeof(FS_name_index));
+            else {
+                fseeko(pDrive, FS_DATA_OFFSET + unit->offset, SEEK_SET);
+                fread(&header, sizeof(FS_name_index), 1, pDrive);
+            }
+        }
+        if (header.capacity == 0 || (header.capacity & (header.capacity - 1)) != 0 ||
+            indexSize(header.capacity) != unit->size)
+            damage(pDest, "NAME INDEX: unit %u holds no index\n", block);
+        else {
+            pDest->name_index = loadTable(pDest, FS_DATA_OFFSET + unit->offset, indexSize(header.capacity));
+            if (pDest->name_index == NULL || indexTrack(pDest, header.capacity) != ST_OK)
+                return ST_NOT_ENOUGH_SPACE;
+            if (indexSum(pDest->name_index, offsetof(FS_name_index, checksum), pDest->name_index->slots,
+                         sizeof(FS_index_slot), header.capacity, pDest->index_sums, NULL) != pDest->name_index->checksum)
+                damage(pDest, "NAME INDEX: checksum mismatch\n");
+            indexCheck(pDest);
+        }
+    }
+
+    if (pDest->info_block->dedup_index != FS_ENDPOINT) {
+        uint32_t block = pDest->info_block->dedup_index;
+        FS_allocation_unit* unit = block < units ? getUnit(pDest, block) : NULL;
+        FS_dedup_index header = {0, 0, 0, 0};
+        if (unit != NULL && unit->size >= sizeof(header) && systemBlock(pDest, block, units, unit->size)) {
+            if (pDest->map != NULL)
+                memcpy(&header, pDest->map + FS_DATA_OFFSET + unit->offset, sizeof(FS_dedup_index));
+            else {
+                fseeko(pDrive, FS_DATA_OFFSET + unit->offset, SEEK_SET);
+                fread(&header, sizeof(FS_dedup_index), 1, pDrive);
+            }
+        }
+        if (header.capacity == 0 || (header.capacity & (header.capacity - 1)) != 0 ||
+            dedupSize(header.capacity) != unit->size)
+            damage(pDest, "DEDUP INDEX: unit %u holds no index\n", block);
+        else {
+            pDest->dedup_index = loadTable(pDest, FS_DATA_OFFSET + unit->offset, dedupSize(header.capacity));
+            if (pDest->dedup_index == NULL || dedupTrack(pDest, header.capacity) != ST_OK)
+                return ST_NOT_ENOUGH_SPACE;
+            if (indexSum(pDest->dedup_index, offsetof(FS_dedup_index, checksum), pDest->dedup_index->slots,
+                         sizeof(FS_dedup_slot), header.capacity, pDest->dedup_sums, NULL) != pDest->dedup_index->checksum)
+                damage(pDest, "DEDUP INDEX: checksum mismatch\n");
+            dedupCheck(pDest);
+        }
+    }
+    return pDest->damaged > 0 && !pDest->checking ? ST_CORRUPT : ST_OK;
+}
+
+//Writes the info block and only the tables, nodes and index chunks touched since the last save, in offset order
+int saveDescriptors(FS_descriptors* pDesc) {
+    uint32_t allocationTables = pDesc->info_block->allocation_tables;
+    uint32_t directoryTables = pDesc->info_block->directory_tables;
+    FS_table_write* writes = malloc((allocationTables + directoryTables + pDesc->nodes_touched + pDesc->index_chunks +
+                                     pDesc->dedup_chunks + pDesc->held_count + 3) * sizeof(FS_table_write));
+    uint32_t count = 0;
+    off_t offset;
+
+    if (writes == NULL)
+        return ST_NOT_ENOUGH_SPACE;
+    //HELD system blocks go free with this commit, which tells replay to skip the older images of them
+    for (uint32_t i = 0; i < pDesc->held_count; ++i) {
+        FS_allocation_unit* unit = getUnit(pDesc, pDesc->held[i]);
+        writes[count++] = (FS_table_write) {FS_DATA_OFFSET + (off_t) unit->offset, NULL, unit->size};
+        freeBlock(pDesc, pDesc->held[i]);
+    }
+    pDesc->held_count = 0;
+    writes[count++] = (FS_table_write) {FS_INFO_OFFSET, pDesc->info_block, sizeof(FS_info)};
+
+    for (uint32_t i = 0; i < allocationTables; ++i) {
+        if (!pDesc->allocation_dirty[i])
+            continue;
+        offset = i == 0 ? FS_ALLOCATION_OFFSET
+                        : FS_DATA_OFFSET + getUnit(pDesc, pDesc->allocation_table[i - 1]->offset_next)->offset;
+        pDesc->allocation_table[i]->checksum = crc32c(0, pDesc->allocation_table[i],
+                                                      offsetof(FS_allocation_table, checksum));
+        writes[count++] = (FS_table_write) {offset, pDesc->allocation_table[i], sizeof(FS_allocation_table)};
+        pDesc->allocation_dirty[i] = 0;
+    }
+
+    for (uint32_t i = 0; i < directoryTables; ++i) {
+        if (!pDesc->directory_dirty[i])
+            continue;
+        offset = i == 0 ? FS_DIRECTORY_OFFSET
+                        : FS_DATA_OFFSET + getUnit(pDesc, pDesc->directory_table[i - 1]->offset_next)->offset;
+        pDesc->directory_table[i]->checksum = crc32c(0, pDesc->directory_table[i],
+                                                     offsetof(FS_directory_table, checksum));
+        writes[count++] = (FS_table_write) {offset, pDesc->directory_table[i], sizeof(FS_directory_table)};
+        pDesc->directory_dirty[i] = 0;
+    }
+
+    for (uint32_t block = 0; block < allocationTables * FS_ALLOC_UNITS && pDesc->nodes_touched > 0; ++block) {
+        if (!pDesc->nodes_dirty[block])
+            continue;
+        pDesc->nodes[block]->checksum = crc32c(0, pDesc->nodes[block], offsetof(FS_tree_node, checksum));
+        writes[count++] = (FS_table_write) {FS_DATA_OFFSET + getUnit(pDesc, block)->offset, pDesc->nodes[block],
+                                            sizeof(FS_tree_node)};
+        pDesc->nodes_dirty[block] = 0;
+        pDesc->nodes_touched -= 1;
+    }
+
+    //NAME INDEX: a fresh one sits in blocks nothing on disk points to yet, so it skips the journal
+    if (pDesc->name_index != NULL)
+        pDesc->name_index->checksum = indexSum(pDesc->name_index, offsetof(FS_name_index, checksum),
+                                               pDesc->name_index->slots, sizeof(FS_index_slot),
+                                               pDesc->name_index->capacity, pDesc->index_sums,
+                                               pDesc->index_fresh ? NULL : pDesc->index_dirty);
+    if (pDesc->name_index != NULL && pDesc->index_fresh) {
+        saveTable(pDesc, pDesc->name_index, FS_DATA_OFFSET + getUnit(pDesc, pDesc->info_block->name_index)->offset,
+                  indexSize(pDesc->name_index->capacity));
+        if (journalSync(pDesc) != ST_OK) {
+            free(writes);
+            return ST_IO_ERROR;
+        }
+    } else if (pDesc->name_index != NULL) {
+        //NAME INDEX: header and the dirty chunks of slots
+        uint32_t header = 0;
+        offset = FS_DATA_OFFSET + getUnit(pDesc, pDesc->info_block->name_index)->offset;
+        for (uint32_t chunk = 0; chunk < pDesc->index_chunks; ++chunk) {
+            uint32_t from = chunk * FS_INDEX_CHUNK;
+            uint32_t slots = pDesc->name_index->capacity - from;
+            if (!pDesc->index_dirty[chunk])
+                continue;
+            if (!header++)
+                writes[count++] = (FS_table_write) {offset, pDesc->name_index, sizeof(FS_name_index)};
+            writes[count++] = (FS_table_write) {offset + (off_t) indexSize(from), &pDesc->name_index->slots[from],
+                                                (slots > FS_INDEX_CHUNK ? FS_INDEX_CHUNK : slots) *
+                                                sizeof(FS_index_slot)};
+        }
+    }
+    if (pDesc->index_dirty != NULL)
+        memset(pDesc->index_dirty, 0, pDesc->index_chunks);
+    pDesc->index_fresh = 0;
+
+    //DEDUP INDEX: the same way
+    if (pDesc->dedup_index != NULL)
+        pDesc->dedup_index->checksum = indexSum(pDesc->dedup_index, offsetof(FS_dedup_index, checksum),
+                                                pDesc->dedup_index->slots, sizeof(FS_dedup_slot),
+                                                pDesc->dedup_index->capacity, pDesc->dedup_sums,
+                                                pDesc->dedup_fresh ? NULL : pDesc->dedup_dirty);
+    if (pDesc->dedup_index != NULL && pDesc->dedup_fresh) {
+        saveTable(pDesc, pDesc->dedup_index, FS_DATA_OFFSET + getUnit(pDesc, pDesc->info_block->dedup_index)->offset,
+                  dedupSize(pDesc->dedup_index->capacity));
+        if (journalSync(pDesc) != ST_OK) {
+            free(writes);
+            return ST_IO_ERROR;
+        }
+    } else if (pDesc->dedup_index != NULL) {
+        uint32_t header = 0;
+        offset = FS_DATA_OFFSET + getUnit(pDesc, pDesc->info_block->dedup_index)->offset;
+        for (uint32_t chunk = 0; chunk < pDesc->dedup_chunks; ++chunk) {
+            uint32_t from = chunk * FS_INDEX_CHUNK;
+            uint32_t slots = pDesc->dedup_index->capacity - from;
+            if (!pDesc->dedup_dirty[chunk])
+                continue;
+            if (!header++)
+                writes[count++] = (FS_table_write) {offset, pDesc->dedup_index, sizeof(FS_dedup_index)};
+            writes[count++] = (FS_table_write) {offset + (off_t) dedupSize(from), &pDesc->dedup_index->slots[from],
+                                                (slots > FS_INDEX_CHUNK ? FS_INDEX_CHUNK : slots) *
+                                                sizeof(FS_dedup_slot)};
+        }
+    }
+    if (pDesc->dedup_dirty != NULL)
+        memset(pDesc->dedup_dirty, 0, pDesc->dedup_chunks);
+    pDesc->dedup_fresh = 0;
+    pDesc->dirty_bytes = 0;
+
+    //COMMIT, then overwrite in place; a transaction larger than the journal grows it first
+    qsort(writes, count, sizeof(FS_table_write), compareWrites);
+    int result = journalCommit(pDesc, writes, count);
+    if (result != ST_OK) {
+        free(writes);
+        return result;
+    }
+    //IN PLACE, all at once through the I/O engine when the drive is not mapped
+    FS_io_request* requests = pDesc->io != NULL && pDesc->map == NULL ? malloc(count * sizeof(FS_io_request)) : NULL;
+    uint32_t submitted = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (writes[i].table == NULL)
+            continue;
+        if (requests != NULL)
+            requests[submitted++] = (FS_io_request) {writes[i].table, writes[i].size, writes[i].offset, 1};
+        else
+            saveTable(pDesc, writes[i].table, writes[i].offset, writes[i].size);
+    }
+    free(writes);
+    if (requests != NULL) {
+        int failed = fflush(pDesc->drive) != 0 || ioSubmit(pDesc->io, fileno(pDesc->drive), requests, submitted) != 0;
+        free(requests);
+        if (failed)
+            return ST_IO_ERROR;
+    }
+    //readers copy below the stdio layer without flushing it
+    if (fflush(pDesc->drive) != 0)
+        return ST_IO_ERROR;
+
+    if (pDesc->map != NULL && pDesc->sync != MMAP_NOSYNC) {
+        uint64_t start = metricClock();
+        int failed = msync(pDesc->map, pDesc->map_size, pDesc->sync == MMAP_SYNC ? MS_SYNC : MS_ASYNC) != 0;
+        metricCount(COUNT_SYSCALLS, 1);
+        metricTime(METRIC_SYNC, start);
+        if (failed)
+            return ST_IO_ERROR;
+    }
+    return ST_OK;
+}
+
+int discardDescriptors(FS_descriptors* pDest) {
+    if (!isMapped(pDest, pDest->info_block))
+        free(pDest->info_block);
+    if (!isMapped(pDest, pDest->name_index))
+        free(pDest->name_index);
+    if (!isMapped(pDest, pDest->dedup_index))
+        free(pDest->dedup_index);
+    for (uint32_t i = 0; i < pDest->allocation_capacity; ++i)
+        if (!isMapped(pDest, pDest->allocation_table[i]))
+            free(pDest->allocation_table[i]);
+    for (uint32_t i = 0; i < pDest->directory_capacity; ++i)
+        if (!isMapped(pDest, pDest->directory_table[i]))
+            free(pDest->directory_table[i]);
+    for (uint32_t i = 0; pDest->nodes != NULL && i < pDest->allocation_capacity * FS_ALLOC_UNITS; ++i)
+        free(pDest->nodes[i]);
+    if (pDest->map != NULL)
+        munmap(pDest->map, pDest->map_size);
+    extentRelease(&pDest->extents);
+    if (pDest->allocation_table)
+        free(pDest->allocation_table);
+    if (pDest->directory_table)
+        free(pDest->directory_table);
+    free(pDest->allocation_dirty);
+    free(pDest->directory_dirty);
+    free(pDest->nodes);
+    free(pDest->nodes_dirty);
+    free(pDest->held);
+    free(pDest->index_dirty);
+    free(pDest->index_sums);
+    free(pDest->dedup_dirty);
+    free(pDest->dedup_sums);
+    for (uint32_t i = 0; i < FS_CHAIN_SLOTS; ++i)
+        free(pDest->chains[i]);
+    return ST_OK;
+}
+
+int reserveTables(FS_descriptors* pDesc, uint32_t pAllocation, uint32_t pDirectory) {
+    if (pAllocation > pDesc->allocation_capacity) {
+        uint32_t capacity = pAllocation * 2;
+        void* tables = realloc(pDesc->allocation_table, capacity * sizeof(FS_allocation_table*));
+        if (tables == NULL)
+            return ST_NOT_ENOUGH_SPACE;
+        pDesc->allocation_table = tables;
+        memset(&pDesc->allocation_table[pDesc->allocation_capacity], 0,
+               (capacity - pDesc->allocation_capacity) * sizeof(FS_allocation_table*));
+        void* dirty = realloc(pDesc->allocation_dirty, capacity);
+        if (dirty == NULL)
+            return ST_NOT_ENOUGH_SPACE;
+        pDesc->allocation_dirty = dirty;
+        memset(&pDesc->allocation_dirty[pDesc->allocation_capacity], 0, capacity - pDesc->allocation_capacity);
+        //B+tree nodes by block, as many as the tables have units
+        void* nodes = realloc(pDesc->nodes, capacity * FS_ALLOC_UNITS * sizeof(FS_tree_node*));
+        if (nodes == NULL)
+            return ST_NOT_ENOUGH_SPACE;
+        pDesc->nodes = nodes;
+        memset(&pDesc->nodes[pDesc->allocation_capacity * FS_ALLOC_UNITS], 0,
+               (capacity - pDesc->allocation_capacity) * FS_ALLOC_UNITS * sizeof(FS_tree_node*));
+        void* nodesDirty = realloc(pDesc->nodes_dirty, capacity * FS_ALLOC_UNITS);
+        if (nodesDirty == NULL)
+            return ST_NOT_ENOUGH_SPACE;
+        pDesc->nodes_dirty = nodesDirty;
+        memset(&pDesc->nodes_dirty[pDesc->allocation_capacity * FS_ALLOC_UNITS], 0,
+               (capacity - pDesc->allocation_capacity) * FS_ALLOC_UNITS);
+        pDesc->allocation_capacity = capacity;
+    }
+    if (pDirectory > pDesc->directory_capacity) {
+        uint32_t capacity = pDirectory * 2;
+        void* tables = realloc(pDesc->directory_table, capacity * sizeof(FS_directory_table*));
+        if (tables == NULL)
+            return ST_NOT_ENOUGH_SPACE;
+        pDesc->directory_table = tables;
+        memset(&pDesc->directory_table[pDesc->directory_capacity], 0,
+               (capacity - pDesc->directory_capacity) * sizeof(FS_directory_table*));
+        void* dirty = realloc(pDesc->directory_dirty, capacity);
+        if (dirty == NULL)
+            return ST_NOT_ENOUGH_SPACE;
+        pDesc->directory_dirty = dirty;
+        memset(&pDesc->directory_dirty[pDesc->directory_capacity], 0, capacity - pDesc->directory_capacity);
+        pDesc->directory_capacity = capacity;
+    }
+    return ST_OK;
+}
+
+//Tables behind misaligned offsets (chained after odd-sized files) are copied even when mapped
+void* loadTable(FS_descriptors* pDesc, off_t pOffset, size_t pSize) {
+    if (pDesc->map != NULL && pOffset % sizeof(uint64_t) == 0)
+        return pDesc->map + pOffset;
+    return copyTable(pDesc, pOffset, pSize);
+}
+
+//Allocation and directory tables are always copies, so a mapped drive never holds one changed since its checksum
+//was taken. One that can not be read is all zeros, which fails its checksum.
+void* copyTable(FS_descriptors* pDesc, off_t pOffset, size_t pSize) {
+    void* table = malloc(pSize);
+
+    if (table == NULL)
+        return NULL;
+    metricCount(COUNT_READ, pSize);
+    if (pDesc->map != NULL) {
+        memcpy(table, pDesc->map + pOffset, pSize);
+    } else {
+        metricCount(COUNT_SYSCALLS, 1);
+        fseeko(pDesc->drive, pOffset, SEEK_SET);
+        if (fread(table, pSize, 1, pDesc->drive) != 1)
+            memset(table, 0, pSize);
+    }
+    return table;
+}
+
+//Whether pBlock is among the first pUnits and a system block of pSize bytes inside the data region
+int systemBlock(FS_descriptors* pDesc, uint32_t pBlock, uint32_t pUnits, uint64_t pSize) {
+    FS_allocation_unit* unit;
+
+    if (pBlock >= pUnits)
+        return 0;
+    unit = getUnit(pDesc, pBlock);
+    return unit->type == FS_SYSTEM && unit->size == pSize && unit->offset <= pDesc->info_block->size &&
+           pSize <= pDesc->info_block->size - unit->offset;
+}
+
+//The table of pSize bytes in system block pBlock. With pCache, a block not read ahead yet has every table of its size
+//among the first pUnits units read in one batch first.
+void* chainedTable(FS_descriptors* pDesc, FS_table_cache* pCache, uint32_t pBlock, uint32_t pUnits, size_t pSize) {
+    void* table;
+
+    if (pCache->tables != NULL && !pCache->fetched[pBlock])
+        prefetchTables(pDesc, pCache, pUnits, pSize);
+    if (pCache->tables != NULL && pCache->tables[pBlock] != NULL) {
+        table = pCache->tables[pBlock];
+        pCache->tables[pBlock] = NULL;
+        return table;
+    }
+    return copyTable(pDesc, FS_DATA_OFFSET + getUnit(pDesc, pBlock)->offset, pSize);
+}
+
+int prefetchTables(FS_descriptors* pDesc, FS_table_cache* pCache, uint32_t pUnits, size_t pSize) {
+    FS_io_request* requests = malloc(pUnits * sizeof(FS_io_request));
+    uint32_t count = 0;
+    int result;
+
+    if (requests == NULL)
+        return ST_NOT_ENOUGH_SPACE;
+    for (uint32_t block = 0; block < pUnits; ++block) {
+        FS_allocation_unit* unit = getUnit(pDesc, block);
+        if (unit->type != FS_SYSTEM || unit->size != pSize || pCache->fetched[block])
+            continue;
+        pCache->fetched[block] = 1;
+        if ((pCache->tables[block] = malloc(pSize)) == NULL)
+            break;
+        requests[count++] = (FS_io_request) {pCache->tables[block], pSize,
+                                             (off_t) (FS_DATA_OFFSET) + (off_t) unit->offset, 0};
+    }
+    //front to back, so a drive full of tables is streamed rather than sought through
+    qsort(requests, count, sizeof(FS_io_request), compareRequests);
+    result = ioSubmit(pDesc->io, fileno(pDesc->drive), requests, count);
+    free(requests);
+    //after a failed batch every table is read on its own
+    if (result != 0)
+        releaseTables(pCache);
+    return result == 0 ? ST_OK : ST_IO_ERROR;
+}
+
+//Frees the tables read ahead that no chain led to, and the cache itself
+void releaseTables(FS_table_cache* pCache) {
+    for (uint32_t block = 0; pCache->tables != NULL && block < pCache->capacity; ++block)
+        free(pCache->tables[block]);
+    free(pCache->tables);
+    free(pCache->fetched);
+    pCache->tables = NULL;
+    pCache->fetched = NULL;
+}
+
+void* newTable(FS_descriptors* pDesc, off_t pOffset, size_t pSize) {
+    if (pDesc->map != NULL && pOffset % sizeof(uint64_t) == 0)
+        return pDesc->map + pOffset;
+    return malloc(pSize);
+}
+
+void saveTable(FS_descriptors* pDesc, void* pTable, off_t pOffset, size_t pSize) {
+    metricCount(COUNT_WRITTEN, pSize);
+    if (pDesc->map != NULL) {
+        if (!isMapped(pDesc, pTable))
+            memcpy(pDesc->map + pOffset, pTable, pSize);
+        return;
+    }
+    metricCount(COUNT_SYSCALLS, 1);
+    fseeko(pDesc->drive, pOffset, SEEK_SET);
+    fwrite(pTable, pSize, 1, pDesc->drive);
+}
+
+int isMapped(FS_descriptors* pDesc, void* pTable) {
+    return pDesc->map != NULL && (uint8_t*) pTable >= pDesc->map && (uint8_t*) pTable < pDesc->map + pDesc->map_size;
+}
+
+//DIRTY TRACKING
+void touchAllocation(FS_descriptors* pDesc, uint32_t pBlock) {
+    pDesc->generation += 1;
+    if (!pDesc->allocation_dirty[pBlock / FS_ALLOC_UNITS])
+        pDesc->dirty_bytes += sizeof(FS_allocation_table);
+    pDesc->allocation_dirty[pBlock / FS_ALLOC_UNITS] = 1;
+}
+
+void touchDirectory(FS_descriptors* pDesc, uint32_t pFile) {
+    if (!pDesc->directory_dirty[pFile / FS_DIRECTORY_FILES])
+        pDesc->dirty_bytes += sizeof(FS_directory_table);
+    pDesc->directory_dirty[pFile / FS_DIRECTORY_FILES] = 1;
+}
+
+void touchNode(FS_descriptors* pDesc, uint32_t pBlock) {
+    if (!pDesc->nodes_dirty[pBlock]) {
+        pDesc->dirty_bytes += sizeof(FS_tree_node);
+        pDesc->nodes_touched += 1;
+    }
+    pDesc->nodes_dirty[pBlock] = 1;
+}
+
+void touchIndex(FS_descriptors* pDesc, uint32_t pSlot) {
+    if (!pDesc->index_dirty[pSlot / FS_INDEX_CHUNK])
+        pDesc->dirty_bytes += FS_INDEX_CHUNK * sizeof(FS_index_slot);
+    pDesc->index_dirty[pSlot / FS_INDEX_CHUNK] = 1;
+}
+
+//Sizes the dirty marks for an index of pCapacity slots, all clean
+int indexTrack(FS_descriptors* pDesc, uint32_t pCapacity) {
+    uint32_t chunks = (pCapacity + FS_INDEX_CHUNK - 1) / FS_INDEX_CHUNK;
+    void* dirty = realloc(pDesc->index_dirty, chunks);
+    void* sums;
+
+    if (dirty == NULL)
+        return ST_NOT_ENOUGH_SPACE;
+    pDesc->index_dirty = dirty;
+    if ((sums = realloc(pDesc->index_sums, chunks * sizeof(uint32_t))) == NULL)
+        return ST_NOT_ENOUGH_SPACE;
+    pDesc->index_sums = sums;
+    pDesc->index_chunks = chunks;
+    memset(pDesc->index_dirty, 0, chunks);
+    return ST_OK;
+}
+
+//The header's checksum: the CRC32C of its fields folded with each chunk's, seeded with its number so chunks can not
+//trade places. Only the chunks marked in pDirty are summed again, all of them when it is NULL.
+uint32_t indexSum(const void* pHeader, size_t pHeaderSize, const void* pSlots, size_t pSlotSize, uint32_t pCapacity,
+                  uint32_t* pSums, const uint8_t* pDirty) {
+    uint32_t sum = crc32c(0, pHeader, pHeaderSize);
+
+    for (uint32_t chunk = 0, from = 0; from < pCapacity; ++chunk, from += FS_INDEX_CHUNK) {
+        uint32_t slots = pCapacity - from < FS_INDEX_CHUNK ? pCapacity - from : FS_INDEX_CHUNK;
+        if (pDirty == NULL || pDirty[chunk])
+            pSums[chunk] = crc32c(chunk, (const uint8_t*) pSlots + (size_t) from * pSlotSize, slots * pSlotSize);
+        sum ^= pSums[chunk];
+    }
+    return sum;
+}
+
+int compareRequests(const void* pLeft, const void* pRight) {
+    off_t left = ((const FS_io_request*) pLeft)->offset;
+    off_t right = ((const FS_io_request*) pRight)->offset;
+    return (left > right) - (left < right);
+}
+
+int compareWrites(const void* pLeft, const void* pRight) {
+    off_t left = ((const FS_table_write*) pLeft)->offset;
+    off_t right = ((const FS_table_write*) pRight)->offset;
+    return (left > right) - (left < right);
+}
+
+//JOURNAL
+off_t journalOffset(FS_info* pInfo) {
+    return (off_t) (FS_DATA_OFFSET) + (off_t) pInfo->size;
+}
+
+//FNV-1a, chained through pSeed
+uint32_t journalChecksum(uint32_t pSeed, const void* pData, size_t pSize) {
+    const uint8_t* data = pData;
+    for (size_t i = 0; i < pSize; ++i) {
+        pSeed ^= data[i];
+        pSeed *= 16777619u;
+    }
+    return pSeed;
+}
+
+//Applies every intact transaction of the current epoch; replaying an already applied one is harmless. An image in a
+//range a later transaction freed is skipped, whatever reuses the range now is newer than the image
+int journalReplay(FS_descriptors* pDesc, FS_info* pInfo) {
+    FS_journal_header header;
+    FS_journal_txn txn;
+    FS_journal_record record;
+    FS_journal_freed* freed = NULL;
+    uint32_t freedCount = 0;
+    uint32_t freedCapacity = 0;
+    uint8_t* journal;
+    uint32_t capacity = pInfo->journal_size - sizeof(FS_journal_header);
+    uint32_t used = 0;
+    uint32_t txns = 0;
+    int result = ST_OK;
+
+    fseeko(pDesc->drive, journalOffset(pInfo), SEEK_SET);
+    if (fread(&header, sizeof(header), 1, pDesc->drive) != 1 || header.magic != FS_JOURNAL_MAGIC)
+        return ST_NOT_VALID_FILE;
+    //a short read leaves zeros, which end the scan like a torn tail
+    journal = calloc(capacity, 1);
+    if (journal == NULL)
+        return ST_NOT_ENOUGH_SPACE;
+    if (fread(journal, 1, capacity, pDesc->drive) == 0 && ferror(pDesc->drive)) {
+        free(journal);
+        return ST_IO_ERROR;
+    }
+
+    //SCAN the intact transactions for the ranges they freed; the torn tail stops it, everything before is committed
+    while (result == ST_OK && used + sizeof(FS_journal_txn) <= capacity) {
+        const uint8_t* records = journal + used + sizeof(FS_journal_txn);
+        memcpy(&txn, journal + used, sizeof(txn));
+        if (txn.magic != FS_JOURNAL_MAGIC || txn.epoch != header.epoch ||
+            txn.length > capacity - used - sizeof(FS_journal_txn))
+            break;
+        if (journalChecksum(journalChecksum(2166136261u, &txn.epoch, 2 * sizeof(uint32_t)), records, txn.length) !=
+            txn.checksum)
+            break;
+        for (uint32_t pos = 0; pos + sizeof(FS_journal_record) <= txn.length;) {
+            //records follow tables of any size, so they are copied out rather than read in place
+            memcpy(&record, records + pos, sizeof(record));
+            pos += sizeof(FS_journal_record);
+            if (!(record.size & FS_JOURNAL_FREED)) {
+                if (record.size > txn.length - pos)
+                    break;
+                pos += record.size;
+                continue;
+            }
+            if (freedCount == freedCapacity) {
+                uint32_t grown = freedCapacity > 0 ? freedCapacity * 2 : 16;
+                void* list = realloc(freed, grown * sizeof(FS_journal_freed));
+                if (list == NULL) {
+                    result = ST_NOT_ENOUGH_SPACE;
+                    break;
+                }
+                freed = list;
+                freedCapacity = grown;
+            }
+            freed[freedCount++] = (FS_journal_freed) {record.offset, record.size & ~FS_JOURNAL_FREED, txns};
+        }
+        used += sizeof(FS_journal_txn) + txn.length;
+        txns++;
+    }
+
+    //APPLY in commit order
+    for (uint32_t at = 0, index = 0; result == ST_OK && index < txns; ++index) {
+        const uint8_t* records = journal + at + sizeof(FS_journal_txn);
+        memcpy(&txn, journal + at, sizeof(txn));
+        for (uint32_t pos = 0; pos + sizeof(FS_journal_record) <= txn.length;) {
+            memcpy(&record, records + pos, sizeof(record));
+            pos += sizeof(FS_journal_record);
+            if (record.size & FS_JOURNAL_FREED)
+                continue;
+            if (record.size > txn.length - pos || record.offset + record.size > (uint64_t) journalOffset(pInfo))
+                break;
+            uint32_t stale = 0;
+            for (uint32_t i = 0; i < freedCount && !stale; ++i)
+                stale = freed[i].txn > index && record.offset < freed[i].offset + freed[i].size &&
+                        freed[i].offset < record.offset + record.size;
+            if (!stale) {
+                fseeko(pDesc->drive, (off_t) record.offset, SEEK_SET);
+                fwrite(records + pos, 1, record.size, pDesc->drive);
+            }
+            pos += record.size;
+        }
+        at += sizeof(FS_journal_txn) + txn.length;
+    }
+    free(freed);
+    free(journal);
+    if (result != ST_OK)
+        return result;
+
+    pDesc->journal_epoch = header.epoch;
+    pDesc->journal_used = used;
+    return fflush(pDesc->drive) == 0 ? ST_OK : ST_IO_ERROR;
+}
+
+//One transaction and one sync per save, however many tables it carries
+int journalCommit(FS_descriptors* pDesc, FS_table_write* pWrites, uint32_t pCount) {
+    uint32_t capacity = pDesc->info_block->journal_size - sizeof(FS_journal_header);
+    size_t length = 0;
+    uint8_t* buffer;
+    FS_journal_txn* txn;
+
+    for (uint32_t i = 0; i < pCount; ++i)
+        length += sizeof(FS_journal_record) + (pWrites[i].table != NULL ? pWrites[i].size : 0);
+    if (pDesc->journal_used + sizeof(FS_journal_txn) + length > capacity) {
+        if (journalCheckpoint(pDesc) != ST_OK)
+            return ST_IO_ERROR;
+        if (sizeof(FS_journal_txn) + length > capacity) {
+            int result = journalGrow(pDesc, sizeof(FS_journal_txn) + length);
+            if (result != ST_OK)
+                return result;
+        }
+    }
+
+    buffer = malloc(sizeof(FS_journal_txn) + length);
+    if (buffer == NULL)
+        return ST_NOT_ENOUGH_SPACE;
+    txn = (FS_journal_txn*) buffer;
+    txn->magic = FS_JOURNAL_MAGIC;
+    txn->epoch = pDesc->journal_epoch;
+    txn->length = (uint32_t) length;
+    uint8_t* pos = buffer + sizeof(FS_journal_txn);
+    for (uint32_t i = 0; i < pCount; ++i) {
+        FS_journal_record record = {(uint64_t) pWrites[i].offset, pWrites[i].size};
+        if (pWrites[i].table == NULL)
+            record.size |= FS_JOURNAL_FREED;
+        memcpy(pos, &record, sizeof(record));
+        pos += sizeof(record);
+        if (pWrites[i].table != NULL) {
+            memcpy(pos, pWrites[i].table, pWrites[i].size);
+            pos += pWrites[i].size;
+        }
+    }
+    txn->checksum = journalChecksum(journalChecksum(2166136261u, &txn->epoch, 2 * sizeof(uint32_t)),
+                                    buffer + sizeof(FS_journal_txn), length);
+
+    fseeko(pDesc->drive, journalOffset(pDesc->info_block) + (off_t) (sizeof(FS_journal_header) + pDesc->journal_used),
+          SEEK_SET);
+    size_t written = fwrite(buffer, 1, sizeof(FS_journal_txn) + length, pDesc->drive);
+    metricCount(COUNT_WRITTEN, written);
+    metricCount(COUNT_SYSCALLS, 1);
+    free(buffer);
+    if (written != sizeof(FS_journal_txn) + length || journalSync(pDesc) != ST_OK)
+        return ST_IO_ERROR;
+    pDesc->journal_used += sizeof(FS_journal_txn) + length;
+    return ST_OK;
+}
+
+//Doubles the emptied journal until pLength fits; the drive file grows behind it and the info block on disk learns
+//the new size before a transaction can need it. The caller checkpoints first.
+int journalGrow(FS_descriptors* pDesc, size_t pLength) {
+    uint64_t size = pDesc->info_block->journal_size;
+    int fd = fileno(pDesc->drive);
+    FS_info info;
+
+    while (size - sizeof(FS_journal_header) < pLength)
+        size *= 2;
+    if (size > UINT32_MAX)
+        return ST_NOT_ENOUGH_SPACE;
+    if (fflush(pDesc->drive) != 0 || ftruncate(fd, journalOffset(pDesc->info_block) + (off_t) size) != 0)
+        return ST_IO_ERROR;
+    //only the size is patched, the rest of the info block on disk belongs to the last commit
+    if (pread(fd, &info, sizeof(FS_info), FS_INFO_OFFSET) != sizeof(FS_info))
+        return ST_IO_ERROR;
+    info.journal_size = (uint32_t) size;
+    metricCount(COUNT_WRITTEN, sizeof(FS_info));
+    metricCount(COUNT_SYSCALLS, 3);
+    if (pwrite(fd, &info, sizeof(FS_info), FS_INFO_OFFSET) != sizeof(FS_info) || journalSync(pDesc) != ST_OK)
+        return ST_IO_ERROR;
+    pDesc->info_block->journal_size = (uint32_t) size;
+    return ST_OK;
+}
+
+//Makes the in-place copies durable and starts a new epoch, which retires every transaction so far
+int journalCheckpoint(FS_descriptors* pDesc) {
+    FS_journal_header header = {FS_JOURNAL_MAGIC, pDesc->journal_epoch + 1};
+
+    if (pDesc->journal_used == 0)
+        return ST_OK;
+    if (journalSync(pDesc) != ST_OK)
+        return ST_IO_ERROR;
+    fseeko(pDesc->drive, journalOffset(pDesc->info_block), SEEK_SET);
+    metricCount(COUNT_WRITTEN, sizeof(header));
+    metricCount(COUNT_SYSCALLS, 1);
+    if (fwrite(&header, sizeof(header), 1, pDesc->drive) != 1 || journalSync(pDesc) != ST_OK)
+        return ST_IO_ERROR;
+    pDesc->journal_epoch = header.epoch;
+    pDesc->journal_used = 0;
+    return ST_OK;
+}
+
+//fdatasync also flushes pages dirtied through the mapping
+int journalSync(FS_descriptors* pDesc) {
+    uint64_t start = metricClock();
+    int result = ST_OK;
+
+    metricCount(COUNT_SYSCALLS, 1);
+    if (fflush(pDesc->drive) != 0)
+        result = ST_IO_ERROR;
+    else if (pDesc->sync != MMAP_NOSYNC) {
+        metricCount(COUNT_SYSCALLS, 1);
+        if (fdatasync(fileno(pDesc->drive)) != 0)
+            result = ST_IO_ERROR;
+    }
+    metricTime(METRIC_SYNC, start);
+    return result;
+}
+
+FS_allocation_unit* getUnit(FS_descriptors* pDesc, uint32_t pBlock) {
+    metricCount(COUNT_UNITS, 1);
+    return &pDesc->allocation_table[pBlock / FS_ALLOC_UNITS]->units[pBlock % FS_ALLOC_UNITS];
+}
+
+FS_file_entry* getEntry(FS_descriptors* pDesc, uint32_t pFile) {
+    return &pDesc->directory_table[pFile / FS_DIRECTORY_FILES]->files[pFile % FS_DIRECTORY_FILES];
+}
+
+//The last commit may still point into a system block, so it stays taken until the save that commits it free
+void releaseBlock(FS_descriptors* pDesc, uint32_t pBlock) {
+    if (getUnit(pDesc, pBlock)->type == FS_SYSTEM) {
+        if (holdBlock(pDesc, pBlock) == ST_OK)
+            return;
+        //no memory to hold it: at least old transactions must not be replayed over whatever reuses it
+        journalCheckpoint(pDesc);
+    }
+    freeBlock(pDesc, pBlock);
+}
+
+int holdBlock(FS_descriptors* pDesc, uint32_t pBlock) {
+    if (pDesc->held_count == pDesc->held_capacity) {
+        uint32_t capacity = pDesc->held_capacity > 0 ? pDesc->held_capacity * 2 : 16;
+        void* held = realloc(pDesc->held, capacity * sizeof(uint32_t));
+        if (held == NULL)
+            return ST_NOT_ENOUGH_SPACE;
+        pDesc->held = held;
+        pDesc->held_capacity = capacity;
+    }
+    pDesc->held[pDesc->held_count++] = pBlock;
+    //the unit changes with the save, which must happen even when nothing else does
+    touchAllocation(pDesc, pBlock);
+    return ST_OK;
+}
+
+void freeBlock(FS_descriptors* pDesc, uint32_t pBlock) {
+    FS_allocation_unit* unit = getUnit(pDesc, pBlock);
+    uint32_t merged;
+    uint64_t start;
+
+    unit->type = FS_FREE;
+    unit->flags = 0;
+    touchAllocation(pDesc, pBlock);
+    pDesc->info_block->free += unit->size;
+    extentInsertFree(&pDesc->extents, pBlock, unit->offset, unit->size);
+    start = metricClock();
+    while ((merged = defragBlock(pDesc, pBlock)) != FS_ENDPOINT)
+        pBlock = merged;
+    metricTime(METRIC_MERGE, start);
+}
+
+//Carves pSize bytes off the front of free pBlock; the rest stays free in a spare unit the caller made sure exists
+void takeBlock(FS_descriptors* pDesc, uint32_t pBlock, uint64_t pSize, uint8_t pType) {
+    FS_allocation_unit* unit = getUnit(pDesc, pBlock);
+
+    extentRemoveFree(&pDesc->extents, pBlock);
+    if (unit->size > pSize) {
+        uint32_t unusedBlock = extentPopUnused(&pDesc->extents);
+        FS_allocation_unit* unusedUnit = getUnit(pDesc, unusedBlock);
+        pDesc->allocation_table[unusedBlock / FS_ALLOC_UNITS]->unused_units -= 1;
+        touchAllocation(pDesc, unusedBlock);
+
+        unusedUnit->type = FS_FREE;
+        unusedUnit->flags = 0;
+        unusedUnit->size = unit->size - pSize;
+        unusedUnit->offset = unit->offset + pSize;
+        unusedUnit->next_block = FS_ENDPOINT;
+        extentInsertFree(&pDesc->extents, unusedBlock, unusedUnit->offset, unusedUnit->size);
+        extentLinkAfter(&pDesc->extents, unusedBlock, pBlock);
+        unit->size = pSize;
+    }
+    unit->type = pType;
+    unit->flags = 0;
+    unit->next_block = FS_ENDPOINT;
+    touchAllocation(pDesc, pBlock);
+    pDesc->info_block->free -= pSize;
+}
+
+//Folds free pRight into free pLeft, which ends where pRight starts
+void mergeBlocks(FS_descriptors* pDesc, uint32_t pLeft, uint32_t pRight) {
+    FS_allocation_unit* left = getUnit(pDesc, pLeft);
+    FS_allocation_unit* right = getUnit(pDesc, pRight);
+
+    extentRemoveFree(&pDesc->extents, pLeft);
+    extentRemoveFree(&pDesc->extents, pRight);
+    left->size += right->size;
+    right->type = FS_UNUSED;
+    pDesc->allocation_table[pRight / FS_ALLOC_UNITS]->unused_units += 1;
+    touchAllocation(pDesc, pLeft);
+    touchAllocation(pDesc, pRight);
+    extentUnlink(&pDesc->extents, pRight);
+    extentPushUnused(&pDesc->extents, pRight);
+    extentInsertFree(&pDesc->extents, pLeft, left->offset, left->size);
+}
+
+//Shell sort by offset, allocation tables only hold a few units per kilobyte of metadata
+void sortBlocks(FS_descriptors* pDesc, uint32_t* pBlocks, uint32_t pCount) {
+    for (uint32_t gap = pCount / 2; gap > 0; gap /= 2) {
+        for (uint32_t i = gap; i < pCount; ++i) {
+            uint32_t block = pBlocks[i];
+            uint64_t offset = getUnit(pDesc, block)->offset;
+            uint32_t j = i;
+            for (; j >= gap && getUnit(pDesc, pBlocks[j - gap])->offset > offset; j -= gap)
+                pBlocks[j] = pBlocks[j - gap];
+            pBlocks[j] = block;
+        }
+    }
+}
+
+//Whole file in one extent if possible, otherwise the largest one or the lowest one, by policy
+uint32_t pickBlock(FS_descriptors* pDesc, uint64_t pSize) {
+    uint64_t start = metricClock();
+    uint32_t block;
+
+    if (pDesc->policy == POLICY_FIRST) {
+        block = extentFirstFit(&pDesc->extents, pSize);
+        if (block == FS_ENDPOINT)
+            block = extentFirstFit(&pDesc->extents, 0);
+    } else {
+        block = findBlockSize(pDesc, FS_FREE, pSize);
+        if (block == FS_ENDPOINT)
+            block = findBlock(pDesc, FS_FREE);
+    }
+    metricTime(METRIC_ALLOCATE, start);
+    return block;
+}
+
+//FNV-1a over the directory and the stored (truncated) name
+uint32_t hashName(uint32_t pParent, const char* pName) {
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < sizeof(pParent); ++i) {
+        hash ^= (pParent >> (8 * i)) & 0xFF;
+        hash *= 16777619u;
+    }
+    for (uint32_t i = 0; i < FS_MAX_NAME - 1 && pName[i] != 0; ++i) {
+        hash ^= (uint8_t) pName[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+int sameName(const uint8_t* pEntryName, const char* pName) {
+    return strncmp((const char*) pEntryName, pName, FS_MAX_NAME - 1) == 0;
+}
+
+size_t indexSize(uint32_t pCapacity) {
+    return sizeof(FS_name_index) + pCapacity * sizeof(FS_index_slot);
+}
+
+int indexFind(FS_descriptors* pDesc, uint32_t pParent, const char* pName, uint32_t* pFile) {
+    FS_name_index* index = pDesc->name_index;
+    uint32_t hash = hashName(pParent, pName);
+    uint32_t mask = index->capacity - 1;
+
+    for (uint32_t probe = 0, pos = hash & mask; probe < index->capacity; ++probe, pos = (pos + 1) & mask) {
+        FS_index_slot* slot = &index->slots[pos];
+        if (slot->file == FS_INDEX_EMPTY)
+            break;
+        if (slot->file != FS_INDEX_DELETED && slot->hash == hash && liveEntry(pDesc, slot->file) &&
+            getEntry(pDesc, slot->file)->parent == pParent && sameName(getEntry(pDesc, slot->file)->name, pName)) {
+            *pFile = slot->file;
+            return ST_OK;
+        }
+    }
+    return ST_NOT_FOUND;
+}
+
+//Every slot must lead to a live entry and the counts must add up with an empty slot to spare, or probes run off
+void indexCheck(FS_descriptors* pDesc) {
+    FS_name_index* index = pDesc->name_index;
+    uint32_t count = 0;
+    uint32_t deleted = 0;
+
+    for (uint32_t i = 0; i < index->capacity; ++i) {
+        uint32_t file = index->slots[i].file;
+        if (file == FS_INDEX_EMPTY)
+            continue;
+        if (file == FS_INDEX_DELETED)
+            deleted += 1;
+        else if (liveEntry(pDesc, file))
+            count += 1;
+        else
+            damage(pDesc, "NAME INDEX: slot %u leads to entry %u, which holds nothing\n", i, file);
+    }
+    if (count != index->count || deleted != index->deleted || count + deleted >= index->capacity)
+        damage(pDesc, "NAME INDEX: %u names and %u deleted in %u slots, the index says %u and %u\n", count, deleted,
+               index->capacity, index->count, index->deleted);
+}
+
+//Makes room for one more name, growing the index (or creating it) at 3/4 load
+int indexReserve(FS_descriptors* pDesc) {
+    FS_name_index* index = pDesc->name_index;
+    uint32_t capacity = FS_INDEX_INITIAL;
+
+    if (index != NULL) {
+        if ((index->count + index->deleted + 1) * 4 <= index->capacity * 3)
+            return ST_OK;
+        capacity = index->capacity;
+        while ((index->count + 1) * 2 > capacity)
+            capacity *= 2;
+    }
+    if (indexRebuild(pDesc, capacity) == ST_OK)
+        return ST_OK;
+    //no room for a bigger index: keep probing the old one while it has empty slots, or go without one
+    if (index == NULL || index->count + index->deleted + 1 < index->capacity)
+        return ST_OK;
+    return ST_NOT_ENOUGH_SPACE;
+}
+
+int indexRebuild(FS_descriptors* pDesc, uint32_t pCapacity) {
+    size_t size = indexSize(pCapacity);
+    uint32_t block = allocateSystemBlock(pDesc, (uint32_t) size);
+    FS_name_index* index;
+
+    if (block == FS_ENDPOINT)
+        return ST_NOT_ENOUGH_SPACE;
+    index = newTable(pDesc, FS_DATA_OFFSET + getUnit(pDesc, block)->offset, size);
+    if (index == NULL || indexTrack(pDesc, pCapacity) != ST_OK) {
+        if (index != NULL && !isMapped(pDesc, index))
+            free(index);
+        releaseBlock(pDesc, block);
+        return ST_NOT_ENOUGH_SPACE;
+    }
+    index->capacity = pCapacity;
+    index->count = 0;
+    index->deleted = 0;
+    for (uint32_t i = 0; i < pCapacity; ++i)
+        index->slots[i].file = FS_INDEX_EMPTY;
+
+    for (uint32_t dir = 0; dir < pDesc->info_block->directory_tables; ++dir) {
+        for (uint32_t file = 0; file < FS_DIRECTORY_FILES; ++file) {
+            if ((pDesc->directory_table[dir]->files_flags >> file) & 1) {
+                FS_file_entry* entry = &pDesc->directory_table[dir]->files[file];
+                indexPlace(index, hashName(entry->parent, (const char*) entry->name), dir * FS_DIRECTORY_FILES + file);
+                index->count += 1;
+            }
+        }
+    }
+
+    if (pDesc->name_index != NULL) {
+        if (!isMapped(pDesc, pDesc->name_index))
+            free(pDesc->name_index);
+        releaseBlock(pDesc, pDesc->info_block->name_index);
+    }
+    pDesc->name_index = index;
+    pDesc->info_block->name_index = block;
+    pDesc->index_fresh = 1;
+    pDesc->dirty_bytes += size;
+    return ST_OK;
+}
+
+uint32_t indexPlace(FS_name_index* pIndex, uint32_t pHash, uint32_t pFile) {
+    uint32_t mask = pIndex->capacity - 1;
+    uint32_t pos = pHash & mask;
+
+    while (pIndex->slots[pos].file != FS_INDEX_EMPTY && pIndex->slots[pos].file != FS_INDEX_DELETED)
+        pos = (pos + 1) & mask;
+    if (pIndex->slots[pos].file == FS_INDEX_DELETED)
+        pIndex->deleted -= 1;
+    pIndex->slots[pos].hash = pHash;
+    pIndex->slots[pos].file = pFile;
+    return pos;
+}
+
+void indexInsert(FS_descriptors* pDesc, uint32_t pFile) {
+    FS_file_entry* entry = getEntry(pDesc, pFile);
+
+    if (pDesc->name_index == NULL)
+        return;
+    uint32_t pos = indexPlace(pDesc->name_index, hashName(entry->parent, (const char*) entry->name), pFile);
+    pDesc->name_index->count += 1;
+    touchIndex(pDesc, pos);
+}
+
+void indexRemove(FS_descriptors* pDesc, uint32_t pFile) {
+    FS_name_index* index = pDesc->name_index;
+    FS_file_entry* entry = getEntry(pDesc, pFile);
+    uint32_t file;
+
+    if (index == NULL || indexFind(pDesc, entry->parent, (const char*) entry->name, &file) != ST_OK || file != pFile)
+        return;
+    uint32_t mask = index->capacity - 1;
+    uint32_t pos = hashName(entry->parent, (const char*) entry->name) & mask;
+    while (index->slots[pos].file != file)
+        pos = (pos + 1) & mask;
+    index->slots[pos].file = FS_INDEX_DELETED;
+    index->count -= 1;
+    index->deleted += 1;
+    touchIndex(pDesc, pos);
+}
+
+//B+TREES: one per directory, nodes are read on first use and stay; like the tables they are copies even when mapped.
+//Readers may load nodes side by side, so a node is published once it is whole.
+FS_tree_node* treeNode(FS_descriptors* pDesc, uint32_t pBlock) {
+    FS_tree_node* node;
+
+    if (pBlock >= pDesc->info_block->allocation_tables * FS_ALLOC_UNITS)
+        return NULL;
+    if ((node = __atomic_load_n(&pDesc->nodes[pBlock], __ATOMIC_ACQUIRE)) != NULL)
+        return node;
+    pthread_mutex_lock(&pDesc->nodes_lock);
+    node = pDesc->nodes[pBlock];
+    if (node == NULL && systemBlock(pDesc, pBlock, pDesc->info_block->allocation_tables * FS_ALLOC_UNITS,
+                                    sizeof(FS_tree_node)) && (node = malloc(sizeof(FS_tree_node))) != NULL) {
+        off_t offset = (off_t) (FS_DATA_OFFSET) + (off_t) getUnit(pDesc, pBlock)->offset;
+        metricCount(COUNT_READ, sizeof(FS_tree_node));
+        if (pDesc->map != NULL)
+            memcpy(node, pDesc->map + offset, sizeof(FS_tree_node));
+        else {
+            metricCount(COUNT_SYSCALLS, 1);
+            if (pread(fileno(pDesc->drive), node, sizeof(FS_tree_node), offset) != sizeof(FS_tree_node))
+                memset(node, 0, sizeof(FS_tree_node));
+        }
+        if (crc32c(0, node, offsetof(FS_tree_node, checksum)) != node->checksum || node->leaf > 1 ||
+            node->count == 0 || node->count > FS_TREE_RECORDS) {
+            free(node);
+            node = NULL;
+        }
+        __atomic_store_n(&pDesc->nodes[pBlock], node, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&pDesc->nodes_lock);
+    return node;
+}
+
+//An empty node in a system block of its own
+uint32_t treeAlloc(FS_descriptors* pDesc, uint16_t pLeaf) {
+    uint32_t block = allocateSystemBlock(pDesc, sizeof(FS_tree_node));
+    FS_tree_node* node;
+
+    if (block == FS_ENDPOINT)
+        return FS_ENDPOINT;
+    if ((node = calloc(1, sizeof(FS_tree_node))) == NULL) {
+        releaseBlock(pDesc, block);
+        return FS_ENDPOINT;
+    }
+    node->leaf = pLeaf;
+    node->next = FS_ENDPOINT;
+    pDesc->nodes[block] = node;
+    touchNode(pDesc, block);
+    return block;
+}
+
+void treeFree(FS_descriptors* pDesc, uint32_t pBlock) {
+    if (pDesc->nodes_dirty[pBlock]) {
+        pDesc->nodes_dirty[pBlock] = 0;
+        pDesc->nodes_touched -= 1;
+    }
+    free(pDesc->nodes[pBlock]);
+    pDesc->nodes[pBlock] = NULL;
+    releaseBlock(pDesc, pBlock);
+}
+
+//pDirectory is an entry, or FS_ENDPOINT for the top directory, whose root the info block holds
+uint32_t treeRoot(FS_descriptors* pDesc, uint32_t pDirectory) {
+    return pDirectory == FS_ENDPOINT ? pDesc->info_block->root : getEntry(pDesc, pDirectory)->tree;
+}
+
+void setRoot(FS_descriptors* pDesc, uint32_t pDirectory, uint32_t pNode) {
+    if (pDirectory == FS_ENDPOINT) {
+        pDesc->info_block->root = pNode;
+        return;
+    }
+    getEntry(pDesc, pDirectory)->tree = pNode;
+    touchDirectory(pDesc, pDirectory);
+}
+
+int compareName(const uint8_t* pRecordName, const char* pName) {
+    return strncmp((const char*) pRecordName, pName, FS_MAX_NAME - 1);
+}
+
+//The first record whose name comes after pName; an inner node leads to pName through the one before it
+uint32_t treeSearch(FS_tree_node* pNode, const char* pName) {
+    uint32_t low = pNode->leaf ? 0 : 1;
+    uint32_t high = pNode->count;
+
+    while (low < high) {
+        uint32_t middle = (low + high) / 2;
+        if (compareName(pNode->records[middle].name, pName) <= 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+//The nodes from pRoot down to the leaf where pName belongs, and the record taken in each: the child in an inner node,
+//the first record after pName in the leaf
+int treePath(FS_descriptors* pDesc, uint32_t pRoot, const char* pName, uint32_t* pPath, uint32_t* pSlots,
+             uint32_t* pDepth) {
+    uint32_t block = pRoot;
+
+    for (uint32_t level = 0; level < FS_TREE_DEPTH; ++level) {
+        FS_tree_node* node = treeNode(pDesc, block);
+        if (node == NULL)
+            return ST_CORRUPT;
+        metricCount(COUNT_TABLES, 1);
+        pPath[level] = block;
+        pSlots[level] = treeSearch(node, pName);
+        if (node->leaf) {
+            *pDepth = level + 1;
+            return ST_OK;
+        }
+        pSlots[level] -= 1;
+        block = node->records[pSlots[level]].target;
+    }
+    return ST_CORRUPT;
+}
+
+int treeFind(FS_descriptors* pDesc, uint32_t pDirectory, const char* pName, uint32_t* pFile) {
+    uint32_t path[FS_TREE_DEPTH];
+    uint32_t slots[FS_TREE_DEPTH];
+    uint32_t root = treeRoot(pDesc, pDirectory);
+    uint32_t depth;
+    FS_tree_node* leaf;
+    int result;
+
+    if (root == FS_ENDPOINT)
+        return ST_NOT_FOUND;
+    if ((result = treePath(pDesc, root, pName, path, slots, &depth)) != ST_OK)
+        return result;
+    leaf = pDesc->nodes[path[depth - 1]];
+    if (slots[depth - 1] == 0 || compareName(leaf->records[slots[depth - 1] - 1].name, pName) != 0)
+        return ST_NOT_FOUND;
+    *pFile = leaf->records[slots[depth - 1] - 1].target;
+    return liveEntry(pDesc, *pFile) ? ST_OK : ST_CORRUPT;
+}
+
+//Files pFile under pName, which is not there yet. A full node splits in two and its upper half goes to a new node
+//on the right; the nodes the splits need are taken first, so a lack of space leaves the tree as it was.
+int treeInsert(FS_descriptors* pDesc, uint32_t pDirectory, const char* pName, uint32_t pFile) {
+    uint32_t path[FS_TREE_DEPTH];
+    uint32_t slots[FS_TREE_DEPTH];
+    uint32_t spare[FS_TREE_DEPTH + 1];
+    FS_tree_record all[FS_TREE_RECORDS + 1];
+    FS_tree_record record;
+    uint32_t root = treeRoot(pDesc, pDirectory);
+    uint32_t depth;
+    uint32_t full = 0;
+    uint32_t needed;
+    int result;
+
+    memset(&record, 0, sizeof(record));
+    strncpy((char*) record.name, pName, FS_MAX_NAME - 1);
+    record.target = pFile;
+
+    //FIRST NAME: a leaf of its own is the root
+    if (root == FS_ENDPOINT) {
+        if ((root = treeAlloc(pDesc, 1)) == FS_ENDPOINT)
+            return ST_NOT_ENOUGH_SPACE;
+        pDesc->nodes[root]->records[0] = record;
+        pDesc->nodes[root]->count = 1;
+        setRoot(pDesc, pDirectory, root);
+        return ST_OK;
+    }
+    if ((result = treePath(pDesc, root, pName, path, slots, &depth)) != ST_OK)
+        return result;
+
+    while (full < depth && pDesc->nodes[path[depth - 1 - full]]->count == FS_TREE_RECORDS)
+        full += 1;
+    needed = full + (full == depth);
+    if (full == FS_TREE_DEPTH)
+        return ST_NOT_ENOUGH_SPACE;
+    for (uint32_t i = 0; i < needed; ++i) {
+        if ((spare[i] = treeAlloc(pDesc, 0)) != FS_ENDPOINT)
+            continue;
+        while (i-- > 0)
+            treeFree(pDesc, spare[i]);
+        return ST_NOT_ENOUGH_SPACE;
+    }
+
+    for (uint32_t level = depth; level-- > 0;) {
+        FS_tree_node* node = pDesc->nodes[path[level]];
+        uint32_t at = node->leaf ? slots[level] : slots[level] + 1;
+        uint32_t right;
+        FS_tree_node* sibling;
+
+        touchNode(pDesc, path[level]);
+        if (node->count < FS_TREE_RECORDS) {
+            memmove(&node->records[at + 1], &node->records[at], (node->count - at) * sizeof(FS_tree_record));
+            node->records[at] = record;
+            node->count += 1;
+            return ST_OK;
+        }
+
+        //SPLIT: the right half's first name leads to it from the level above
+        memcpy(all, node->records, at * sizeof(FS_tree_record));
+        all[at] = record;
+        memcpy(&all[at + 1], &node->records[at], (node->count - at) * sizeof(FS_tree_record));
+        right = spare[--needed];
+        sibling = pDesc->nodes[right];
+        node->count = (FS_TREE_RECORDS + 1) / 2;
+        sibling->count = FS_TREE_RECORDS + 1 - node->count;
+        memcpy(node->records, all, node->count * sizeof(FS_tree_record));
+        memset(&node->records[node->count], 0, (FS_TREE_RECORDS - node->count) * sizeof(FS_tree_record));
+        memcpy(sibling->records, &all[node->count], sibling->count * sizeof(FS_tree_record));
+        sibling->leaf = node->leaf;
+        if (node->leaf) {
+            sibling->next = node->next;
+            node->next = right;
+        }
+        record = sibling->records[0];
+        record.target = right;
+    }
+
+    //ROOT SPLIT: a new root above both halves
+    root = spare[--needed];
+    pDesc->nodes[root]->records[0] = pDesc->nodes[path[0]]->records[0];
+    pDesc->nodes[root]->records[0].target = path[0];
+    pDesc->nodes[root]->records[1] = record;
+    pDesc->nodes[root]->count = 2;
+    setRoot(pDesc, pDirectory, root);
+    return ST_OK;
+}
+
+//A leaf left empty goes, with its record in the node above, and so on up; a root left with one child gives way to it.
+//Nodes are not merged otherwise.
+int treeRemove(FS_descriptors* pDesc, uint32_t pDirectory, const char* pName) {
+    uint32_t path[FS_TREE_DEPTH];
+    uint32_t slots[FS_TREE_DEPTH];
+    uint32_t root = treeRoot(pDesc, pDirectory);
+    uint32_t previous = FS_ENDPOINT;
+    uint32_t depth;
+    FS_tree_node* leaf;
+    FS_tree_node* node;
+    int result;
+
+    if (root == FS_ENDPOINT)
+        return ST_NOT_FOUND;
+    if ((result = treePath(pDesc, root, pName, path, slots, &depth)) != ST_OK)
+        return result;
+    leaf = pDesc->nodes[path[depth - 1]];
+    if (slots[depth - 1] == 0 || compareName(leaf->records[slots[depth - 1] - 1].name, pName) != 0)
+        return ST_NOT_FOUND;
+    slots[depth - 1] -= 1;
+
+    //PREVIOUS LEAF of one about to go: right down from the child before the closest branch to the left
+    if (leaf->count == 1 && depth > 1) {
+        uint32_t level = depth - 1;
+        while (level > 0 && slots[level - 1] == 0)
+            level -= 1;
+        if (level > 0) {
+            previous = pDesc->nodes[path[level - 1]]->records[slots[level - 1] - 1].target;
+            for (; level < depth - 1; ++level) {
+                if ((node = treeNode(pDesc, previous)) == NULL)
+                    return ST_CORRUPT;
+                previous = node->records[node->count - 1].target;
+            }
+            if (treeNode(pDesc, previous) == NULL)
+                return ST_CORRUPT;
+        }
+    }
+
+    for (uint32_t level = depth; level-- > 0;) {
+        node = pDesc->nodes[path[level]];
+        node->count -= 1;
+        memmove(&node->records[slots[level]], &node->records[slots[level] + 1],
+                (node->count - slots[level]) * sizeof(FS_tree_record));
+        memset(&node->records[node->count], 0, sizeof(FS_tree_record));
+        touchNode(pDesc, path[level]);
+        if (node->count > 0)
+            break;
+        if (node->leaf && previous != FS_ENDPOINT) {
+            pDesc->nodes[previous]->next = node->next;
+            touchNode(pDesc, previous);
+        }
+        treeFree(pDesc, path[level]);
+        if (level == 0)
+            setRoot(pDesc, pDirectory, FS_ENDPOINT);
+    }
+
+    while ((root = treeRoot(pDesc, pDirectory)) != FS_ENDPOINT && !pDesc->nodes[root]->leaf &&
+           pDesc->nodes[root]->count == 1 && treeNode(pDesc, pDesc->nodes[root]->records[0].target) != NULL) {
+        setRoot(pDesc, pDirectory, pDesc->nodes[root]->records[0].target);
+        treeFree(pDesc, root);
+    }
+    return ST_OK;
+}
+
+//Places pCursor on the first name after pAfter, or the first of all when it is NULL
+int treeSeek(FS_descriptors* pDesc, uint32_t pDirectory, const char* pAfter, FS_tree_cursor* pCursor) {
+    uint32_t path[FS_TREE_DEPTH];
+    uint32_t slots[FS_TREE_DEPTH];
+    uint32_t root = treeRoot(pDesc, pDirectory);
+    uint32_t depth;
+    int result;
+
+    pCursor->leaf = NULL;
+    pCursor->slot = 0;
+    if (root == FS_ENDPOINT)
+        return ST_OK;
+    if ((result = treePath(pDesc, root, pAfter != NULL ? pAfter : "", path, slots, &depth)) != ST_OK)
+        return result;
+    pCursor->leaf = pDesc->nodes[path[depth - 1]];
+    pCursor->slot = slots[depth - 1];
+    return ST_OK;
+}
+
+//The record under pCursor, which moves on to the next; *pRecord is NULL past the last
+int treeStep(FS_descriptors* pDesc, FS_tree_cursor* pCursor, FS_tree_record** pRecord) {
+    *pRecord = NULL;
+    while (pCursor->leaf != NULL && pCursor->slot == pCursor->leaf->count) {
+        if (pCursor->leaf->next == FS_ENDPOINT) {
+            pCursor->leaf = NULL;
+            return ST_OK;
+        }
+        if ((pCursor->leaf = treeNode(pDesc, pCursor->leaf->next)) == NULL)
+            return ST_CORRUPT;
+        metricCount(COUNT_TABLES, 1);
+        pCursor->slot = 0;
+    }
+    if (pCursor->leaf == NULL)
+        return ST_OK;
+    *pRecord = &pCursor->leaf->records[pCursor->slot++];
+    return liveEntry(pDesc, (*pRecord)->target) ? ST_OK : ST_CORRUPT;
+}
+
+//Moves pSize bytes between pData and pFile's file position, below the FILE* layer like blockCopy
+int streamCopy(FILE* pFile, uint8_t* pData, uint64_t pSize, uint8_t pDirection) {
+    int fd = fileno(pFile);
+    ssize_t done;
+
+    fflush(pFile);
+    while (pSize > 0) {
+        if (pDirection == DIR_FROM_FILE)
+            done = read(fd, pData, pSize);
+        else
+            done = write(fd, pData, pSize);
+        if (done <= 0)
+            return ST_IO_ERROR;
+        pData += done;
+        pSize -= (uint64_t) done;
+    }
+    return ST_OK;
+}
+
+int blockCopy(FS_descriptors* pDesc, FILE* pFile, FS_allocation_unit* pUnit, uint64_t pSize, uint8_t pDirection) {
+    uint8_t* buf = NULL;
+    int result = ST_OK;
+    int driveFd = fileno(pDesc->drive);
+    int fileFd = fileno(pFile);
+    off_t offset = (off_t) (FS_DATA_OFFSET) + pUnit->offset;
+    uint64_t start = metricClock();
+    ssize_t done;
+
+    //stdio buffers must not shadow what is copied below the FILE* layer; saves leave the drive's flushed for readers
+    if (pDirection == DIR_FROM_FILE)
+        fflush(pDesc->drive);
+    fflush(pFile);
+    metricCount(pDirection == DIR_FROM_FILE ? COUNT_WRITTEN : COUNT_READ, pSize);
+
+    //MAPPED: copy straight between the file and the mapping
+    if (pDesc->map != NULL) {
+        uint8_t* data = pDesc->map + offset;
+        while (pSize > 0) {
+            metricCount(COUNT_SYSCALLS, 1);
+            if (pDirection == DIR_FROM_FILE)
+                done = read(fileFd, data, pSize);
+            else
+                done = write(fileFd, data, pSize);
+            if (done <= 0)
+                return ST_IO_ERROR;
+            data += done;
+            pSize -= done;
+        }
+        metricTime(METRIC_COPY, start);
+        return ST_OK;
+    }
+
+    //KERNEL SIDE COPY, file side uses (and advances) the file position
+    while (pSize > 0) {
+        metricCount(COUNT_SYSCALLS, 1);
+        if (pDirection == DIR_FROM_FILE)
+            done = copy_file_range(fileFd, NULL, driveFd, &offset, pSize, 0);
+        else
+            done = copy_file_range(driveFd, &offset, fileFd, NULL, pSize, 0);
+        if (done <= 0)
+            break;
+        pSize -= done;
+    }
+
+    while (pSize > 0) {
+        metricCount(COUNT_SYSCALLS, 1);
+        if (pDirection == DIR_FROM_FILE) {
+            if (lseek(driveFd, offset, SEEK_SET) < 0)
+                break;
+            done = sendfile(driveFd, fileFd, NULL, pSize);
+            if (done > 0)
+                offset += done;
+        } else {
+            done = sendfile(fileFd, driveFd, &offset, pSize);
+        }
+        if (done <= 0)
+            break;
+        pSize -= done;
+    }
+
+    //FALLBACK: LARGE ALIGNED BUFFER, one per call since readers copy concurrently
+    if (pSize > 0 && posix_memalign((void**) &buf, COPY_ALIGN, COPY_CHUNK) != 0)
+        return ST_IO_ERROR;
+    while (pSize > 0) {
+        size_t size = pSize > COPY_CHUNK ? COPY_CHUNK : pSize;
+        ssize_t got;
+        metricCount(COUNT_SYSCALLS, 2);
+        if (pDirection == DIR_FROM_FILE) {
+            got = read(fileFd, buf, size);
+            if (got <= 0 || pwrite(driveFd, buf, (size_t) got, offset) != got) {
+                result = ST_IO_ERROR;
+                break;
+            }
+        } else {
+            got = pread(driveFd, buf, size, offset);
+            if (got <= 0 || write(fileFd, buf, (size_t) got) != got) {
+                result = ST_IO_ERROR;
+                break;
+            }
+        }
+        offset += got;
+        pSize -= got;
+    }
+    free(buf);
+    metricTime(METRIC_COPY, start);
+    return result;
+}
+
+//Copies the whole of pUnit between the drive and memory, by offset so concurrent readers do not interfere
+int bufferCopy(FS_descriptors* pDesc, uint8_t* pBuffer, FS_allocation_unit* pUnit, uint8_t pDirection) {
+    int driveFd = fileno(pDesc->drive);
+    off_t offset = (off_t) (FS_DATA_OFFSET) + pUnit->offset;
+    uint64_t size = pUnit->size;
+    uint64_t start = metricClock();
+    ssize_t done;
+
+    if (pDirection == DIR_FROM_FILE)
+        fflush(pDesc->drive);
+    metricCount(pDirection == DIR_FROM_FILE ? COUNT_WRITTEN : COUNT_READ, size);
+    if (pDesc->map != NULL) {
+        if (pDirection == DIR_FROM_FILE)
+            memcpy(pDesc->map + offset, pBuffer, size);
+        else
+            memcpy(pBuffer, pDesc->map + offset, size);
+        metricTime(METRIC_COPY, start);
+        return ST_OK;
+    }
+
+    while (size > 0) {
+        metricCount(COUNT_SYSCALLS, 1);
+        if (pDirection == DIR_FROM_FILE)
+            done = pwrite(driveFd, pBuffer, size, offset);
+        else
+            done = pread(driveFd, pBuffer, size, offset);
+        if (done <= 0)
+            return ST_IO_ERROR;
+        pBuffer += done;
+        offset += done;
+        size -= (uint64_t) done;
+    }
+    metricTime(METRIC_COPY, start);
+    return ST_OK;
+}
+
+//Adds the copy of pUnit to the batch in pRequests, which goes to the I/O engine once it holds FS_IO_DEPTH copies.
+//Without an engine, or with a map, the copy is made at once.
+int queueCopy(FS_descriptors* pDesc, FS_io_request* pRequests, uint32_t* pCount, uint8_t* pBuffer,
+              FS_allocation_unit* pUnit, uint8_t pDirection) {
+    if (pDesc->io == NULL || pDesc->map != NULL)
+        return bufferCopy(pDesc, pBuffer, pUnit, pDirection);
+    pRequests[(*pCount)++] = (FS_io_request) {pBuffer, pUnit->size, (off_t) (FS_DATA_OFFSET) + (off_t) pUnit->offset,
+                                              pDirection == DIR_FROM_FILE};
+    return *pCount < FS_IO_DEPTH ? ST_OK : flushCopies(pDesc, pRequests, pCount);
+}
+
+//Submits the copies queued so far and waits for all of them
+int flushCopies(FS_descriptors* pDesc, FS_io_request* pRequests, uint32_t* pCount) {
+    uint32_t count = *pCount;
+    uint64_t start = metricClock();
+    int result;
+
+    *pCount = 0;
+    if (count == 0)
+        return ST_OK;
+    if (pRequests[0].write)
+        fflush(pDesc->drive);
+    result = ioSubmit(pDesc->io, fileno(pDesc->drive), pRequests, count) == 0 ? ST_OK : ST_IO_ERROR;
+    metricTime(METRIC_COPY, start);
+    return result;
+}
+
+int createAllocationBlock(FS_descriptors* pDesc) {
+    uint32_t tables = pDesc->info_block->allocation_tables;
+    uint32_t freeBlock = findBlockSize(pDesc, FS_FREE, sizeof(FS_allocation_table));
+    if (freeBlock == FS_ENDPOINT)
+        return ST_NOT_ENOUGH_SPACE;
+    if (reserveTables(pDesc, tables + 1, 0) != ST_OK)
+        return ST_NOT_ENOUGH_SPACE;
+    if (extentGrow(&pDesc->extents, (tables + 1) * FS_ALLOC_UNITS) != 0)
+        return ST_NOT_ENOUGH_SPACE;
+
+    FS_allocation_unit* freeUnit = getUnit(pDesc, freeBlock);
+    FS_allocation_table* table = malloc(sizeof(FS_allocation_table));
+    if (table == NULL)
+        return ST_NOT_ENOUGH_SPACE;
+    memset(table, FS_UNUSED, sizeof(FS_allocation_table));
+    pDesc->allocation_table[tables] = table;
+    table->offset_next = FS_ENDPOINT;
+    table->unused_units = FS_ALLOC_UNITS;
+
+    //the table takes the head of the free block, its first unit keeps the rest
+    extentRemoveFree(&pDesc->extents, freeBlock);
+    if (freeUnit->size > sizeof(FS_allocation_table)) {
+        FS_allocation_unit* newUnit = &table->units[0];
+        newUnit->type = FS_FREE;
+        newUnit->flags = 0;
+        newUnit->size = freeUnit->size - sizeof(FS_allocation_table);
+        newUnit->next_block = FS_ENDPOINT;
+        newUnit->offset = freeUnit->offset + sizeof(FS_allocation_table);
+        table->unused_units -= 1;
+        extentInsertFree(&pDesc->extents, tables * FS_ALLOC_UNITS, newUnit->offset, newUnit->size);
+        extentLinkAfter(&pDesc->extents, tables * FS_ALLOC_UNITS, freeBlock);
+    }
+    freeUnit->type = FS_SYSTEM;
+    freeUnit->size = sizeof(FS_allocation_table);
+    freeUnit->next_block = FS_ENDPOINT;
+    touchAllocation(pDesc, freeBlock);
+    touchAllocation(pDesc, tables * FS_ALLOC_UNITS);
+    touchAllocation(pDesc, (tables - 1) * FS_ALLOC_UNITS);
+    pDesc->info_block->free -= sizeof(FS_allocation_table);
+
+    for (uint32_t unit = FS_ALLOC_UNITS; unit-- > 0;)
+        if (table->units[unit].type == FS_UNUSED)
+            extentPushUnused(&pDesc->extents, tables * FS_ALLOC_UNITS + unit);
+    pDesc->allocation_table[tables - 1]->offset_next = freeBlock;
+    pDesc->info_block->allocation_tables += 1;
+    return ST_OK;
+}
+
+int createDirectoryBlock(FS_descriptors* pDesc) {
+    uint32_t tables = pDesc->info_block->directory_tables;
+    if (reserveTables(pDesc, 0, tables + 1) != ST_OK)
+        return ST_NOT_ENOUGH_SPACE;
+    uint32_t nextBlock = allocateSystemBlock(pDesc, sizeof(FS_directory_table));
+    if (nextBlock == FS_ENDPOINT)
+        return ST_NOT_ENOUGH_SPACE;
+    FS_directory_table* table = malloc(sizeof(FS_directory_table));
+    if (table == NULL)
+        return ST_NOT_ENOUGH_SPACE;
+    memset(table, 0, sizeof(FS_directory_table));
+    table->offset_next = FS_ENDPOINT;
+    pDesc->directory_table[tables] = table;
+    pDesc->directory_table[tables - 1]->offset_next = nextBlock;
+    pDesc->info_block->directory_tables += 1;
+    touchDirectory(pDesc, tables * FS_DIRECTORY_FILES);
+    touchDirectory(pDesc, (tables - 1) * FS_DIRECTORY_FILES);
+    return ST_OK;
+}
+
+uint32_t allocateSystemBlock(FS_descriptors* pDesc, uint32_t pSize) {
+    uint32_t block;
+
+    if (pSize > pDesc->info_block->size)
+        return FS_ENDPOINT;
+
+    block = findBlockSize(pDesc, FS_FREE, pSize);
+    if (block == FS_ENDPOINT) {
+        //free space in pieces too small, FS defrag gathers it
+        return FS_ENDPOINT;
+    }
+    //the split needs a spare unit; a new allocation table may take the very block found above
+    if (getUnit(pDesc, block)->size > pSize && findBlock(pDesc, FS_UNUSED) == FS_ENDPOINT) {
+        if (createAllocationBlock(pDesc) != ST_OK)
+            return FS_ENDPOINT;
+        block = findBlockSize(pDesc, FS_FREE, pSize);
+        if (block == FS_ENDPOINT)
+            return FS_ENDPOINT;
+    }
+
+    takeBlock(pDesc, block, pSize, FS_SYSTEM);
+    return block;
+}
+
+uint32_t findBlock(FS_descriptors* pDesc, uint8_t pType) {
+    if (pType == FS_FREE)
+        return extentLargest(&pDesc->extents);
+    if (pType == FS_UNUSED)
+        return extentPeekUnused(&pDesc->extents);
+    return FS_ENDPOINT;
+}
+
+uint32_t findBlockSize(FS_descriptors* pDesc, uint8_t pType, uint64_t pSize) {
+    if (pType == FS_FREE)
+        return extentBestFit(&pDesc->extents, pSize);
+    return FS_ENDPOINT;
+}
+
+off_t fsize(FILE* pFile) {
+    off_t size;
+    fpos_t pos;
+    fgetpos(pFile, &pos);
+    fseeko(pFile, 0, SEEK_END);
+    size = ftello(pFile);
+    fsetpos(pFile, &pos);
+    return size;
+}
+
+//Merges free pBlock with a free neighbour by offset, returns the surviving block or FS_ENDPOINT
+uint32_t defragBlock(FS_descriptors* pDesc, uint32_t pBlock) {
+    uint32_t prev = extentPrev(&pDesc->extents, pBlock);
+    uint32_t next = extentNext(&pDesc->extents, pBlock);
+
+    //LEFT:
+    if (prev != FS_ENDPOINT && getUnit(pDesc, prev)->type == FS_FREE) {
+        mergeBlocks(pDesc, prev, pBlock);
+        return prev;
+    }
+    //RIGHT:
+    if (next != FS_ENDPOINT && getUnit(pDesc, next)->type == FS_FREE) {
+        mergeBlocks(pDesc, pBlock, next);
+        return pBlock;
+    }
+    return FS_ENDPOINT;
+}
+
+//DEFRAG: compaction from the front of the image, then files still in pieces copied whole and compacted again
+int defragment(FS_descriptors* pDesc, uint32_t pMillis, FS_defrag_report* pReport) {
+    FS_defrag_state state;
+    struct timespec now;
+    int result;
+
+    memset(&state, 0, sizeof(state));
+    memset(pReport, 0, sizeof(FS_defrag_report));
+    if (pMillis > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        state.deadline = (uint64_t) now.tv_sec * 1000000000u + now.tv_nsec + (uint64_t) pMillis * 1000000u;
+    }
+    fragmentation(pDesc, &pReport->before);
+
+    //every rejoin leaves holes behind, compacting them may make room to rejoin more
+    result = compact(pDesc, &state);
+    fragmentation(pDesc, &pReport->after);
+    while (result == ST_OK && !state.expired) {
+        uint32_t extents = pReport->after.file_extents;
+        result = rejoinFiles(pDesc, &state);
+        if (result == ST_OK)
+            result = compact(pDesc, &state);
+        fragmentation(pDesc, &pReport->after);
+        if (pReport->after.file_extents >= extents)
+            break;
+    }
+    if (defragCommit(pDesc, &state) != ST_OK)
+        result = ST_IO_ERROR;
+
+    fragmentation(pDesc, &pReport->after);
+    pReport->moved = state.moved;
+    pReport->moves = state.moves;
+    pReport->complete = result == ST_OK && !state.expired;
+    return result == ST_NOT_ENOUGH_SPACE ? ST_OK : result;
+}
+
+void fragmentation(FS_descriptors* pDesc, FS_fragmentation* pOut) {
+    memset(pOut, 0, sizeof(FS_fragmentation));
+    for (uint32_t block = pDesc->extents.first; block != FS_ENDPOINT; block = extentNext(&pDesc->extents, block)) {
+        FS_allocation_unit* unit = getUnit(pDesc, block);
+        if (unit->type != FS_FREE)
+            continue;
+        pOut->free_extents += 1;
+        if (unit->size > pOut->largest_free)
+            pOut->largest_free = unit->size;
+    }
+    for (uint32_t dir = 0; dir < pDesc->info_block->directory_tables; ++dir) {
+        for (uint32_t file = 0; file < FS_DIRECTORY_FILES; ++file) {
+            if (!((pDesc->directory_table[dir]->files_flags >> file) & 1) ||
+                pDesc->directory_table[dir]->files[file].flags & FS_ENTRY_INLINE)
+                continue;
+            pOut->files += 1;
+            for (uint32_t block = pDesc->directory_table[dir]->files[file].block; block != FS_ENDPOINT;
+                 block = getUnit(pDesc, block)->next_block)
+                pOut->file_extents += 1;
+        }
+    }
+}
+
+//Moves the extent above the lowest hole into it, until the hole is the last extent of the image
+int compact(FS_descriptors* pDesc, FS_defrag_state* pState) {
+    uint32_t packed = FS_ENDPOINT;     //everything up to this extent is in place
+    uint32_t hole;
+    int result;
+
+    while ((hole = lowestFree(pDesc, packed)) != FS_ENDPOINT && !defragExpired(pState)) {
+        uint32_t block = extentNext(&pDesc->extents, hole);
+        uint32_t target = hole;
+
+        packed = extentPrev(&pDesc->extents, hole);
+        if (block == FS_ENDPOINT)
+            return ST_OK;
+        //any move may split its target
+        if (findBlock(pDesc, FS_UNUSED) == FS_ENDPOINT) {
+            if ((result = spareUnit(pDesc, pState)) != ST_OK)
+                return result;
+            continue;
+        }
+
+        //LARGER THAN THE HOLE: out of the way to let the hole grow, else down in hole-sized steps
+        if (getUnit(pDesc, block)->size > getUnit(pDesc, hole)->size) {
+            target = findBlockSize(pDesc, FS_FREE, getUnit(pDesc, block)->size);
+            if (target == FS_ENDPOINT && getUnit(pDesc, block)->type == FS_OCCUPIED) {
+                splitBlock(pDesc, block, getUnit(pDesc, hole)->size);
+                target = hole;
+            } else if (target == FS_ENDPOINT) {
+                //a table nothing can take stays where it is
+                packed = block;
+                continue;
+            }
+        }
+        if ((result = moveBlock(pDesc, block, target, pState)) != ST_OK)
+            return result;
+        if (target == hole)
+            joinBlock(pDesc, block);
+    }
+    return ST_OK;
+}
+
+//Copies every file still in pieces into one free extent that takes it whole
+int rejoinFiles(FS_descriptors* pDesc, FS_defrag_state* pState) {
+    int result;
+
+    for (uint32_t dir = 0; dir < pDesc->info_block->directory_tables; ++dir) {
+        for (uint32_t file = 0; file < FS_DIRECTORY_FILES; ++file) {
+            FS_file_entry* entry = &pDesc->directory_table[dir]->files[file];
+            uint32_t block;
+            uint32_t target;
+            uint64_t offset;
+            uint64_t stored;
+            uint32_t crc = 0;
+            uint8_t checked = FS_UNIT_CHECKED;
+
+            if (!((pDesc->directory_table[dir]->files_flags >> file) & 1) || entry->block == FS_ENDPOINT ||
+                getUnit(pDesc, entry->block)->next_block == FS_ENDPOINT)
+                continue;
+            if (defragExpired(pState))
+                return ST_OK;
+            if (findBlock(pDesc, FS_UNUSED) == FS_ENDPOINT && (result = spareUnit(pDesc, pState)) != ST_OK)
+                return result;
+            stored = storedSize(pDesc, entry);
+            target = findBlockSize(pDesc, FS_FREE, stored);
+            if (target == FS_ENDPOINT)
+                continue;
+            offset = getUnit(pDesc, target)->offset;
+            if (defragClaim(pDesc, pState, offset, stored) != ST_OK)
+                return ST_IO_ERROR;
+
+            for (block = entry->block; block != FS_ENDPOINT; block = getUnit(pDesc, block)->next_block) {
+                FS_allocation_unit* unit = getUnit(pDesc, block);
+                if (rangeCopy(pDesc, (off_t) (FS_DATA_OFFSET) + unit->offset, (off_t) (FS_DATA_OFFSET) + offset,
+                              unit->size) != ST_OK)
+                    return ST_IO_ERROR;
+                crc = crc32cCombine(crc, unit->checksum, unit->size);
+                checked &= unit->flags;
+                offset += unit->size;
+            }
+            block = entry->block;
+            takeBlock(pDesc, target, stored, FS_OCCUPIED);
+            getUnit(pDesc, target)->flags = checked;
+            getUnit(pDesc, target)->checksum = crc;
+            entry->block = target;
+            touchDirectory(pDesc, dir * FS_DIRECTORY_FILES + file);
+            while (block != FS_ENDPOINT) {
+                FS_allocation_unit* unit = getUnit(pDesc, block);
+                uint32_t next = unit->next_block;
+                defragFreed(pState, unit->offset, unit->size);
+                releaseBlock(pDesc, block);
+                block = next;
+            }
+            pState->moved += stored;
+            pState->moves += 1;
+            if (pDesc->dirty_bytes > pDesc->info_block->journal_size / 2 && defragCommit(pDesc, pState) != ST_OK)
+                return ST_IO_ERROR;
+        }
+    }
+    return ST_OK;
+}
+
+//Copies pBlock to the front of free pFree, which takes it whole and does not overlap it; its old place becomes free
+int moveBlock(FS_descriptors* pDesc, uint32_t pBlock, uint32_t pFree, FS_defrag_state* pState) {
+    FS_allocation_unit* unit = getUnit(pDesc, pBlock);
+    uint64_t size = unit->size;
+    uint64_t from = unit->offset;
+    uint64_t to = getUnit(pDesc, pFree)->offset;
+    uint8_t system = unit->type == FS_SYSTEM;
+    uint32_t prev;
+    uint32_t merged;
+
+    if (defragClaim(pDesc, pState, to, size) != ST_OK ||
+        rangeCopy(pDesc, (off_t) (FS_DATA_OFFSET) + from, (off_t) (FS_DATA_OFFSET) + to, size) != ST_OK)
+        return ST_IO_ERROR;
+    if (system && repointTable(pDesc, pBlock, to) != ST_OK)
+        return ST_NOT_ENOUGH_SPACE;
+
+    //a moved allocation table moves the units it holds, so they are looked up from here on
+    unit = getUnit(pDesc, pBlock);
+    FS_allocation_unit* free = getUnit(pDesc, pFree);
+    extentRemoveFree(&pDesc->extents, pFree);
+    if (free->size > size) {
+        uint32_t rest = extentPopUnused(&pDesc->extents);
+        FS_allocation_unit* restUnit = getUnit(pDesc, rest);
+        pDesc->allocation_table[rest / FS_ALLOC_UNITS]->unused_units -= 1;
+        restUnit->type = FS_FREE;
+        restUnit->flags = 0;
+        restUnit->offset = to + size;
+        restUnit->size = free->size - size;
+        restUnit->next_block = FS_ENDPOINT;
+        extentInsertFree(&pDesc->extents, rest, restUnit->offset, restUnit->size);
+        extentLinkAfter(&pDesc->extents, rest, pFree);
+        touchAllocation(pDesc, rest);
+    }
+
+    //SWAP PLACES in offset order: the block takes the front of the free one, which takes the block's old place
+    prev = extentPrev(&pDesc->extents, pBlock);
+    extentUnlink(&pDesc->extents, pBlock);
+    extentLinkAfter(&pDesc->extents, pBlock, pFree);
+    extentUnlink(&pDesc->extents, pFree);
+    extentLinkAfter(&pDesc->extents, pFree, prev == pFree ? pBlock : prev);
+    unit->offset = to;
+    free->offset = from;
+    free->size = size;
+    extentInsertFree(&pDesc->extents, pFree, from, size);
+    touchAllocation(pDesc, pBlock);
+    touchAllocation(pDesc, pFree);
+    defragFreed(pState, from, size);
+    pState->moved += size;
+    pState->moves += 1;
+    while ((merged = defragBlock(pDesc, pFree)) != FS_ENDPOINT)
+        pFree = merged;
+
+    //old transactions hold the table at its old place, they must not be replayed over whatever goes there
+    if (system) {
+        if (defragCommit(pDesc, pState) != ST_OK || journalCheckpoint(pDesc) != ST_OK)
+            return ST_IO_ERROR;
+    } else if (pDesc->dirty_bytes > pDesc->info_block->journal_size / 2 && defragCommit(pDesc, pState) != ST_OK)
+        return ST_IO_ERROR;
+    return ST_OK;
+}
+
+//The table in system block pBlock is saved at pOffset from now on; a mapped one is also read from there
+int repointTable(FS_descriptors* pDesc, uint32_t pBlock, uint64_t pOffset) {
+    off_t offset = (off_t) (FS_DATA_OFFSET) + (off_t) pOffset;
+
+    if (pDesc->info_block->name_index == pBlock) {
+        size_t size = indexSize(pDesc->name_index->capacity);
+        if (isMapped(pDesc, pDesc->name_index)) {
+            FS_name_index* index = loadTable(pDesc, offset, size);
+            if (index == NULL)
+                return ST_NOT_ENOUGH_SPACE;
+            pDesc->name_index = index;
+        }
+        pDesc->index_fresh = 1;
+        pDesc->dirty_bytes += size;
+        return ST_OK;
+    }
+    if (pDesc->info_block->dedup_index == pBlock) {
+        size_t size = dedupSize(pDesc->dedup_index->capacity);
+        if (isMapped(pDesc, pDesc->dedup_index)) {
+            FS_dedup_index* index = loadTable(pDesc, offset, size);
+            if (index == NULL)
+                return ST_NOT_ENOUGH_SPACE;
+            pDesc->dedup_index = index;
+        }
+        pDesc->dedup_fresh = 1;
+        pDesc->dirty_bytes += size;
+        return ST_OK;
+    }
+    //allocation and directory tables and B+tree nodes are copies even when mapped; a node is saved wherever its unit
+    //is by then
+    for (uint32_t i = 1; i < pDesc->info_block->allocation_tables; ++i) {
+        if (pDesc->allocation_table[i - 1]->offset_next != pBlock)
+            continue;
+        touchAllocation(pDesc, i * FS_ALLOC_UNITS);
+        return ST_OK;
+    }
+    for (uint32_t i = 1; i < pDesc->info_block->directory_tables; ++i) {
+        if (pDesc->directory_table[i - 1]->offset_next != pBlock)
+            continue;
+        touchDirectory(pDesc, i * FS_DIRECTORY_FILES);
+        return ST_OK;
+    }
+    return ST_OK;
+}
+
+//Cuts occupied pBlock after pSize bytes, the rest goes to a spare unit that follows it in the file
+void splitBlock(FS_descriptors* pDesc, uint32_t pBlock, uint64_t pSize) {
+    FS_allocation_unit* unit = getUnit(pDesc, pBlock);
+    uint32_t rest = extentPopUnused(&pDesc->extents);
+    FS_allocation_unit* restUnit = getUnit(pDesc, rest);
+
+    pDesc->allocation_table[rest / FS_ALLOC_UNITS]->unused_units -= 1;
+    restUnit->type = FS_OCCUPIED;
+    restUnit->flags = 0;
+    //the rest's CRC follows from the whole one and the head's, so only the head is read
+    if (unit->flags & FS_UNIT_CHECKED) {
+        uint32_t head;
+        unit->flags = 0;
+        if (extentChecksum(pDesc, unit->offset, pSize, &head) == ST_OK) {
+            unit->flags = restUnit->flags = FS_UNIT_CHECKED;
+            restUnit->checksum = unit->checksum ^ crc32cCombine(head, 0, unit->size - pSize);
+            unit->checksum = head;
+        }
+    }
+    restUnit->offset = unit->offset + pSize;
+    restUnit->size = unit->size - pSize;
+    restUnit->next_block = unit->next_block;
+    unit->size = pSize;
+    unit->next_block = rest;
+    extentLinkAfter(&pDesc->extents, rest, pBlock);
+    touchAllocation(pDesc, pBlock);
+    touchAllocation(pDesc, rest);
+}
+
+//Folds occupied pBlock into the extent right before it when that one comes right before it in the file too
+void joinBlock(FS_descriptors* pDesc, uint32_t pBlock) {
+    uint32_t prev = extentPrev(&pDesc->extents, pBlock);
+    FS_allocation_unit* unit = getUnit(pDesc, pBlock);
+    FS_allocation_unit* prevUnit;
+
+    if (prev == FS_ENDPOINT || unit->type != FS_OCCUPIED)
+        return;
+    prevUnit = getUnit(pDesc, prev);
+    if (prevUnit->type != FS_OCCUPIED || prevUnit->next_block != pBlock ||
+        prevUnit->offset + prevUnit->size != unit->offset)
+        return;
+    if (prevUnit->flags & unit->flags & FS_UNIT_CHECKED)
+        prevUnit->checksum = crc32cCombine(prevUnit->checksum, unit->checksum, unit->size);
+    else
+        prevUnit->flags = 0;
+    prevUnit->size += unit->size;
+    prevUnit->next_block = unit->next_block;
+    unit->type = FS_UNUSED;
+    pDesc->allocation_table[pBlock / FS_ALLOC_UNITS]->unused_units += 1;
+    extentUnlink(&pDesc->extents, pBlock);
+    extentPushUnused(&pDesc->extents, pBlock);
+    touchAllocation(pDesc, prev);
+    touchAllocation(pDesc, pBlock);
+}
+
+uint32_t lowestFree(FS_descriptors* pDesc, uint32_t pAfter) {
+    uint32_t block = pAfter == FS_ENDPOINT ? pDesc->extents.first : extentNext(&pDesc->extents, pAfter);
+
+    while (block != FS_ENDPOINT && getUnit(pDesc, block)->type != FS_FREE)
+        block = extentNext(&pDesc->extents, block);
+    return block;
+}
+
+//A new allocation table is written where it lands at once when mapped, so nothing may be moved out of there uncommitted
+int spareUnit(FS_descriptors* pDesc, FS_defrag_state* pState) {
+    if (defragCommit(pDesc, pState) != ST_OK)
+        return ST_IO_ERROR;
+    return createAllocationBlock(pDesc);
+}
+
+//Commits first when pSize bytes at pOffset were moved out of since the last commit
+int defragClaim(FS_descriptors* pDesc, FS_defrag_state* pState, uint64_t pOffset, uint64_t pSize) {
+    if (pState->freed_from < pState->freed_to && pOffset < pState->freed_to &&
+        pOffset + pSize > pState->freed_from)
+        return defragCommit(pDesc, pState);
+    return ST_OK;
+}
+
+void defragFreed(FS_defrag_state* pState, uint64_t pOffset, uint64_t pSize) {
+    if (pState->freed_from == pState->freed_to) {
+        pState->freed_from = pOffset;
+        pState->freed_to = pOffset + pSize;
+        return;
+    }
+    if (pOffset < pState->freed_from)
+        pState->freed_from = pOffset;
+    if (pOffset + pSize > pState->freed_to)
+        pState->freed_to = pOffset + pSize;
+}
+
+//The copies reach the disk with the commit's sync, before the metadata pointing at them
+int defragCommit(FS_descriptors* pDesc, FS_defrag_state* pState) {
+    uint64_t start = metricClock();
+    int result;
+
+    pState->freed_from = 0;
+    pState->freed_to = 0;
+    if (pDesc->dirty_bytes == 0)
+        return ST_OK;
+    result = saveDescriptors(pDesc);
+    metricTime(METRIC_SAVE, start);
+    return result;
+}
+
+int defragExpired(FS_defrag_state* pState) {
+    struct timespec now;
+
+    if (pState->deadline == 0 || pState->expired)
+        return pState->expired;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    pState->expired = (uint64_t) now.tv_sec * 1000000000u + now.tv_nsec >= pState->deadline;
+    return pState->expired;
+}
+
+//Copies pSize bytes of the drive from pFrom to pTo, the ranges do not overlap
+int rangeCopy(FS_descriptors* pDesc, off_t pFrom, off_t pTo, uint64_t pSize) {
+    int fd = fileno(pDesc->drive);
+    uint8_t* buf = NULL;
+    int result = ST_OK;
+    uint64_t start = metricClock();
+    ssize_t done;
+
+    metricCount(COUNT_READ, pSize);
+    metricCount(COUNT_WRITTEN, pSize);
+    if (pDesc->map != NULL) {
+        memcpy(pDesc->map + pTo, pDesc->map + pFrom, pSize);
+        metricTime(METRIC_COPY, start);
+        return ST_OK;
+    }
+    fflush(pDesc->drive);
+    while (pSize > 0) {
+        metricCount(COUNT_SYSCALLS, 1);
+        done = copy_file_range(fd, &pFrom, fd, &pTo, pSize, 0);
+        if (done <= 0)
+            break;
+        pSize -= (uint64_t) done;
+    }
+
+    //FALLBACK: LARGE ALIGNED BUFFER
+    if (pSize > 0 && posix_memalign((void**) &buf, COPY_ALIGN, COPY_CHUNK) != 0)
+        return ST_IO_ERROR;
+    while (pSize > 0) {
+        size_t size = pSize > COPY_CHUNK ? COPY_CHUNK : pSize;
+        metricCount(COUNT_SYSCALLS, 2);
+        done = pread(fd, buf, size, pFrom);
+        if (done <= 0 || pwrite(fd, buf, (size_t) done, pTo) != done) {
+            result = ST_IO_ERROR;
+            break;
+        }
+        pFrom += done;
+        pTo += done;
+        pSize -= (uint64_t) done;
+    }
+    free(buf);
+    metricTime(METRIC_COPY, start);
+    return result;
+}
+
+//Records the CRC32C of pBlock, from pData holding its bytes or else read back from the drive
+void sealBlock(FS_descriptors* pDesc, uint32_t pBlock, const uint8_t* pData) {
+    FS_allocation_unit* unit = getUnit(pDesc, pBlock);
+    uint32_t crc;
+
+    if (pData != NULL)
+        crc = crc32c(0, pData, unit->size);
+    else if (extentChecksum(pDesc, unit->offset, unit->size, &crc) != ST_OK)
+        return;
+    unit->flags = FS_UNIT_CHECKED;
+    unit->checksum = crc;
+}
+
+//CRC32C of pSize bytes of the data region from pOffset on, as they are on the drive
+int extentChecksum(FS_descriptors* pDesc, uint64_t pOffset, uint64_t pSize, uint32_t* pCrc) {
+    uint8_t* buf;
+    int result = ST_OK;
+
+    *pCrc = 0;
+    if (pDesc->map != NULL) {
+        *pCrc = crc32c(0, pDesc->map + FS_DATA_OFFSET + pOffset, pSize);
+        return ST_OK;
+    }
+    if ((buf = malloc(pSize < COPY_CHUNK ? pSize : COPY_CHUNK)) == NULL)
+        return ST_NOT_ENOUGH_SPACE;
+    while (result == ST_OK && pSize > 0) {
+        FS_allocation_unit part = {FS_OCCUPIED, FS_ENDPOINT, pOffset, pSize < COPY_CHUNK ? pSize : COPY_CHUNK};
+        result = bufferCopy(pDesc, buf, &part, DIR_TO_FILE);
+        *pCrc = crc32c(*pCrc, buf, part.size);
+        pOffset += part.size;
+        pSize -= part.size;
+    }
+    free(buf);
+    return result;
+}
+
+void damage(FS_descriptors* pDesc, const char* pFormat, ...) {
+    va_list args;
+
+    pDesc->damaged += 1;
+    if (pDesc->check_out == NULL)
+        return;
+    va_start(args, pFormat);
+    vfprintf(pDesc->check_out, pFormat, args);
+    va_end(args);
+}
+
+//FSCK: every unit must tile the data region in offset order and be held by exactly one thing, a table link, an index,
+//a shared chunk or a file, or be free
+int check(FS_descriptors* pDesc, FS_check_report* pReport) {
+    FS_info* info = pDesc->info_block;
+    uint32_t units = info->allocation_tables * FS_ALLOC_UNITS;
+    uint8_t* owned = calloc(units, 1);  //1 held, 2 first unit of a shared chunk
+    uint32_t* refs = calloc(units, sizeof(uint32_t));
+    uint64_t end = 0;
+    uint64_t unclaimed = 0;
+    uint32_t indexed = 0;
+    uint32_t records;
+    char what[FS_MAX_NAME + 16];
+
+    if (owned == NULL || refs == NULL) {
+        free(owned);
+        free(refs);
+        return ST_NOT_ENOUGH_SPACE;
+    }
+    pReport->tables += info->allocation_tables + info->directory_tables;
+
+    //UNITS
+    for (uint32_t i = 0; i < info->allocation_tables; ++i) {
+        uint32_t unused = 0;
+        for (uint32_t j = 0; j < FS_ALLOC_UNITS; ++j)
+            unused += pDesc->allocation_table[i]->units[j].type == FS_UNUSED;
+        if (unused != pDesc->allocation_table[i]->unused_units)
+            damage(pDesc, "ALLOCATION TABLE %u: %u units unused, the table says %u\n", i, unused,
+                   pDesc->allocation_table[i]->unused_units);
+    }
+    for (uint32_t block = pDesc->extents.first; block != FS_ENDPOINT; block = extentNext(&pDesc->extents, block)) {
+        FS_allocation_unit* unit = getUnit(pDesc, block);
+        if (unit->type != FS_FREE && unit->type != FS_OCCUPIED && unit->type != FS_SYSTEM)
+            damage(pDesc, "UNIT %u: unknown type 0x%02x\n", block, unit->type);
+        if (unit->offset > info->size || unit->size > info->size - unit->offset)
+            damage(pDesc, "UNIT %u: %llu bytes at %llu run past the end of the data region\n", block,
+                   (unsigned long long) unit->size, (unsigned long long) unit->offset);
+        else if (unit->offset < end)
+            damage(pDesc, "UNIT %u: overlaps the unit before it at %llu\n", block, (unsigned long long) unit->offset);
+        else if (unit->offset > end)
+            damage(pDesc, "UNIT %u: %llu bytes before it belong to no unit\n", block,
+                   (unsigned long long) (unit->offset - end));
+        if (unit->offset + unit->size > end)
+            end = unit->offset + unit->size;
+        if (unit->type == FS_FREE)
+            unclaimed += unit->size;
+        else
+            pReport->extents += 1;
+    }
+    if (end < info->size)
+        damage(pDesc, "DATA REGION: the last %llu bytes belong to no unit\n", (unsigned long long) (info->size - end));
+    if (unclaimed != info->free)
+        damage(pDesc, "INFO BLOCK: %llu bytes free, the info block says %llu\n", (unsigned long long) unclaimed,
+               (unsigned long long) info->free);
+
+    //OWNERS: system blocks, then shared chunks, then the files
+    for (uint32_t i = 1; i < info->allocation_tables; ++i)
+        claimChain(pDesc, owned, pDesc->allocation_table[i - 1]->offset_next, FS_SYSTEM, "ALLOCATION TABLES");
+    for (uint32_t i = 1; i < info->directory_tables; ++i)
+        claimChain(pDesc, owned, pDesc->directory_table[i - 1]->offset_next, FS_SYSTEM, "DIRECTORY TABLES");
+    if (pDesc->name_index != NULL)
+        claimChain(pDesc, owned, info->name_index, FS_SYSTEM, "NAME INDEX");
+    if (pDesc->dedup_index != NULL) {
+        claimChain(pDesc, owned, info->dedup_index, FS_SYSTEM, "DEDUP INDEX");
+        for (uint32_t slot = 0; slot < pDesc->dedup_index->capacity; ++slot) {
+            uint32_t block = pDesc->dedup_index->slots[slot].block;
+            if (block == FS_INDEX_EMPTY || block == FS_INDEX_DELETED)
+                continue;
+            claimChain(pDesc, owned, block, FS_OCCUPIED, "SHARED CHUNK");
+            if (block < units)
+                owned[block] |= 2;
+        }
+    }
+    records = claimTree(pDesc, owned, FS_ENDPOINT, pReport);
+    for (uint32_t table = 0; table < info->directory_tables; ++table) {
+        for (uint32_t file = 0; file < FS_DIRECTORY_FILES; ++file) {
+            FS_file_entry* entry = &pDesc->directory_table[table]->files[file];
+            uint32_t damaged = pDesc->damaged;
+            uint32_t index = table * FS_DIRECTORY_FILES + file;
+            uint64_t stored;
+            if (!((pDesc->directory_table[table]->files_flags >> file) & 1))
+                continue;
+            snprintf(what, sizeof(what), "FILE %.*s", FS_MAX_NAME, (const char*) entry->name);
+            if (pDesc->name_index != NULL && (indexFind(pDesc, entry->parent, (const char*) entry->name, &index) != ST_OK ||
+                                              index != table * FS_DIRECTORY_FILES + file))
+                damage(pDesc, "%s: the name index does not lead to it\n", what);
+            indexed += 1;
+            if (entry->parent != FS_ENDPOINT &&
+                (!liveEntry(pDesc, entry->parent) || !(getEntry(pDesc, entry->parent)->flags & FS_ENTRY_DIRECTORY)))
+                damage(pDesc, "%s: its directory is entry %u, which is no directory\n", what, entry->parent);
+            if (entry->flags & FS_ENTRY_DIRECTORY) {
+                pReport->directories += 1;
+                records += claimTree(pDesc, owned, table * FS_DIRECTORY_FILES + file, pReport);
+            } else
+                pReport->files += 1;
+            if (entry->flags & FS_ENTRY_INLINE) {
+                if (entry->block != FS_ENDPOINT || entry->size > FS_INLINE_MAX)
+                    damage(pDesc, "%s: inline, yet %llu bytes at unit %u\n", what, (unsigned long long) entry->size,
+                           entry->block);
+                continue;
+            }
+            stored = claimChain(pDesc, owned, entry->block, FS_OCCUPIED, what);
+            if (pDesc->damaged != damaged)
+                continue;
+            if (!(entry->flags & (FS_ENTRY_COMPRESSED | FS_ENTRY_DEDUP)) && stored != entry->size)
+                damage(pDesc, "%s: %llu bytes, its extents hold %llu\n", what, (unsigned long long) entry->size,
+                       (unsigned long long) stored);
+            if (entry->flags & FS_ENTRY_DEDUP) {
+                uint32_t count;
+                FS_dedup_ref* chunks = dedupRefs(pDesc, entry, &count);
+                for (uint32_t i = 0; i < count && chunks != NULL; ++i) {
+                    if (chunks[i].block < units && owned[chunks[i].block] & 2)
+                        refs[chunks[i].block] += 1;
+                    else
+                        damage(pDesc, "%s: chunk %u refers to unit %u, which is no shared chunk\n", what, i,
+                               chunks[i].block);
+                }
+                free(chunks);
+            }
+        }
+    }
+    if (pDesc->name_index != NULL && pDesc->name_index->count != indexed)
+        damage(pDesc, "NAME INDEX: %u names for %u files\n", pDesc->name_index->count, indexed);
+    if (records != indexed)
+        damage(pDesc, "DIRECTORIES: %u names for %u files and directories\n", records, indexed);
+    for (uint32_t slot = 0; pDesc->dedup_index != NULL && slot < pDesc->dedup_index->capacity; ++slot) {
+        FS_dedup_slot* entry = &pDesc->dedup_index->slots[slot];
+        if (entry->block < units && entry->refs != refs[entry->block])
+            damage(pDesc, "SHARED CHUNK %u: %u references, the dedup index says %u\n", entry->block,
+                   refs[entry->block], entry->refs);
+    }
+
+    //LEAKS
+    for (uint32_t block = pDesc->extents.first; block != FS_ENDPOINT; block = extentNext(&pDesc->extents, block)) {
+        FS_allocation_unit* unit = getUnit(pDesc, block);
+        if (unit->type != FS_FREE && !(owned[block] & 1))
+            damage(pDesc, "UNIT %u: %llu bytes at %llu held by nothing\n", block, (unsigned long long) unit->size,
+                   (unsigned long long) unit->offset);
+    }
+    free(owned);
+    free(refs);
+    return ST_OK;
+}
+
+//Marks the units of the chain from pBlock held and returns the bytes they hold; the chain stops at the first unit
+//out of range, of another type or held already
+uint64_t claimChain(FS_descriptors* pDesc, uint8_t* pOwned, uint32_t pBlock, uint8_t pType, const char* pWhat) {
+    uint32_t units = pDesc->info_block->allocation_tables * FS_ALLOC_UNITS;
+    uint64_t size = 0;
+
+    for (uint32_t block = pBlock; block != FS_ENDPOINT; block = getUnit(pDesc, block)->next_block) {
+        if (block >= units) {
+            damage(pDesc, "%s: the chain leads to unit %u, past the last table\n", pWhat, block);
+            break;
+        }
+        if (getUnit(pDesc, block)->type != pType) {
+            damage(pDesc, "%s: the chain leads to unit %u, of type 0x%02x\n", pWhat, block, getUnit(pDesc, block)->type);
+            break;
+        }
+        if (pOwned[block] & 1) {
+            damage(pDesc, "%s: the chain leads to unit %u, held already\n", pWhat, block);
+            break;
+        }
+        pOwned[block] |= 1;
+        size += getUnit(pDesc, block)->size;
+    }
+    return size;
+}
+
+//Claims the nodes of pDirectory's B+tree and returns the names in it. Each must lead to an entry of that directory
+//by the same name, in order, and every leaf to the one after it.
+uint32_t claimTree(FS_descriptors* pDesc, uint8_t* pOwned, uint32_t pDirectory, FS_check_report* pReport) {
+    FS_tree_check walk;
+    uint32_t root = treeRoot(pDesc, pDirectory);
+
+    memset(&walk, 0, sizeof(walk));
+    walk.directory = pDirectory;
+    walk.leaf = FS_ENDPOINT;
+    if (pDirectory == FS_ENDPOINT)
+        snprintf(walk.what, sizeof(walk.what), "TOP DIRECTORY");
+    else
+        snprintf(walk.what, sizeof(walk.what), "DIRECTORY %.*s", FS_MAX_NAME, (const char*) getEntry(pDesc, pDirectory)->name);
+    if (root == FS_ENDPOINT)
+        return 0;
+    claimNode(pDesc, pOwned, root, 0, NULL, NULL, &walk);
+    if (walk.leaf != FS_ENDPOINT && pDesc->nodes[walk.leaf]->next != FS_ENDPOINT)
+        damage(pDesc, "%s: the last leaf leads on to unit %u\n", walk.what, pDesc->nodes[walk.leaf]->next);
+    pReport->tables += walk.nodes;
+    return walk.records;
+}
+
+//Names under pBlock must be from pLow on and before pHigh, NULL for no bound
+void claimNode(FS_descriptors* pDesc, uint8_t* pOwned, uint32_t pBlock, uint32_t pDepth, const uint8_t* pLow,
+               const uint8_t* pHigh, FS_tree_check* pWalk) {
+    uint32_t damaged = pDesc->damaged;
+    FS_tree_node* node;
+
+    if (pDepth == FS_TREE_DEPTH) {
+        damage(pDesc, "%s: the B+tree is more than %u levels deep\n", pWalk->what, FS_TREE_DEPTH);
+        return;
+    }
+    claimChain(pDesc, pOwned, pBlock, FS_SYSTEM, pWalk->what);
+    if (pDesc->damaged != damaged)
+        return;
+    if ((node = treeNode(pDesc, pBlock)) == NULL) {
+        damage(pDesc, "%s: unit %u holds no B+tree node\n", pWalk->what, pBlock);
+        return;
+    }
+    pWalk->nodes += 1;
+    if (!node->leaf) {
+        for (uint32_t i = 0; i < node->count; ++i)
+            claimNode(pDesc, pOwned, node->records[i].target, pDepth + 1, i > 0 ? node->records[i].name : pLow,
+                      i + 1 < node->count ? node->records[i + 1].name : pHigh, pWalk);
+        return;
+    }
+
+    if (pWalk->leaf != FS_ENDPOINT && pDesc->nodes[pWalk->leaf]->next != pBlock)
+        damage(pDesc, "%s: leaf %u leads to unit %u, not to the next leaf %u\n", pWalk->what, pWalk->leaf,
+               pDesc->nodes[pWalk->leaf]->next, pBlock);
+    pWalk->leaf = pBlock;
+    for (uint32_t i = 0; i < node->count; ++i) {
+        FS_tree_record* record = &node->records[i];
+        const char* name = (const char*) record->name;
+        if ((pWalk->records > 0 && compareName(pWalk->last, name) >= 0) || (pLow != NULL && compareName(pLow, name) > 0) ||
+            (pHigh != NULL && compareName(pHigh, name) <= 0))
+            damage(pDesc, "%s: %.*s is out of order\n", pWalk->what, FS_MAX_NAME, name);
+        if (!liveEntry(pDesc, record->target) || getEntry(pDesc, record->target)->parent != pWalk->directory ||
+            !sameName(getEntry(pDesc, record->target)->name, name))
+            damage(pDesc, "%s: %.*s leads to entry %u, which is not it\n", pWalk->what, FS_MAX_NAME, name,
+                   record->target);
+        memcpy(pWalk->last, record->name, FS_MAX_NAME);
+        pWalk->records += 1;
+    }
+}
+
+//SCRUB: the checked extents in offset order, cut into pieces. The caller reads windows of adjacent pieces front to
+//back into a ring of slots while the workers compute the CRC of each piece; those of one extent are combined after.
+int scrubDrive(FS_descriptors* pDesc, FILE* pOut, FS_scrub_report* pReport) {
+    FS_scrub_job job;
+    pthread_t threads[FS_SCRUB_THREADS];
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t pieces = 0;
+    uint32_t windows = 0;
+    int fd = fileno(pDesc->drive);
+    int result = ST_OK;
+
+    memset(pReport, 0, sizeof(FS_scrub_report));
+    memset(&job, 0, sizeof(job));
+    for (uint32_t block = pDesc->extents.first; block != FS_ENDPOINT; block = extentNext(&pDesc->extents, block)) {
+        FS_allocation_unit* unit = getUnit(pDesc, block);
+        if (unit->type != FS_OCCUPIED)
+            continue;
+        if (!(unit->flags & FS_UNIT_CHECKED)) {
+            pReport->unchecked += 1;
+            continue;
+        }
+        pReport->extents += 1;
+        pReport->bytes += unit->size;
+        pieces += unit->size == 0 ? 1 : (uint32_t) ((unit->size + FS_SCRUB_PIECE - 1) / FS_SCRUB_PIECE);
+    }
+    if (pieces == 0)
+        return ST_OK;
+
+    job.pieces = malloc(pieces * sizeof(FS_scrub_piece));
+    job.windows = malloc((pieces + 1) * sizeof(uint32_t));
+    if (job.pieces == NULL || job.windows == NULL) {
+        free(job.pieces);
+        free(job.windows);
+        return ST_NOT_ENOUGH_SPACE;
+    }
+    pieces = 0;
+    for (uint32_t block = pDesc->extents.first; block != FS_ENDPOINT; block = extentNext(&pDesc->extents, block)) {
+        FS_allocation_unit* unit = getUnit(pDesc, block);
+        uint64_t done = 0;
+        if (unit->type != FS_OCCUPIED || !(unit->flags & FS_UNIT_CHECKED))
+            continue;
+        do {
+            FS_scrub_piece* piece = &job.pieces[pieces];
+            piece->offset = unit->offset + done;
+            piece->block = block;
+            piece->size = unit->size - done > FS_SCRUB_PIECE ? FS_SCRUB_PIECE : (uint32_t) (unit->size - done);
+            piece->crc = 0;
+            piece->failed = 0;
+            //a window ends where the next piece is not adjacent or would not fit
+            if (pieces == 0 || piece->offset != piece[-1].offset + piece[-1].size ||
+                piece->offset + piece->size - job.pieces[job.windows[windows - 1]].offset > FS_SCRUB_WINDOW)
+                job.windows[windows++] = pieces;
+            pieces += 1;
+            done += piece->size;
+        } while (done < unit->size);
+    }
+    job.windows[windows] = pieces;
+    job.count = windows;
+
+    pReport->threads = cores < 1 ? 1 : cores > FS_SCRUB_THREADS ? FS_SCRUB_THREADS : (uint32_t) cores;
+    job.slots = pReport->threads + 2;
+    job.map = pDesc->map;
+    job.read = job.map != NULL ? job.count : 0;
+    job.held = calloc(job.slots, 1);
+    job.buffers = calloc(job.slots, sizeof(uint8_t*));
+    for (uint32_t slot = 0; job.map == NULL && job.buffers != NULL && slot < job.slots; ++slot)
+        if ((job.buffers[slot] = malloc(FS_SCRUB_WINDOW)) == NULL)
+            result = ST_NOT_ENOUGH_SPACE;
+    if (job.held == NULL || job.buffers == NULL)
+        result = ST_NOT_ENOUGH_SPACE;
+    if (result == ST_OK && (pthread_mutex_init(&job.lock, NULL) != 0 || pthread_cond_init(&job.ready, NULL) != 0 ||
+                            pthread_cond_init(&job.freed, NULL) != 0))
+        result = ST_NOT_ENOUGH_SPACE;
+
+    if (result == ST_OK) {
+        uint32_t started = 0;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        while (started < pReport->threads && pthread_create(&threads[started], NULL, scrubWorker, &job) == 0)
+            started += 1;
+        pReport->threads = started;
+        //READER: one window at a time, in the order they lie on the drive
+        for (uint32_t window = job.read; window < job.count; ++window) {
+            uint32_t slot = window % job.slots;
+            FS_scrub_piece* first = &job.pieces[job.windows[window]];
+            FS_scrub_piece* last = &job.pieces[job.windows[window + 1] - 1];
+            FS_allocation_unit part = {FS_OCCUPIED, FS_ENDPOINT, first->offset,
+                                       last->offset + last->size - first->offset};
+            pthread_mutex_lock(&job.lock);
+            while (job.held[slot])
+                pthread_cond_wait(&job.freed, &job.lock);
+            pthread_mutex_unlock(&job.lock);
+            if (bufferCopy(pDesc, job.buffers[slot], &part, DIR_TO_FILE) != ST_OK)
+                for (FS_scrub_piece* piece = first; piece <= last; ++piece)
+                    piece->failed = 1;
+            pthread_mutex_lock(&job.lock);
+            job.held[slot] = 1;
+            job.read += 1;
+            pthread_cond_broadcast(&job.ready);
+            pthread_mutex_unlock(&job.lock);
+            //no worker started: each window is verified before the next one takes a slot
+            if (started == 0)
+                scrubWindow(&job, job.taken++);
+        }
+        for (uint32_t i = 0; i < started; ++i)
+            pthread_join(threads[i], NULL);
+        if (started == 0)
+            scrubWorker(&job);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_NORMAL);
+        pthread_mutex_destroy(&job.lock);
+        pthread_cond_destroy(&job.ready);
+        pthread_cond_destroy(&job.freed);
+
+        //VERDICT: the pieces of one extent are next to each other
+        for (uint32_t i = 0; i < pieces;) {
+            FS_allocation_unit* unit = getUnit(pDesc, job.pieces[i].block);
+            uint32_t crc = job.pieces[i].crc;
+            uint8_t failed = job.pieces[i].failed;
+            uint32_t block = job.pieces[i].block;
+            for (++i; i < pieces && job.pieces[i].block == block; ++i) {
+                crc = crc32cCombine(crc, job.pieces[i].crc, job.pieces[i].size);
+                failed |= job.pieces[i].failed;
+            }
+            if (!failed && crc == unit->checksum)
+                continue;
+            pReport->bad += 1;
+            if (pOut != NULL)
+                fprintf(pOut, "%.*s: extent %u, %llu bytes at %llu, %s\n", FS_MAX_NAME, extentOwner(pDesc, block),
+                        block, (unsigned long long) unit->size, (unsigned long long) unit->offset,
+                        failed ? "can not be read" : "checksum mismatch");
+        }
+    }
+
+    for (uint32_t slot = 0; job.buffers != NULL && slot < job.slots; ++slot)
+        free(job.buffers[slot]);
+    free(job.buffers);
+    free(job.held);
+    free(job.pieces);
+    free(job.windows);
+    if (result == ST_OK && pReport->bad > 0)
+        result = ST_CORRUPT;
+    return result;
+}
+
+//Takes the windows in order as the reader fills them and verifies each
+void* scrubWorker(void* pJob) {
+    FS_scrub_job* job = pJob;
+
+    for (;;) {
+        uint32_t window;
+        pthread_mutex_lock(&job->lock);
+        while (job->taken < job->count && job->taken >= job->read)
+            pthread_cond_wait(&job->ready, &job->lock);
+        if (job->taken == job->count) {
+            pthread_mutex_unlock(&job->lock);
+            return NULL;
+        }
+        window = job->taken++;
+        pthread_mutex_unlock(&job->lock);
+        scrubWindow(job, window);
+    }
+}
+
+//Computes the CRC of each piece of pWindow, then gives its slot back to the reader
+void scrubWindow(FS_scrub_job* pJob, uint32_t pWindow) {
+    uint32_t slot = pWindow % pJob->slots;
+    const uint8_t* data = pJob->map != NULL ? pJob->map + FS_DATA_OFFSET + pJob->pieces[pJob->windows[pWindow]].offset
+                                            : pJob->buffers[slot];
+
+    for (uint32_t i = pJob->windows[pWindow]; i < pJob->windows[pWindow + 1]; ++i) {
+        FS_scrub_piece* piece = &pJob->pieces[i];
+        if (!piece->failed)
+            piece->crc = crc32c(0, data + (piece->offset - pJob->pieces[pJob->windows[pWindow]].offset), piece->size);
+    }
+    if (pJob->map == NULL) {
+        pthread_mutex_lock(&pJob->lock);
+        pJob->held[slot] = 0;
+        pthread_cond_broadcast(&pJob->freed);
+        pthread_mutex_unlock(&pJob->lock);
+    }
+}
+
+//Name of the file whose chain holds pBlock, or what else holds it
+const char* extentOwner(FS_descriptors* pDesc, uint32_t pBlock) {
+    for (uint32_t table = 0; table < pDesc->info_block->directory_tables; ++table) {
+        for (uint32_t file = 0; file < FS_DIRECTORY_FILES; ++file) {
+            FS_file_entry* entry = &pDesc->directory_table[table]->files[file];
+            if (!((pDesc->directory_table[table]->files_flags >> file) & 1) || entry->flags & FS_ENTRY_INLINE)
+                continue;
+            for (uint32_t block = entry->block; block != FS_ENDPOINT; block = getUnit(pDesc, block)->next_block)
+                if (block == pBlock)
+                    return (const char*) entry->name;
+        }
+    }
+    return "shared chunk";
+}
+
+//COMPRESSION: chunks of FS_CHUNK_SIZE plain bytes, each behind an FS_chunk_header, so a reader can skip to any chunk
+//NULL when compressing pData saves less than an eighth, or without zlib
+uint8_t* packChunks(const uint8_t* pData, uint64_t pSize, uint64_t* pStored) {
+#ifdef GFS_COMPRESSION
+    uint64_t chunks = (pSize + FS_CHUNK_SIZE - 1) / FS_CHUNK_SIZE;
+    size_t limit = pSize - pSize / 8;
+    uint8_t* packed = malloc(limit + compressBound(FS_CHUNK_SIZE) + sizeof(FS_chunk_header));
+    size_t used = 0;
+
+    if (packed == NULL)
+        return NULL;
+    for (uint64_t chunk = 0; chunk < chunks && used < limit; ++chunk) {
+        FS_chunk_header header;
+        uLongf size = compressBound(FS_CHUNK_SIZE);
+        const uint8_t* plain = pData + (size_t) chunk * FS_CHUNK_SIZE;
+
+        header.size = pSize - chunk * FS_CHUNK_SIZE > FS_CHUNK_SIZE ? FS_CHUNK_SIZE : (uint32_t) (pSize - chunk * FS_CHUNK_SIZE);
+        if (compress2(packed + used + sizeof(header), &size, plain, header.size, Z_BEST_SPEED) != Z_OK ||
+            size >= header.size) {
+            size = header.size;
+            memcpy(packed + used + sizeof(header), plain, header.size);
+        }
+        header.stored = (uint32_t) size;
+        memcpy(packed + used, &header, sizeof(header));
+        used += sizeof(header) + header.stored;
+    }
+    if (used < limit) {
+        *pStored = used;
+        return packed;
+    }
+    free(packed);
+#endif
+    return NULL;
+}
+
+//Writes pSize plain bytes of compressed pFile from pOffset on at pDest's file position, or into pBuffer when pDest
+//is NULL. Chunks before the range are skipped by their headers, only those it covers are inflated.
+int unpackRange(FS_descriptors* pDesc, FS_file_entry* pFile, uint64_t pOffset, uint64_t pSize, FILE* pDest,
+                uint8_t* pBuffer) {
+#ifdef GFS_COMPRESSION
+    FS_extent_cursor cursor = {pFile->block, 0};
+    uint8_t* stored = malloc(FS_CHUNK_SIZE);
+    uint8_t* plain = malloc(FS_CHUNK_SIZE);
+    uint64_t at = 0;    //plain offset of the chunk
+    int result = ST_OK;
+
+    if (stored == NULL || plain == NULL)
+        result = ST_IO_ERROR;
+    while (result == ST_OK && pSize > 0) {
+        FS_chunk_header header;
+        uint64_t from;
+        uint64_t size;
+        uint8_t* out;
+        uLongf done;
+
+        if (cursorCopy(pDesc, &cursor, sizeof(header), NULL, (uint8_t*) &header) != ST_OK ||
+            header.size == 0 || header.size > pFile->size - at || header.size > FS_CHUNK_SIZE ||
+            header.stored > header.size) {
+            result = ST_IO_ERROR;
+            break;
+        }
+        if (at + header.size <= pOffset) {
+            result = cursorCopy(pDesc, &cursor, header.stored, NULL, NULL);
+            at += header.size;
+            continue;
+        }
+
+        //a chunk wanted whole goes straight into the caller's buffer
+        from = pOffset > at ? pOffset - at : 0;
+        size = header.size - from < pSize ? header.size - from : pSize;
+        out = pDest == NULL && from == 0 && size == header.size ? pBuffer : plain;
+        done = header.size;
+        if (header.stored == header.size)
+            result = cursorCopy(pDesc, &cursor, header.size, NULL, out);
+        else if (cursorCopy(pDesc, &cursor, header.stored, NULL, stored) != ST_OK ||
+                 uncompress(out, &done, stored, header.stored) != Z_OK || done != header.size)
+            result = ST_IO_ERROR;
+        if (result == ST_OK && pDest != NULL)
+            result = streamCopy(pDest, out + from, size, DIR_TO_FILE);
+        else if (result == ST_OK && out != pBuffer)
+            memcpy(pBuffer, out + from, size);
+        if (pBuffer != NULL)
+            pBuffer += size;
+        pSize -= size;
+        at += header.size;
+    }
+    free(stored);
+    free(plain);
+    return result;
+#else
+    return ST_NOT_VALID_FILE;
+#endif
+}
+
+//Copies the next pSize stored bytes of a file, across as many extents as they span, to pDest's file position or
+//into pBuffer when pDest is NULL; with neither it only moves past them
+int cursorCopy(FS_descriptors* pDesc, FS_extent_cursor* pCursor, uint64_t pSize, FILE* pDest, uint8_t* pBuffer) {
+    FS_io_request requests[FS_IO_DEPTH];
+    uint32_t queued = 0;
+
+    while (pSize > 0) {
+        FS_allocation_unit* unit;
+        FS_allocation_unit part;
+
+        if (pCursor->block == FS_ENDPOINT)
+            return ST_IO_ERROR;
+        unit = getUnit(pDesc, pCursor->block);
+        part.offset = unit->offset + pCursor->offset;
+        part.size = unit->size - pCursor->offset < pSize ? unit->size - pCursor->offset : pSize;
+        if (pDest != NULL && blockCopy(pDesc, pDest, &part, part.size, DIR_TO_FILE) != ST_OK)
+            return ST_IO_ERROR;
+        if (pDest == NULL && pBuffer != NULL) {
+            if (queueCopy(pDesc, requests, &queued, pBuffer, &part, DIR_TO_FILE) != ST_OK)
+                return ST_IO_ERROR;
+            pBuffer += part.size;
+        }
+        pSize -= part.size;
+        pCursor->offset += part.size;
+        if (pCursor->offset == unit->size) {
+            pCursor->block = unit->next_block;
+            pCursor->offset = 0;
+        }
+    }
+    return flushCopies(pDesc, requests, &queued);
+}
+
+//Points pCursor at stored byte pOffset of the chain from pBlock. The first FS_CHAIN_WALK extents are walked,
+//past them the chain's offset map is searched instead.
+int chainSeek(FS_descriptors* pDesc, uint32_t pBlock, uint64_t pOffset, FS_extent_cursor* pCursor) {
+    FS_chain_map* map;
+
+    pCursor->block = pBlock;
+    pCursor->offset = pOffset;
+    for (uint32_t walked = 0; pCursor->block != FS_ENDPOINT; ++walked) {
+        FS_allocation_unit* unit = getUnit(pDesc, pCursor->block);
+        if (pCursor->offset < unit->size)
+            return ST_OK;
+        if (walked == FS_CHAIN_WALK)
+            break;
+        pCursor->offset -= unit->size;
+        pCursor->block = unit->next_block;
+    }
+    if (pCursor->block == FS_ENDPOINT)
+        return pCursor->offset == 0 ? ST_OK : ST_IO_ERROR;
+
+    //LONG CHAIN: the last extent starting at or before pOffset, found by halves
+    pthread_mutex_lock(&pDesc->chains_lock);
+    if ((map = chainMap(pDesc, pBlock)) != NULL) {
+        uint32_t low = 0;
+        uint32_t high = map->count;
+        while (high - low > 1) {
+            uint32_t middle = low + (high - low) / 2;
+            if (map->marks[middle].start <= pOffset)
+                low = middle;
+            else
+                high = middle;
+        }
+        pCursor->block = map->marks[low].block;
+        pCursor->offset = pOffset - map->marks[low].start;
+    }
+    pthread_mutex_unlock(&pDesc->chains_lock);
+
+    //without memory for the map, on along the chain
+    while (pCursor->block != FS_ENDPOINT && pCursor->offset >= getUnit(pDesc, pCursor->block)->size) {
+        pCursor->offset -= getUnit(pDesc, pCursor->block)->size;
+        pCursor->block = getUnit(pDesc, pCursor->block)->next_block;
+    }
+    return pCursor->block != FS_ENDPOINT || pCursor->offset == 0 ? ST_OK : ST_IO_ERROR;
+}
+
+//The offset map of the chain from pBlock, built again once the allocation tables changed; the caller holds
+//chains_lock. NULL without memory for it.
+FS_chain_map* chainMap(FS_descriptors* pDesc, uint32_t pBlock) {
+    FS_chain_map** slot = &pDesc->chains[pBlock % FS_CHAIN_SLOTS];
+    FS_chain_map* map = *slot;
+    uint32_t count = 0;
+    uint64_t start = 0;
+
+    if (map != NULL && map->block == pBlock && map->generation == pDesc->generation)
+        return map;
+    for (uint32_t block = pBlock; block != FS_ENDPOINT; block = getUnit(pDesc, block)->next_block)
+        count += 1;
+    free(map);
+    *slot = map = malloc(sizeof(FS_chain_map) + count * sizeof(FS_chain_mark));
+    if (map == NULL)
+        return NULL;
+    map->block = pBlock;
+    map->count = 0;
+    map->generation = pDesc->generation;
+    for (uint32_t block = pBlock; block != FS_ENDPOINT; block = getUnit(pDesc, block)->next_block) {
+        map->marks[map->count++] = (FS_chain_mark) {start, block};
+        start += getUnit(pDesc, block)->size;
+    }
+    return map;
+}
+
+//Bytes the file takes in its extents
+uint64_t storedSize(FS_descriptors* pDesc, FS_file_entry* pFile) {
+    uint64_t size = 0;
+
+    if (!(pFile->flags & (FS_ENTRY_COMPRESSED | FS_ENTRY_DEDUP)))
+        return pFile->flags & FS_ENTRY_INLINE ? 0 : pFile->size;
+    for (uint32_t block = pFile->block; block != FS_ENDPOINT; block = getUnit(pDesc, block)->next_block)
+        size += getUnit(pDesc, block)->size;
+    return size;
+}
+
+//DEDUP: content-defined chunks kept once, a file's extents hold one FS_dedup_ref per chunk in order
+int dedupStore(FS_descriptors* pDesc, FS_file_entry* pFile, const uint8_t* pData, uint64_t pSize) {
+    FS_dedup_ref* refs = malloc((pSize / FS_DEDUP_MIN + 1) * sizeof(FS_dedup_ref));
+    uint32_t count = 0;
+    int result = ST_OK;
+
+    if (refs == NULL)
+        return ST_NOT_ENOUGH_SPACE;
+    for (uint64_t done = 0; done < pSize; done += refs[count++].size) {
+        refs[count].size = dedupCut(pData + done, pSize - done);
+        refs[count].hash = dedupHash(pData + done, refs[count].size);
+        if ((result = dedupTake(pDesc, pData + done, &refs[count])) != ST_OK)
+            break;
+    }
+    if (result == ST_OK)
+        result = writeChain(pDesc, NULL, (const uint8_t*) refs, count * sizeof(FS_dedup_ref), &pFile->block);
+
+    if (result != ST_OK) {
+        for (uint32_t i = 0; i < count; ++i)
+            dedupRelease(pDesc, &refs[i]);
+    }
+    free(refs);
+    return result;
+}
+
+//Writes pSize plain bytes of pFile from pOffset on at pDest's file position, or into pBuffer when pDest is NULL
+int dedupRange(FS_descriptors* pDesc, FS_file_entry* pFile, uint64_t pOffset, uint64_t pSize, FILE* pDest,
+               uint8_t* pBuffer) {
+    uint32_t count;
+    uint64_t at = 0;    //plain offset of the chunk
+    FS_dedup_ref* refs = dedupRefs(pDesc, pFile, &count);
+    int result = ST_OK;
+
+    if (refs == NULL)
+        return pSize == 0 ? ST_OK : ST_IO_ERROR;
+    for (uint32_t i = 0; i < count && result == ST_OK && pSize > 0; ++i) {
+        if (refs[i].size > pFile->size - at) {
+            result = ST_IO_ERROR;
+            break;
+        }
+        if (at + refs[i].size > pOffset) {
+            FS_extent_cursor cursor = {refs[i].block, 0};
+            uint64_t from = pOffset > at ? pOffset - at : 0;
+            uint64_t size = refs[i].size - from < pSize ? refs[i].size - from : pSize;
+            result = cursorCopy(pDesc, &cursor, from, NULL, NULL);
+            if (result == ST_OK)
+                result = cursorCopy(pDesc, &cursor, size, pDest, pBuffer);
+            if (pBuffer != NULL)
+                pBuffer += size;
+            pSize -= size;
+        }
+        at += refs[i].size;
+    }
+    free(refs);
+    return result == ST_OK && pSize != 0 ? ST_IO_ERROR : result;
+}
+
+//Lets go of every chunk of pFile, those no other file holds are freed
+void dedupDrop(FS_descriptors* pDesc, FS_file_entry* pFile) {
+    uint32_t count;
+    FS_dedup_ref* refs = dedupRefs(pDesc, pFile, &count);
+
+    //without memory for the list the chunks stay, held by nothing
+    if (refs == NULL)
+        return;
+    for (uint32_t i = 0; i < count; ++i)
+        dedupRelease(pDesc, &refs[i]);
+    free(refs);
+}
+
+FS_dedup_ref* dedupRefs(FS_descriptors* pDesc, FS_file_entry* pFile, uint32_t* pCount) {
+    uint64_t size = storedSize(pDesc, pFile);
+    FS_dedup_ref* refs;
+
+    *pCount = (uint32_t) (size / sizeof(FS_dedup_ref));
+    if (*pCount == 0 || (refs = malloc(size)) == NULL)
+        return NULL;
+    if (copyChain(pDesc, pFile->block, NULL, (uint8_t*) refs) != ST_OK) {
+        free(refs);
+        return NULL;
+    }
+    return refs;
+}
+
+//Length of the chunk at pData: a gear hash over the last 64 bytes picks the cut, between FS_DEDUP_MIN and FS_DEDUP_MAX
+uint32_t dedupCut(const uint8_t* pData, uint64_t pSize) {
+    uint32_t limit = pSize < FS_DEDUP_MAX ? (uint32_t) pSize : FS_DEDUP_MAX;
+    uint64_t hash = 0;
+
+    if (pSize <= FS_DEDUP_MIN)
+        return (uint32_t) pSize;
+    pthread_once(&gearsOnce, dedupGears);
+    for (uint32_t i = FS_DEDUP_MIN - 64; i < limit; ++i) {
+        hash = (hash << 1) + gears[pData[i]];
+        if (i >= FS_DEDUP_MIN && !(hash & FS_DEDUP_MASK))
+            return i + 1;
+    }
+    return limit;
+}
+
+//Fixed random values per byte, the same in every process so equal bytes cut the same everywhere
+void dedupGears(void) {
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint64_t value = i + 0x9E3779B97F4A7C15ull;
+        value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+        value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+        gears[i] = value ^ (value >> 31);
+    }
+}
+
+uint64_t dedupHash(const uint8_t* pData, uint32_t pSize) {
+    uint64_t hash = 14695981039346656037ull;
+    for (uint32_t i = 0; i < pSize; ++i) {
+        hash ^= pData[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+//Points pRef at a stored chunk equal to pData, storing it first when there is none
+int dedupTake(FS_descriptors* pDesc, const uint8_t* pData, FS_dedup_ref* pRef) {
+    FS_dedup_index* index;
+    uint32_t mask;
+    uint32_t pos;
+    int result;
+
+    if (dedupReserve(pDesc) != ST_OK)
+        return ST_NOT_ENOUGH_SPACE;
+    index = pDesc->dedup_index;
+    mask = index->capacity - 1;
+    pos = (uint32_t) pRef->hash & mask;
+    for (uint32_t probe = 0; probe < index->capacity; ++probe, pos = (pos + 1) & mask) {
+        FS_dedup_slot* slot = &index->slots[pos];
+        if (slot->block == FS_INDEX_EMPTY)
+            break;
+        //a hash match is only a candidate, the bytes decide
+        if (slot->block != FS_INDEX_DELETED && slot->hash == pRef->hash && slot->refs < UINT32_MAX &&
+            sameChunk(pDesc, slot->block, pData, pRef->size)) {
+            slot->refs += 1;
+            pRef->block = slot->block;
+            touchDedup(pDesc, pos);
+            return ST_OK;
+        }
+    }
+
+    result = writeChain(pDesc, NULL, pData, pRef->size, &pRef->block);
+    if (result != ST_OK)
+        return result;
+    pos = dedupPlace(pDesc->dedup_index, pRef->hash, pRef->block, 1);
+    pDesc->dedup_index->count += 1;
+    touchDedup(pDesc, pos);
+    return ST_OK;
+}
+
+void dedupRelease(FS_descriptors* pDesc, FS_dedup_ref* pRef) {
+    FS_dedup_index* index = pDesc->dedup_index;
+    uint32_t mask;
+    uint32_t pos;
+
+    if (index != NULL) {
+        mask = index->capacity - 1;
+        pos = (uint32_t) pRef->hash & mask;
+        for (uint32_t probe = 0; probe < index->capacity; ++probe, pos = (pos + 1) & mask) {
+            FS_dedup_slot* slot = &index->slots[pos];
+            if (slot->block == FS_INDEX_EMPTY)
+                break;
+            if (slot->block != pRef->block)
+                continue;
+            touchDedup(pDesc, pos);
+            if (--slot->refs > 0)
+                return;
+            slot->block = FS_INDEX_DELETED;
+            index->count -= 1;
+            index->deleted += 1;
+            break;
+        }
+    }
+    releaseChain(pDesc, pRef->block);
+}
+
+int sameChunk(FS_descriptors* pDesc, uint32_t pBlock, const uint8_t* pData, uint64_t pSize) {
+    uint8_t* stored = malloc(pSize);
+    uint64_t size = 0;
+    int same;
+
+    for (uint32_t block = pBlock; block != FS_ENDPOINT; block = getUnit(pDesc, block)->next_block)
+        size += getUnit(pDesc, block)->size;
+    same = stored != NULL && size == pSize && copyChain(pDesc, pBlock, NULL, stored) == ST_OK &&
+           memcmp(stored, pData, pSize) == 0;
+    free(stored);
+    return same;
+}
+
+size_t dedupSize(uint32_t pCapacity) {
+    return sizeof(FS_dedup_index) + pCapacity * sizeof(FS_dedup_slot);
+}
+
+//Makes room for one more chunk, growing the index (or creating it) at 3/4 load
+int dedupReserve(FS_descriptors* pDesc) {
+    FS_dedup_index* index = pDesc->dedup_index;
+    uint32_t capacity = FS_INDEX_INITIAL;
+
+    if (index != NULL) {
+        if ((index->count + index->deleted + 1) * 4 <= index->capacity * 3)
+            return ST_OK;
+        capacity = index->capacity;
+        while ((index->count + 1) * 2 > capacity)
+            capacity *= 2;
+    }
+    if (dedupRebuild(pDesc, capacity) == ST_OK)
+        return ST_OK;
+    if (index != NULL && index->count + index->deleted + 1 < index->capacity)
+        return ST_OK;
+    return ST_NOT_ENOUGH_SPACE;
+}
+
+int dedupRebuild(FS_descriptors* pDesc, uint32_t pCapacity) {
+    size_t size = dedupSize(pCapacity);
+    uint32_t block = allocateSystemBlock(pDesc, (uint32_t) size);
+    FS_dedup_index* index;
+
+    if (block == FS_ENDPOINT)
+        return ST_NOT_ENOUGH_SPACE;
+    index = newTable(pDesc, FS_DATA_OFFSET + getUnit(pDesc, block)->offset, size);
+    if (index == NULL || dedupTrack(pDesc, pCapacity) != ST_OK) {
+        if (index != NULL && !isMapped(pDesc, index))
+            free(index);
+        releaseBlock(pDesc, block);
+        return ST_NOT_ENOUGH_SPACE;
+    }
+    index->capacity = pCapacity;
+    index->count = 0;
+    index->deleted = 0;
+    for (uint32_t i = 0; i < pCapacity; ++i)
+        index->slots[i].block = FS_INDEX_EMPTY;
+
+    if (pDesc->dedup_index != NULL) {
+        FS_dedup_index* old = pDesc->dedup_index;
+        for (uint32_t i = 0; i < old->capacity; ++i) {
+            if (old->slots[i].block == FS_INDEX_EMPTY || old->slots[i].block == FS_INDEX_DELETED)
+                continue;
+            dedupPlace(index, old->slots[i].hash, old->slots[i].block, old->slots[i].refs);
+            index->count += 1;
+        }
+        if (!isMapped(pDesc, old))
+            free(old);
+        releaseBlock(pDesc, pDesc->info_block->dedup_index);
+    }
+    pDesc->dedup_index = index;
+    pDesc->info_block->dedup_index = block;
+    pDesc->dedup_fresh = 1;
+    pDesc->dirty_bytes += size;
+    return ST_OK;
+}
+
+//Every slot must hold an occupied unit that something refers to, with the counts adding up like the name index's
+void dedupCheck(FS_descriptors* pDesc) {
+    FS_dedup_index* index = pDesc->dedup_index;
+    uint32_t units = pDesc->info_block->allocation_tables * FS_ALLOC_UNITS;
+    uint32_t count = 0;
+    uint32_t deleted = 0;
+
+    for (uint32_t i = 0; i < index->capacity; ++i) {
+        FS_dedup_slot* slot = &index->slots[i];
+        if (slot->block == FS_INDEX_EMPTY)
+            continue;
+        if (slot->block == FS_INDEX_DELETED)
+            deleted += 1;
+        else if (slot->block < units && getUnit(pDesc, slot->block)->type == FS_OCCUPIED && slot->refs > 0)
+            count += 1;
+        else
+            damage(pDesc, "DEDUP INDEX: slot %u leads to unit %u, which holds no chunk\n", i, slot->block);
+    }
+    if (count != index->count || deleted != index->deleted || count + deleted >= index->capacity)
+        damage(pDesc, "DEDUP INDEX: %u chunks and %u deleted in %u slots, the index says %u and %u\n", count, deleted,
+               index->capacity, index->count, index->deleted);
+}
+
+uint32_t dedupPlace(FS_dedup_index* pIndex, uint64_t pHash, uint32_t pBlock, uint32_t pRefs) {
+    uint32_t mask = pIndex->capacity - 1;
+    uint32_t pos = (uint32_t) pHash & mask;
+
+    while (pIndex->slots[pos].block != FS_INDEX_EMPTY && pIndex->slots[pos].block != FS_INDEX_DELETED)
+        pos = (pos + 1) & mask;
+    if (pIndex->slots[pos].block == FS_INDEX_DELETED)
+        pIndex->deleted -= 1;
+    pIndex->slots[pos].hash = pHash;
+    pIndex->slots[pos].block = pBlock;
+    pIndex->slots[pos].refs = pRefs;
+    return pos;
+}
+
+void touchDedup(FS_descriptors* pDesc, uint32_t pSlot) {
+    if (!pDesc->dedup_dirty[pSlot / FS_INDEX_CHUNK])
+        pDesc->dirty_bytes += FS_INDEX_CHUNK * sizeof(FS_dedup_slot);
+    pDesc->dedup_dirty[pSlot / FS_INDEX_CHUNK] = 1;
+}
+
+//Sizes the dirty marks for a dedup index of pCapacity slots, all clean
+int dedupTrack(FS_descriptors* pDesc, uint32_t pCapacity) {
+    uint32_t chunks = (pCapacity + FS_INDEX_CHUNK - 1) / FS_INDEX_CHUNK;
+    void* dirty = realloc(pDesc->dedup_dirty, chunks);
+    void* sums;
+
+    if (dirty == NULL)
+        return ST_NOT_ENOUGH_SPACE;
+    pDesc->dedup_dirty = dirty;
+    if ((sums = realloc(pDesc->dedup_sums, chunks * sizeof(uint32_t))) == NULL)
+        return ST_NOT_ENOUGH_SPACE;
+    pDesc->dedup_sums = sums;
+    pDesc->dedup_chunks = chunks;
+    memset(pDesc->dedup_dirty, 0, chunks);
+    return ST_OK;
+}
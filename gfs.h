@@ -0,0 +1,185 @@
+#ifndef FS_GFS_H
+#define FS_GFS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define ST_OK 0
+#define ST_CANT_OPEN -1
+#define ST_EXISTS -2
+#define ST_NOT_VALID_FILE -3
+#define ST_NOT_FOUND -4
+#define ST_NOT_ENOUGH_SPACE -5
+#define ST_IO_ERROR -6
+#define ST_OLD_FORMAT -7
+#define ST_CORRUPT -8
+#define ST_NOT_EMPTY -9
+#define ST_INVALID_COMMAND 1
+
+#define CREATE_SPARSE 0x01
+#define CREATE_PREALLOC 0x02
+#define CREATE_ZERO 0x03
+
+#define MMAP_OFF 0x00
+#define MMAP_NOSYNC 0x01
+#define MMAP_ASYNC 0x02
+#define MMAP_SYNC 0x03
+
+//How copies spanning several extents and table loads and saves reach an unmapped drive. AUTO takes io_uring where
+//the kernel has it and a pool of threads where not; SYNC copies one extent at a time.
+#define IO_SYNC 0x00
+#define IO_URING 0x01
+#define IO_THREADS 0x02
+#define IO_AUTO 0x03
+
+//CONTIGUOUS: the tightest extent that takes the whole file, else the fewest, largest extents
+//FIRST: the lowest extent that takes the whole file, else extents from the front of the image
+#define POLICY_CONTIGUOUS 0x00
+#define POLICY_FIRST 0x01
+
+#define STATS_TEXT 0x00
+#define STATS_JSON 0x01
+
+//PATHS: every name is a path of parts separated by '/', each part cut to PART_MAX bytes. Empty and "." parts are
+//skipped, ".." is refused. Adds create the directories a path leads through.
+#define PART_MAX 31
+
+//One open drive. Any number of threads may read through it at once; adds, removes and flushes take turns.
+typedef struct FS_handle FS_handle;
+
+typedef struct {
+    uint32_t files;     //those kept in extents, inline ones have none
+    uint32_t file_extents;
+    uint32_t free_extents;
+    uint64_t largest_free;
+} FS_fragmentation;
+
+typedef struct {
+    FS_fragmentation before;
+    FS_fragmentation after;
+    uint64_t moved;     //bytes copied
+    uint32_t moves;
+    uint8_t complete;   //0 when the time limit or a lack of space stopped it early
+} FS_defrag_report;
+
+typedef struct {
+    uint32_t tables;    //allocation and directory tables and B+tree nodes
+    uint32_t files;
+    uint32_t directories;
+    uint32_t extents;   //units that are not free, of files, shared chunks and tables
+    uint32_t problems;
+} FS_check_report;
+
+typedef struct {
+    uint64_t bytes;     //verified
+    uint32_t extents;
+    uint32_t unchecked; //stored without a checksum
+    uint32_t bad;       //checksum mismatch or unreadable
+    uint32_t threads;
+} FS_scrub_report;
+
+//Called once per file by gfsList and once per entry by gfsListDir, a non-zero return stops the listing
+typedef int (*FS_list_callback)(const char* pName, uint64_t pSize, uint64_t pCreated, void* pContext);
+
+//pPolicy becomes the image's allocation policy
+int gfsCreate(const char* pPath, uint64_t pBytes, uint8_t pMode, uint8_t pPolicy);
+
+//NULL on failure, with the reason in *pStatus; ST_OLD_FORMAT for an image made by an earlier format, ST_CORRUPT
+//when a table or an index fails its checksum, an index slot leads nowhere or a chain of tables does
+FS_handle* gfsOpen(const char* pPath, uint8_t pMap, uint8_t pIo, int* pStatus);
+
+//Flushes, then releases the handle whatever the flush returned
+int gfsClose(FS_handle* pHandle);
+
+//Places the following adds through this handle with pPolicy, the image keeps its own
+int gfsPolicy(FS_handle* pHandle, uint8_t pPolicy);
+
+//Compresses the following adds through this handle, file by file where it pays; reads always decompress.
+//ST_INVALID_COMMAND when the library was built without zlib.
+int gfsCompression(FS_handle* pHandle, uint8_t pOn);
+
+//Stores the following adds through this handle as content-defined chunks, each kept once however many files
+//hold it. Compression does not apply to them.
+int gfsDedup(FS_handle* pHandle, uint8_t pOn);
+
+//Records the CRC32C of every extent the following adds through this handle write, for gfsScrub to verify
+int gfsChecksums(FS_handle* pHandle, uint8_t pOn);
+
+//Commits every change since the last flush; changes are also committed early once they outgrow half the journal,
+//and a commit larger than the whole journal grows it at the end of the drive file
+int gfsFlush(FS_handle* pHandle);
+
+//WRITERS
+int gfsAdd(FS_handle* pHandle, const char* pName, const void* pData, uint64_t pSize);
+
+int gfsAddFile(FS_handle* pHandle, const char* pPath);
+
+//Stores pSize bytes read from pFile's current position as pName
+int gfsAddStream(FS_handle* pHandle, FILE* pFile, uint64_t pSize, const char* pName);
+
+//Stores everything read from pFile until its end as pName, for pipes and other input of unknown size
+int gfsAddPipe(FS_handle* pHandle, FILE* pFile, const char* pName);
+
+//Removes a file or an empty directory, ST_NOT_EMPTY for any other
+int gfsRemove(FS_handle* pHandle, const char* pName);
+
+//Creates the directory and those leading to it
+int gfsMakeDir(FS_handle* pHandle, const char* pPath);
+
+//Moves extents down until every file is one extent and free space one extent at the end, or pMillis run out.
+//0 means no limit. Progress is committed as it goes, so a stopped run can be continued by the next one.
+int gfsDefrag(FS_handle* pHandle, uint32_t pMillis, FS_defrag_report* pReport);
+
+//READERS
+//Copies the file into pBuffer; a buffer that is too small gets nothing and ST_NOT_ENOUGH_SPACE. *pSize is the file size.
+int gfsRead(FS_handle* pHandle, const char* pName, void* pBuffer, uint64_t pCapacity, uint64_t* pSize);
+
+//Copies up to pSize bytes of pName from pOffset on into pBuffer, like pread; *pRead is 0 at or past the end
+int gfsPread(FS_handle* pHandle, const char* pName, void* pBuffer, uint64_t pSize, uint64_t pOffset, uint64_t* pRead);
+
+int gfsSize(FS_handle* pHandle, const char* pName, uint64_t* pSize);
+
+int gfsGetFile(FS_handle* pHandle, const char* pName, const char* pDest);
+
+//Writes the contents of pName at pDest's current position
+int gfsGetStream(FS_handle* pHandle, const char* pName, FILE* pDest);
+
+//Writes up to pSize bytes of pName from pOffset on at pDest's current position
+int gfsGetRange(FS_handle* pHandle, const char* pName, uint64_t pOffset, uint64_t pSize, FILE* pDest);
+
+//Every file of the drive by its path, directory by directory in name order
+int gfsList(FS_handle* pHandle, FS_list_callback pEach, void* pContext);
+
+//The entries of directory pPath in name order, a directory's name ending in '/': those after pAfter (NULL or "" from
+//the first), at most pCount of them (0 for all). NULL or "" lists the top directory. Only the B+tree nodes leading
+//to the page are read, so a page costs the same wherever it starts.
+int gfsListDir(FS_handle* pHandle, const char* pPath, const char* pAfter, uint32_t pCount, FS_list_callback pEach,
+               void* pContext);
+
+int gfsStatus(FS_handle* pHandle, FILE* pOut);
+
+//Files kept in extents and their extents, free extents and the largest of them, as gfsDefrag reports them
+int gfsFragmentation(FS_handle* pHandle, FS_fragmentation* pOut);
+
+//METRICS
+//Writes a line per operation of the handle from now on to pOut: its latency, the time spent in each phase inside it
+//(loading, finding, allocating, merging, saving, syncing, copying) and the tables scanned, units looked at, bytes
+//read and written and system calls it took. NULL stops the trace.
+int gfsTrace(FS_handle* pHandle, FILE* pOut);
+
+//Calls, total and worst latency, percentiles and a latency histogram per operation and phase, and every counter,
+//since the handle opened. STATS_TEXT for a table, STATS_JSON for one JSON object.
+int gfsStats(FS_handle* pHandle, FILE* pOut, uint8_t pFormat);
+
+//CHECKS
+//Checks the metadata of the drive at pPath, which need not open: table and index checksums, chains and index slots,
+//units overlapping or past the end, free space against the info block, chains shared or leading nowhere, blocks
+//nothing holds. One line per problem goes to pOut unless it is NULL; ST_CORRUPT when there is any. The journal is
+//replayed first.
+int gfsCheck(const char* pPath, FILE* pOut, FS_check_report* pReport);
+
+//Verifies every extent stored with a checksum, reading the drive front to back while a worker per core computes.
+//One line per bad extent goes to pOut unless it is NULL; ST_CORRUPT when there is any.
+int gfsScrub(FS_handle* pHandle, FILE* pOut, FS_scrub_report* pReport);
+
+#endif //FS_GFS_H
@@ -0,0 +1,373 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifdef GFS_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#endif
+#include "gfs.h"
+#include "io.h"
+#include "metrics.h"
+
+//One caller's requests while the pool works through them
+typedef struct FS_io_batch {
+    FS_io_request* requests;
+    int fd;
+    uint32_t count;
+    uint32_t next;      //first request nobody took yet
+    uint32_t done;
+    int failed;
+    struct FS_io_batch* later;
+} FS_io_batch;
+
+struct FS_io_engine {
+    uint8_t kind;
+    pthread_mutex_t lock;       //the ring, or the pool's queue
+#ifdef GFS_IO_URING
+    //IO_URING: rings shared with the kernel, set up through the raw system calls
+    int ring;
+    uint8_t* sq_map;
+    size_t sq_size;
+    uint8_t* cq_map;
+    size_t cq_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+    uint32_t* sq_head;
+    uint32_t* sq_tail;
+    uint32_t* sq_array;
+    uint32_t sq_mask;
+    uint32_t* cq_head;
+    uint32_t* cq_tail;
+    uint32_t cq_mask;
+    struct io_uring_cqe* cqes;
+    uint32_t depth;
+#endif
+    //IO_THREADS
+    pthread_cond_t work;
+    pthread_cond_t finished;
+    FS_io_batch* batches;       //oldest first, each until its last request is taken
+    pthread_t workers[FS_IO_THREADS];
+    uint32_t started;
+    uint8_t stopping;
+};
+
+static int copyAll(int pFd, FS_io_request* pRequest) {
+    uint8_t* data = pRequest->data;
+    size_t size = pRequest->size;
+    off_t offset = pRequest->offset;
+
+    while (size > 0) {
+        ssize_t done = pRequest->write ? pwrite(pFd, data, size, offset) : pread(pFd, data, size, offset);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0)
+            return -1;
+        data += done;
+        offset += done;
+        size -= (size_t) done;
+    }
+    return 0;
+}
+
+#ifdef GFS_IO_URING
+static void ringStop(FS_io_engine* pEngine) {
+    if (pEngine->sqes != NULL)
+        munmap(pEngine->sqes, pEngine->sqes_size);
+    if (pEngine->cq_map != NULL && pEngine->cq_map != pEngine->sq_map)
+        munmap(pEngine->cq_map, pEngine->cq_size);
+    if (pEngine->sq_map != NULL)
+        munmap(pEngine->sq_map, pEngine->sq_size);
+    if (pEngine->ring >= 0)
+        close(pEngine->ring);
+    pEngine->sqes = NULL;
+    pEngine->cq_map = NULL;
+    pEngine->sq_map = NULL;
+    pEngine->ring = -1;
+}
+
+static int ringStart(FS_io_engine* pEngine) {
+    struct io_uring_params params;
+    void* map;
+
+    memset(&params, 0, sizeof(params));
+    pEngine->ring = (int) syscall(__NR_io_uring_setup, FS_IO_DEPTH, &params);
+    if (pEngine->ring < 0)
+        return -1;
+    pEngine->sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    pEngine->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) && pEngine->cq_size > pEngine->sq_size)
+        pEngine->sq_size = pEngine->cq_size;
+
+    map = mmap(NULL, pEngine->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pEngine->ring,
+               IORING_OFF_SQ_RING);
+    if (map == MAP_FAILED) {
+        ringStop(pEngine);
+        return -1;
+    }
+    pEngine->sq_map = map;
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        pEngine->cq_map = pEngine->sq_map;
+    else {
+        map = mmap(NULL, pEngine->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pEngine->ring,
+                   IORING_OFF_CQ_RING);
+        if (map == MAP_FAILED) {
+            ringStop(pEngine);
+            return -1;
+        }
+        pEngine->cq_map = map;
+    }
+    pEngine->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    map = mmap(NULL, pEngine->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pEngine->ring,
+               IORING_OFF_SQES);
+    if (map == MAP_FAILED) {
+        ringStop(pEngine);
+        return -1;
+    }
+    pEngine->sqes = map;
+
+    pEngine->sq_head = (uint32_t*) (pEngine->sq_map + params.sq_off.head);
+    pEngine->sq_tail = (uint32_t*) (pEngine->sq_map + params.sq_off.tail);
+    pEngine->sq_array = (uint32_t*) (pEngine->sq_map + params.sq_off.array);
+    pEngine->sq_mask = *(uint32_t*) (pEngine->sq_map + params.sq_off.ring_mask);
+    pEngine->cq_head = (uint32_t*) (pEngine->cq_map + params.cq_off.head);
+    pEngine->cq_tail = (uint32_t*) (pEngine->cq_map + params.cq_off.tail);
+    pEngine->cq_mask = *(uint32_t*) (pEngine->cq_map + params.cq_off.ring_mask);
+    pEngine->cqes = (struct io_uring_cqe*) (pEngine->cq_map + params.cq_off.cqes);
+    pEngine->depth = params.sq_entries < FS_IO_DEPTH ? params.sq_entries : FS_IO_DEPTH;
+    return 0;
+}
+
+//Puts what is left of pRequest after pMoved bytes on the submission ring, tagged with pSlot
+static void ringQueue(FS_io_engine* pEngine, int pFd, FS_io_request* pRequest, struct iovec* pVector, uint32_t pSlot,
+                      size_t pMoved) {
+    uint32_t tail = *pEngine->sq_tail;
+    uint32_t index = tail & pEngine->sq_mask;
+    struct io_uring_sqe* sqe = &pEngine->sqes[index];
+
+    pVector->iov_base = (uint8_t*) pRequest->data + pMoved;
+    pVector->iov_len = pRequest->size - pMoved;
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = pRequest->write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = pFd;
+    sqe->addr = (uint64_t) (uintptr_t) pVector;
+    sqe->len = 1;
+    sqe->off = (uint64_t) (pRequest->offset + (off_t) pMoved);
+    sqe->user_data = pSlot;
+    pEngine->sq_array[index] = index;
+    __atomic_store_n(pEngine->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+//Keeps up to depth requests on the ring, a short transfer goes back on for the rest of its bytes. The caller holds
+//the lock.
+static int ringRun(FS_io_engine* pEngine, int pFd, FS_io_request* pRequests, uint32_t pCount) {
+    struct iovec vectors[FS_IO_DEPTH];
+    uint32_t owners[FS_IO_DEPTH];   //request in each slot
+    size_t moved[FS_IO_DEPTH];
+    uint32_t idle[FS_IO_DEPTH];
+    uint32_t idleCount = pEngine->depth;
+    uint32_t next = 0;
+    uint32_t inflight = 0;
+    int failed = 0;
+
+    for (uint32_t slot = 0; slot < pEngine->depth; ++slot)
+        idle[slot] = slot;
+    while (inflight > 0 || (next < pCount && !failed)) {
+        while (!failed && next < pCount && idleCount > 0) {
+            uint32_t slot = idle[--idleCount];
+            owners[slot] = next++;
+            moved[slot] = 0;
+            ringQueue(pEngine, pFd, &pRequests[owners[slot]], &vectors[slot], slot, 0);
+            inflight += 1;
+        }
+
+        uint32_t pending = *pEngine->sq_tail - __atomic_load_n(pEngine->sq_head, __ATOMIC_ACQUIRE);
+        metricCount(COUNT_SYSCALLS, 1);
+        if (syscall(__NR_io_uring_enter, pEngine->ring, pending, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+            errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            return -1;
+
+        uint32_t head = *pEngine->cq_head;
+        uint32_t tail = __atomic_load_n(pEngine->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            struct io_uring_cqe* cqe = &pEngine->cqes[head & pEngine->cq_mask];
+            uint32_t slot = (uint32_t) cqe->user_data;
+            FS_io_request* request = &pRequests[owners[slot]];
+
+            if (cqe->res > 0)
+                moved[slot] += (size_t) cqe->res;
+            else if (cqe->res != -EINTR && cqe->res != -EAGAIN)
+                failed = 1;
+            if (!failed && moved[slot] < request->size)
+                ringQueue(pEngine, pFd, request, &vectors[slot], slot, moved[slot]);
+            else {
+                idle[idleCount++] = slot;
+                inflight -= 1;
+            }
+        }
+        __atomic_store_n(pEngine->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return failed ? -1 : 0;
+}
+#endif
+
+static void poolUnlink(FS_io_engine* pEngine, FS_io_batch* pBatch) {
+    FS_io_batch** link = &pEngine->batches;
+    while (*link != pBatch)
+        link = &(*link)->later;
+    *link = pBatch->later;
+}
+
+//Takes the next request of the oldest batch until stopped; a batch leaves the queue once its last one is taken
+static void* poolWork(void* pEngine) {
+    FS_io_engine* engine = pEngine;
+
+    pthread_mutex_lock(&engine->lock);
+    while (!engine->stopping) {
+        FS_io_batch* batch = engine->batches;
+        uint32_t index;
+        int result;
+
+        if (batch == NULL) {
+            pthread_cond_wait(&engine->work, &engine->lock);
+            continue;
+        }
+        index = batch->next++;
+        if (batch->next == batch->count)
+            poolUnlink(engine, batch);
+        pthread_mutex_unlock(&engine->lock);
+        result = copyAll(batch->fd, &batch->requests[index]);
+        pthread_mutex_lock(&engine->lock);
+        batch->failed |= result != 0;
+        if (++batch->done == batch->count)
+            pthread_cond_broadcast(&engine->finished);
+    }
+    pthread_mutex_unlock(&engine->lock);
+    return NULL;
+}
+
+static int poolStart(FS_io_engine* pEngine) {
+    if (pthread_cond_init(&pEngine->work, NULL) != 0)
+        return -1;
+    if (pthread_cond_init(&pEngine->finished, NULL) != 0) {
+        pthread_cond_destroy(&pEngine->work);
+        return -1;
+    }
+    for (; pEngine->started < FS_IO_THREADS; ++pEngine->started)
+        if (pthread_create(&pEngine->workers[pEngine->started], NULL, poolWork, pEngine) != 0)
+            break;
+    if (pEngine->started == 0) {
+        pthread_cond_destroy(&pEngine->work);
+        pthread_cond_destroy(&pEngine->finished);
+        return -1;
+    }
+    return 0;
+}
+
+static void poolStop(FS_io_engine* pEngine) {
+    pthread_mutex_lock(&pEngine->lock);
+    pEngine->stopping = 1;
+    pthread_cond_broadcast(&pEngine->work);
+    pthread_mutex_unlock(&pEngine->lock);
+    for (uint32_t i = 0; i < pEngine->started; ++i)
+        pthread_join(pEngine->workers[i], NULL);
+    pthread_cond_destroy(&pEngine->work);
+    pthread_cond_destroy(&pEngine->finished);
+}
+
+//The caller works through its own batch beside the pool, then waits for the requests the workers took
+static int poolRun(FS_io_engine* pEngine, int pFd, FS_io_request* pRequests, uint32_t pCount) {
+    FS_io_batch batch = {pRequests, pFd, pCount, 0, 0, 0, NULL};
+    FS_io_batch** last = &pEngine->batches;
+
+    pthread_mutex_lock(&pEngine->lock);
+    while (*last != NULL)
+        last = &(*last)->later;
+    *last = &batch;
+    pthread_cond_broadcast(&pEngine->work);
+    while (batch.next < batch.count) {
+        uint32_t index = batch.next++;
+        int result;
+        if (batch.next == batch.count)
+            poolUnlink(pEngine, &batch);
+        pthread_mutex_unlock(&pEngine->lock);
+        result = copyAll(pFd, &pRequests[index]);
+        pthread_mutex_lock(&pEngine->lock);
+        batch.failed |= result != 0;
+        batch.done += 1;
+    }
+    while (batch.done < batch.count)
+        pthread_cond_wait(&pEngine->finished, &pEngine->lock);
+    pthread_mutex_unlock(&pEngine->lock);
+    return batch.failed ? -1 : 0;
+}
+
+FS_io_engine* ioStart(uint8_t pKind) {
+    FS_io_engine* engine;
+
+    if (pKind == IO_SYNC || (engine = calloc(1, sizeof(FS_io_engine))) == NULL)
+        return NULL;
+    if (pthread_mutex_init(&engine->lock, NULL) != 0) {
+        free(engine);
+        return NULL;
+    }
+#ifdef GFS_IO_URING
+    engine->ring = -1;
+    if (pKind != IO_THREADS && ringStart(engine) == 0) {
+        engine->kind = IO_URING;
+        return engine;
+    }
+#endif
+    if (poolStart(engine) == 0) {
+        engine->kind = IO_THREADS;
+        return engine;
+    }
+    pthread_mutex_destroy(&engine->lock);
+    free(engine);
+    return NULL;
+}
+
+void ioStop(FS_io_engine* pEngine) {
+    if (pEngine == NULL)
+        return;
+#ifdef GFS_IO_URING
+    ringStop(pEngine);
+#endif
+    if (pEngine->kind == IO_THREADS)
+        poolStop(pEngine);
+    pthread_mutex_destroy(&pEngine->lock);
+    free(pEngine);
+}
+
+uint8_t ioKind(FS_io_engine* pEngine) {
+    return pEngine != NULL ? pEngine->kind : IO_SYNC;
+}
+
+//Counted here on the caller's thread, pool threads have no operation to count into; a request is one call
+int ioSubmit(FS_io_engine* pEngine, int pFd, FS_io_request* pRequests, uint32_t pCount) {
+    int result = 0;
+
+    for (uint32_t i = 0; i < pCount; ++i)
+        metricCount(pRequests[i].write ? COUNT_WRITTEN : COUNT_READ, pRequests[i].size);
+    if (pEngine != NULL && pCount > 1) {
+#ifdef GFS_IO_URING
+        if (pEngine->kind == IO_URING && pthread_mutex_trylock(&pEngine->lock) == 0) {
+            result = ringRun(pEngine, pFd, pRequests, pCount);
+            pthread_mutex_unlock(&pEngine->lock);
+            return result;
+        }
+#endif
+        if (pEngine->kind == IO_THREADS) {
+            metricCount(COUNT_SYSCALLS, pCount);
+            return poolRun(pEngine, pFd, pRequests, pCount);
+        }
+    }
+    metricCount(COUNT_SYSCALLS, pCount);
+    for (uint32_t i = 0; i < pCount && result == 0; ++i)
+        result = copyAll(pFd, &pRequests[i]);
+    return result;
+}
@@ -0,0 +1,20 @@
+#ifndef FS_IO_H
+#define FS_IO_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "descriptors.h"
+
+//IO_URING falls back to IO_THREADS where the kernel lacks it; NULL for IO_SYNC or when neither starts
+FS_io_engine* ioStart(uint8_t pKind);
+
+void ioStop(FS_io_engine* pEngine);
+
+//IO_* the engine runs, IO_SYNC for NULL
+uint8_t ioKind(FS_io_engine* pEngine);
+
+//Carries out every request on pFd, up to FS_IO_DEPTH at once, and returns once all are done; 0 when each moved all
+//its bytes. A NULL engine, or a ring busy with another caller's batch, runs them one after another in the caller.
+int ioSubmit(FS_io_engine* pEngine, int pFd, FS_io_request* pRequests, uint32_t pCount);
+
+#endif //FS_IO_H
@@ -1,73 +1,196 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <time.h>
-#include "descriptors.h"
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/sendfile.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "gfs.h"
+#include "protocol.h"
 #include "version.h"
 
 #define STR_HELPER(x) #x
 #define STR(x) STR_HELPER(x)
 #define FS_VERSION  STR(MAJOR_VERSION)"."STR(MINOR_VERSION)
 
-#define ST_OK 0
-#define ST_CANT_OPEN -1
-#define ST_EXISTS -2
-#define ST_NOT_VALID_FILE -3
-#define ST_NOT_FOUND -4
-#define ST_NOT_ENOUGH_SPACE -5
-#define ST_INVALID_COMMAND 1
+#define BATCH_ADD 0x01
+#define BATCH_GET 0x02
+#define BATCH_REMOVE 0x03
+#define BATCH_MKDIR 0x04
+
+#define LIST_PAGE 4096      //entries ls prints per gfsListDir call
+#define TREE_PAGE 1024      //entries tree holds per directory it is in
+
+typedef struct {
+    FS_handle* handle;
+    char* dest;
+    char** names;
+    uint32_t total;
+    uint32_t capacity;
+    uint32_t next;      //shared by the workers, each takes the next file from here
+    uint32_t failed;
+    int result;
+} FS_extract_job;
+
+typedef struct {
+    char name[PART_MAX + 1];
+    uint8_t directory;
+    uint64_t size;
+    uint64_t created;
+} FS_list_item;
+
+//One page of a directory, and the last created time formatted so a run of files added together formats it once
+typedef struct {
+    FILE* out;
+    FS_list_item* items;
+    uint32_t count;
+    time_t created;
+    char time[20];
+} FS_list_page;
+
+int ls(FS_handle* pHandle, const char* pPath, const char* pAfter, uint32_t pCount);
+
+int tree(FS_handle* pHandle, FILE* pOut);
+
+int treeDirectory(FS_handle* pHandle, char* pPath, size_t pLength, FS_list_page* pPage);
 
-#define DIR_FROM_FILE 0x01
-#define DIR_TO_FILE 0x02
+int pageEntry(const char* pName, uint64_t pSize, uint64_t pCreated, void* pContext);
 
+void printEntry(FS_list_page* pPage, const char* pPath, FS_list_item* pItem);
 
-int createFS(FILE* pDrive, uint32_t pBytes);
+int batch(FS_handle* pHandle, uint8_t pOp, char** pArgs, int pCount, char* pDest);
 
-int findFile(FS_file_entry* pFile, uint32_t* pIndex, FS_descriptors* pDesc, char* pFilename);
+int batchItem(FS_handle* pHandle, uint8_t pOp, char* pName, char* pDest);
 
-void blockCopy(FILE* pDrive, FILE* pFile, FS_allocation_unit* pUnit, uint32_t pSize, uint8_t pDirection);
+int collectNames(char** pArgs, int pCount, char*** pNames, uint32_t* pTotal);
 
-int loadDescriptors(FILE* pDrive, FS_descriptors* pDest);
+const char* resultMessage(int pResult);
 
-int discardDescriptors(FS_descriptors* pDest);
+int extract(FS_handle* pHandle, char* pDest, uint32_t pThreads);
 
-size_t fsize(FILE* pFile);
+int extractEntry(const char* pName, uint64_t pSize, uint64_t pCreated, void* pContext);
 
-int createDirectoryBlock(FS_descriptors* pDesc);
+void* extractWorker(void* pJob);
 
-uint32_t findBlock(FS_descriptors* pDesc, uint8_t pType);
+int makeParents(char* pPath);
 
-uint32_t findBlockSize(FS_descriptors* pDesc, uint8_t pType, uint32_t pSize);
+int defrag(FS_handle* pHandle, uint32_t pMillis);
 
-uint32_t allocateSystemBlock(FS_descriptors* pDesc, uint32_t pSize);
+int fsck(char* pDrive);
 
-int createAllocationBlock(FS_descriptors* pDesc);
+int scrub(FS_handle* pHandle);
 
-int saveDescriptors(FS_descriptors* pDesc);
+int serve(FS_handle* pHandle, char* pSocket);
 
-int status(FS_descriptors* pDrive);
+int serveRequest(FS_handle* pHandle, FS_client* pClients, uint32_t pCount, uint32_t pClient, int pSpool);
 
-int tree(FS_descriptors* pDesc);
+void serveCommit(FS_handle* pHandle, FS_client* pClients, uint32_t pCount);
 
-int addFile(FS_descriptors* pDesc, char* pFilename);
+void stopServing(int pSignal);
 
-int getFile(FS_descriptors* pDesc, char* pDest, char* pFilename);
+int client(char* pSocket, char* pCommand, char** pArgs, int pCount);
 
-int removeFile(FS_descriptors* pDesc, char* pFile);
+int clientSend(int pSocket, uint8_t pOp, char* pName);
 
-uint32_t defragBlock(FS_descriptors* pDesc, uint32_t pBlock);
+int clientReceive(int pSocket, FILE* pDest, FS_response* pResponse);
+
+int readAll(int pFd, void* pData, size_t pSize);
+
+int writeAll(int pFd, const void* pData, size_t pSize);
 
 int main(int argc, char** argv) {
-    FILE* virtualDrive = NULL;
-    FS_descriptors descriptors;
+    FS_handle* handle = NULL;
+    uint8_t map = MMAP_OFF;
+    uint8_t io = IO_AUTO;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int policy = -1;
+    uint8_t compress = 0;
+    uint8_t dedup = 0;
+    uint8_t checksum = 0;
+    uint8_t piped = 0;
+    uint8_t trace = 0;
+    FILE* report = stdout;
+    int args = 1;
     int result = 0;
 
+    //STRIP OPTIONS
+    for (int arg = 1; arg < argc; ++arg) {
+        if (!strcmp(argv[arg], "--mmap") || !strcmp(argv[arg], "--mmap=async"))
+            map = MMAP_ASYNC;
+        else if (!strcmp(argv[arg], "--mmap=sync"))
+            map = MMAP_SYNC;
+        else if (!strcmp(argv[arg], "--mmap=nosync"))
+            map = MMAP_NOSYNC;
+        else if (!strcmp(argv[arg], "--io=sync"))
+            io = IO_SYNC;
+        else if (!strcmp(argv[arg], "--io=uring"))
+            io = IO_URING;
+        else if (!strcmp(argv[arg], "--io=threads"))
+            io = IO_THREADS;
+        else if (!strcmp(argv[arg], "--policy=contiguous"))
+            policy = POLICY_CONTIGUOUS;
+        else if (!strcmp(argv[arg], "--policy=first"))
+            policy = POLICY_FIRST;
+        else if (!strcmp(argv[arg], "--compress"))
+            compress = 1;
+        else if (!strcmp(argv[arg], "--dedup"))
+            dedup = 1;
+        else if (!strcmp(argv[arg], "--checksum"))
+            checksum = 1;
+        else if (!strcmp(argv[arg], "--stdin"))
+            piped = 1;
+        else if (!strcmp(argv[arg], "--trace"))
+            trace = 1;
+        else if (!strncmp(argv[arg], "--threads=", 10)) {
+            threads = strtol(argv[arg] + 10, NULL, 10);
+            if (threads < 1) {
+                printf("Provide at least one thread: %s\n", argv[arg]);
+                return ST_INVALID_COMMAND;
+            }
+        } else if (!strncmp(argv[arg], "--", 2)) {
+            printf("Unknown option: %s\n", argv[arg]);
+            return ST_INVALID_COMMAND;
+        } else
+            argv[args++] = argv[arg];
+    }
+    argc = args;
+
     do {
         if (argc < 2 || !strcmp(argv[1], "help")) {
             printf("Provide correct module: \n");
-            printf("create, drop, add, remove, tree, status, version\n");
-            printf("are allowed\n");
+            printf("create, drop, add, get, cat, extract, remove, mkdir, ls, defrag, fsck, scrub, tree, status, stats,\n");
+            printf("version are allowed\n");
+            printf("names are paths like dir/sub/name, adds create the directories on the way\n");
+            printf("add, get, remove and mkdir take many names, - to read them from stdin or @file for a manifest\n");
+            printf("ls <drive> [directory [after count]] lists a directory in name order, count entries after that one\n");
+            printf("add <drive> --stdin <name> stores whatever is piped in as that one file\n");
+            printf("serve <drive> <socket> keeps the drive open for clients; pass the socket instead of a drive\n");
+            printf("to add, get, remove, tree, status or stats to send them to that server\n");
+            printf("cat <drive> <name> [offset length] writes the file, or that much of it, to stdout\n");
+            printf("extract <drive> <directory> copies every file out of the drive at once\n");
+            printf("defrag <drive> [seconds] compacts the drive, for at most that long if given\n");
+            printf("fsck <drive> checks the tables of a drive, even one that no longer opens\n");
+            printf("scrub <drive> reads every extent added with --checksum and verifies it\n");
+            printf("stats <drive> prints the calls, latencies and I/O of every operation as JSON\n");
+            printf("Options: --mmap[=async|sync|nosync] maps the drive instead of reading it\n");
+            printf("         --io=uring|threads|sync batches reads and writes spanning extents, io_uring by default\n");
+            printf("         --threads=N extracts with N workers, one per core by default\n");
+            printf("         --policy=contiguous|first places added files; given to create it sets the drive's own\n");
+            printf("         --compress compresses added files where it pays, get always decompresses\n");
+            printf("         --dedup stores added files in chunks shared with every file holding the same bytes\n");
+            printf("         --checksum records the CRC32C of every extent added, for scrub to verify\n");
+            printf("         --trace prints each operation's phases to stderr, and every latency at the end\n");
             return ST_INVALID_COMMAND;
         }
 
@@ -78,38 +201,80 @@ int main(int argc, char** argv) {
         }
 
         if (!strcmp(argv[1], "create")) {
-            int bytes;
+            unsigned long long bytes;
+            uint8_t mode = CREATE_SPARSE;
+            char* end;
             if (argc < 4) {
                 printf("Provide correct arguments:\n");
-                printf("FS create <drive> <size in bytes>\n");
+                printf("FS create <drive> <size in bytes> [sparse|prealloc|zero] [--policy=contiguous|first]\n");
                 return ST_INVALID_COMMAND;
             }
-            virtualDrive = fopen(argv[2], "wb+");
-            bytes = atoi(argv[3]);
-            if (virtualDrive == NULL) {
-                printf("Can not create the file!\n");
-                return ST_CANT_OPEN;
+            if (argc > 4) {
+                if (!strcmp(argv[4], "sparse"))
+                    mode = CREATE_SPARSE;
+                else if (!strcmp(argv[4], "prealloc"))
+                    mode = CREATE_PREALLOC;
+                else if (!strcmp(argv[4], "zero"))
+                    mode = CREATE_ZERO;
+                else {
+                    printf("Unknown create mode: %s\n", argv[4]);
+                    return ST_INVALID_COMMAND;
+                }
             }
-            if (bytes <= 0) {
+            bytes = strtoull(argv[3], &end, 10);
+            if (*end != 0 || argv[3][0] == '-' || bytes == 0) {
                 printf("Size can not be negative or zero!\n");
                 return ST_INVALID_COMMAND;
             }
-            result = createFS(virtualDrive, (uint32_t) bytes);
-            fclose(virtualDrive);
+            if (bytes > INT64_MAX / 2) {
+                printf("Size can not exceed %lld bytes!\n", (long long) (INT64_MAX / 2));
+                return ST_INVALID_COMMAND;
+            }
+            result = gfsCreate(argv[2], (uint64_t) bytes, mode, policy < 0 ? POLICY_CONTIGUOUS : (uint8_t) policy);
+            if (result == ST_CANT_OPEN)
+                printf("Can not create the file!\n");
+            else if (result != ST_OK)
+                printf("Can not allocate the drive!\n");
             return result;
         }
 
-        virtualDrive = fopen(argv[2], "rb+");
-        if (virtualDrive == NULL) {
-            descriptors.info_block = NULL;
-            descriptors.allocation_table = NULL;
-            descriptors.directory_table = NULL;
-            result = ST_CANT_OPEN;
+        //the drive may be too damaged to open
+        if (!strcmp(argv[1], "fsck")) {
+            if (argc < 3) {
+                printf("Provide correct arguments:\n");
+                printf("FS fsck <drive>\n");
+                return ST_INVALID_COMMAND;
+            }
+            result = fsck(argv[2]);
             break;
         }
 
-        result = loadDescriptors(virtualDrive, &descriptors);
-        if (result != ST_OK) break;
+        //CLIENT MODE: a socket in place of the drive
+        struct stat socketStat;
+        if (argc > 2 && stat(argv[2], &socketStat) == 0 && S_ISSOCK(socketStat.st_mode)) {
+            if (piped) {
+                printf("A server takes files by name, --stdin needs the drive itself\n");
+                return ST_INVALID_COMMAND;
+            }
+            if (!strcmp(argv[1], "stats"))
+                report = stderr;
+            result = client(argv[2], argv[1], &argv[3], argc - 3);
+            break;
+        }
+
+        handle = gfsOpen(argv[2], map, io, &result);
+        if (handle == NULL) break;
+        if (trace)
+            gfsTrace(handle, stderr);
+        if (policy >= 0)
+            gfsPolicy(handle, (uint8_t) policy);
+        if (compress && gfsCompression(handle, 1) != ST_OK) {
+            printf("Built without compression: --compress\n");
+            result = ST_INVALID_COMMAND;
+            break;
+        }
+        gfsDedup(handle, dedup);
+        gfsChecksums(handle, checksum);
 
         if (!strcmp(argv[1], "drop")) {
             remove(argv[2]);
@@ -123,7 +288,14 @@ int main(int argc, char** argv) {
                 printf("FS status <filename>\n");
                 return ST_INVALID_COMMAND;
             }
-            result = status(&descriptors);
+            result = gfsStatus(handle, stdout);
+            break;
+        }
+
+        if (!strcmp(argv[1], "stats")) {
+            //stdout carries the JSON
+            report = stderr;
+            result = gfsStats(handle, stdout, STATS_JSON);
             break;
         }
 
@@ -133,599 +305,945 @@ int main(int argc, char** argv) {
                 printf("FS tree <filename>\n");
                 return ST_INVALID_COMMAND;
             }
-            result = tree(&descriptors);
+            result = tree(handle, stdout);
+            break;
+        }
+
+        if (!strcmp(argv[1], "ls")) {
+            long count = argc > 5 ? strtol(argv[5], NULL, 10) : 0;
+            if (argc == 5 || argc > 6 || count < 0) {
+                printf("Provide correct arguments:\n");
+                printf("FS ls <drive> [directory [after count]]\n");
+                return ST_INVALID_COMMAND;
+            }
+            result = ls(handle, argc > 3 ? argv[3] : NULL, argc > 4 ? argv[4] : NULL, (uint32_t) count);
+            break;
+        }
+
+        if (!strcmp(argv[1], "mkdir")) {
+            if (argc < 4) {
+                printf("Provide correct arguments:\n");
+                printf("FS mkdir <drive> <directory>... | - | @manifest\n");
+                return ST_INVALID_COMMAND;
+            }
+            result = batch(handle, BATCH_MKDIR, &argv[3], argc - 3, NULL);
             break;
         }
 
         if (!strcmp(argv[1], "add")) {
-            char* filename;
-            if (argc < 3) {
+            if (argc < 4) {
                 printf("Provide correct arguments:\n");
-                printf("FS add <drive> <filename>\n");
+                printf("FS add <drive> <filename>... | - | @manifest\n");
+                printf("FS add <drive> --stdin <name>\n");
                 return ST_INVALID_COMMAND;
             }
-            filename = argv[3];
-            result = addFile(&descriptors, filename);
+            if (piped) {
+                if (argc != 4) {
+                    printf("Provide correct arguments:\n");
+                    printf("FS add <drive> --stdin <name>\n");
+                    return ST_INVALID_COMMAND;
+                }
+                result = gfsAddPipe(handle, stdin, argv[3]);
+                break;
+            }
+            result = batch(handle, BATCH_ADD, &argv[3], argc - 3, NULL);
             break;
         }
 
         if (!strcmp(argv[1], "get")) {
+            struct stat st;
             char* destname;
             char* filename;
             if (argc < 5) {
                 printf("Provide correct arguments:\n");
                 printf("FS get <drive> <filename> <destination>\n");
+                printf("FS get <drive> <filename>... | - | @manifest <destination directory>\n");
                 return ST_INVALID_COMMAND;
             }
-            destname = argv[4];
+            destname = argv[argc - 1];
             filename = argv[3];
 
-            result = getFile(&descriptors, destname, filename);
+            if (stat(destname, &st) == 0 && S_ISDIR(st.st_mode))
+                result = batch(handle, BATCH_GET, &argv[3], argc - 4, destname);
+            else if (argc == 5 && strcmp(filename, "-") && filename[0] != '@')
+                result = gfsGetFile(handle, filename, destname);
+            else {
+                printf("Destination of many files must be a directory!\n");
+                result = ST_INVALID_COMMAND;
+            }
             break;
         }
 
-        if (!strcmp(argv[1], "remove")) {
-            char* filename;
-            if (argc < 4) {
+        if (!strcmp(argv[1], "cat")) {
+            unsigned long long range[2] = {0, UINT64_MAX};
+            if (argc != 4 && argc != 6) {
                 printf("Provide correct arguments:\n");
-                printf("FS get <drive> <filename>\n");
+                printf("FS cat <drive> <filename> [offset length]\n");
                 return ST_INVALID_COMMAND;
             }
-            filename = argv[3];
-            result = removeFile(&descriptors, filename);
+            for (int i = 0; argc == 6 && i < 2; ++i) {
+                char* end;
+                range[i] = strtoull(argv[4 + i], &end, 10);
+                if (*end != 0 || argv[4 + i][0] == '-') {
+                    printf("Provide offset and length in bytes: %s\n", argv[4 + i]);
+                    result = ST_INVALID_COMMAND;
+                    break;
+                }
+            }
+            if (result == ST_INVALID_COMMAND)
+                break;
+            //stdout carries the file, so only failures are reported, on stderr
+            report = stderr;
+            result = gfsGetRange(handle, argv[3], (uint64_t) range[0], (uint64_t) range[1], stdout);
+            if (fflush(stdout) != 0 && result == ST_OK)
+                result = ST_IO_ERROR;
             break;
         }
 
-    } while (0);
-
-    switch (result) {
-        case ST_OK:
-            printf("OK.\n");
-            break;
-        case ST_NOT_ENOUGH_SPACE:
-            printf("Failed, not enough space on drive.\n");
-            break;
-        case ST_NOT_VALID_FILE:
-            printf("Specified file is not a valid file!\n");
+        if (!strcmp(argv[1], "extract")) {
+            if (argc < 4) {
+                printf("Provide correct arguments:\n");
+                printf("FS extract <drive> <directory> [--threads=N]\n");
+                result = ST_INVALID_COMMAND;
+                break;
+            }
+            result = extract(handle, argv[3], (uint32_t) threads);
             break;
-        case ST_CANT_OPEN:
-            printf("Can not open the file!\n");
+        }
+
+        if (!strcmp(argv[1], "defrag")) {
+            double seconds = argc > 3 ? strtod(argv[3], NULL) : 0;
+            if (seconds < 0) {
+                printf("Provide correct arguments:\n");
+                printf("FS defrag <drive> [seconds]\n");
+                result = ST_INVALID_COMMAND;
+                break;
+            }
+            result = defrag(handle, (uint32_t) (seconds * 1000));
             break;
-        case ST_EXISTS:
-            printf("File already exists!\n");
+        }
+
+        if (!strcmp(argv[1], "scrub")) {
+            result = scrub(handle);
             break;
-        case ST_NOT_FOUND:
-            printf("File not found!\n");
+        }
+
+        if (!strcmp(argv[1], "serve")) {
+            if (argc < 4) {
+                printf("Provide correct arguments:\n");
+                printf("FS serve <drive> <socket>\n");
+                return ST_INVALID_COMMAND;
+            }
+            result = serve(handle, argv[3]);
             break;
-        default:
-            printf("Something strange happened!\n");
+        }
+
+        if (!strcmp(argv[1], "remove")) {
+            if (argc < 4) {
+                printf("Provide correct arguments:\n");
+                printf("FS remove <drive> <filename>... | - | @manifest\n");
+                return ST_INVALID_COMMAND;
+            }
+            result = batch(handle, BATCH_REMOVE, &argv[3], argc - 3, NULL);
             break;
+        }
+
+    } while (0);
+
+    //the closing save belongs in the summary too
+    if (handle != NULL && trace) {
+        if (gfsFlush(handle) != ST_OK && result == ST_OK)
+            result = ST_IO_ERROR;
+        gfsStats(handle, stderr, STATS_TEXT);
+        gfsTrace(handle, NULL);
     }
-    if (virtualDrive != NULL)
-        fclose(virtualDrive);
-    discardDescriptors(&descriptors);
+    if (handle != NULL && gfsClose(handle) != ST_OK && result == ST_OK)
+        result = ST_IO_ERROR;
+    if (result != ST_INVALID_COMMAND && (result != ST_OK || report == stdout))
+        fprintf(report, "%s\n", resultMessage(result));
 
     return result;
 }
 
-int createFS(FILE* pDrive, uint32_t pBytes) {
-    FS_info header;
-    FS_directory_table directoryTable;
-    FS_allocation_table allocationTable;
-
-    uint8_t dummy = 0;
-
-    header.magic[0] = 'G';
-    header.magic[1] = 'F';
-    header.magic[2] = 'S';
-    strncpy((char*) header.version, FS_VERSION, 5);
-    header.size = pBytes;
-    header.free = pBytes;
-    header.allocation_tables = 1;
-    header.directory_tables = 1;
-
-    allocationTable.offset_next = FS_ENDPOINT;
-    allocationTable.unused_units = FS_ALLOC_UNITS - 1;
-    allocationTable.units[0].type = FS_FREE;
-    allocationTable.units[0].offset = 0;
-    allocationTable.units[0].size = pBytes;
-    allocationTable.units[0].next_block = FS_ENDPOINT;
-    for (uint32_t i = 1; i < FS_ALLOC_UNITS; ++i)
-        allocationTable.units[i].type = FS_UNUSED;
-
-    directoryTable.files_flags = 0;
-    directoryTable.offset_next = FS_ENDPOINT;
-
-    fwrite(&header, sizeof(header), 1, pDrive);
-    fwrite(&allocationTable, sizeof(allocationTable), 1, pDrive);
-    fwrite(&directoryTable, sizeof(directoryTable), 1, pDrive);
-
-    for (uint32_t i = 0; i < pBytes; i++)
-        fwrite(&dummy, sizeof(dummy), 1, pDrive);
 
-    return ST_OK;
+int defrag(FS_handle* pHandle, uint32_t pMillis) {
+    FS_defrag_report report;
+    int result = gfsDefrag(pHandle, pMillis, &report);
+
+    printf("FREE EXTENTS: %u -> %u\n", report.before.free_extents, report.after.free_extents);
+    printf("LARGEST FREE: %llu -> %llu\n", (unsigned long long) report.before.largest_free,
+           (unsigned long long) report.after.largest_free);
+    printf("EXTENTS PER FILE: %.2f -> %.2f\n",
+           report.before.files ? (double) report.before.file_extents / report.before.files : 0,
+           report.after.files ? (double) report.after.file_extents / report.after.files : 0);
+    printf("MOVED: %llu bytes in %u moves\n", (unsigned long long) report.moved, report.moves);
+    if (!report.complete && result == ST_OK)
+        printf("Stopped early, run defrag again to continue\n");
+    return result;
 }
 
-int addFile(FS_descriptors* pDesc, char* pFilename) {
-    FILE* file;
-    uint32_t size;
-    FS_file_entry* file_entry = NULL;
+int fsck(char* pDrive) {
+    FS_check_report report;
+    int result = gfsCheck(pDrive, stdout, &report);
+
+    if (result != ST_OK && result != ST_CORRUPT)
+        return result;
+    printf("TABLES: %u\n", report.tables);
+    printf("FILES: %u\n", report.files);
+    printf("DIRECTORIES: %u\n", report.directories);
+    printf("EXTENTS: %u\n", report.extents);
+    printf("PROBLEMS: %u\n", report.problems);
+    return result;
+}
 
-    file = fopen(pFilename, "rb");
-    if (file == NULL)
-        return ST_CANT_OPEN;
+int scrub(FS_handle* pHandle) {
+    FS_scrub_report report;
+    int result = gfsScrub(pHandle, stdout, &report);
 
-    size = (uint32_t) fsize(file);
+    printf("VERIFIED: %llu bytes in %u extents with %u threads\n", (unsigned long long) report.bytes,
+           report.extents, report.threads);
+    printf("UNCHECKED: %u extents\n", report.unchecked);
+    printf("BAD: %u extents\n", report.bad);
+    return result;
+}
+
+//LISTING: a page at a time, so the drive is never locked for a whole directory and nothing holds all of it
+int ls(FS_handle* pHandle, const char* pPath, const char* pAfter, uint32_t pCount) {
+    FS_list_page page = {stdout, NULL, 0, -1, ""};
+    char after[PART_MAX + 1] = "";
+    int result;
 
-    if (pDesc->info_block->free < size) {
-        fclose(file);
-        printf("Not enough space!\n");
-        printf("Free: %d\n", pDesc->info_block->free);
-        printf("Required: %d\n", size);
+    page.items = malloc((pCount > 0 ? pCount : LIST_PAGE) * sizeof(FS_list_item));
+    if (page.items == NULL)
         return ST_NOT_ENOUGH_SPACE;
-    }
+    if (pAfter != NULL)
+        snprintf(after, sizeof(after), "%s", pAfter);
+    do {
+        page.count = 0;
+        result = gfsListDir(pHandle, pPath, after, pCount > 0 ? pCount : LIST_PAGE, pageEntry, &page);
+        for (uint32_t i = 0; i < page.count; ++i)
+            printEntry(&page, NULL, &page.items[i]);
+        if (page.count > 0)
+            memcpy(after, page.items[page.count - 1].name, sizeof(after));
+    } while (result == ST_OK && pCount == 0 && page.count == LIST_PAGE);
+    free(page.items);
+    return result;
+}
 
-    if (findFile(NULL, NULL, pDesc, pFilename) == ST_OK) {
-        fclose(file);
-        return ST_EXISTS;
-    }
-    pDesc->info_block->free -= size;
+int tree(FS_handle* pHandle, FILE* pOut) {
+    FS_list_page page = {pOut, NULL, 0, -1, ""};
+    char path[PATH_MAX] = "";
 
-    //FIND EMPTY FILE RECORD
-    for (uint32_t dir_block = 0; dir_block < pDesc->info_block->directory_tables; ++dir_block) {
-        if (file_entry != NULL)
-            break;
-        if (~pDesc->directory_table[dir_block].files_flags == 0)
-            continue;
-        for (uint32_t dir_position = 0; dir_position < FS_DIRECTORY_FILES; ++dir_position)
-            if (((~pDesc->directory_table[dir_block].files_flags) >> (dir_position)) & 1) {
-                file_entry = &pDesc->directory_table[dir_block].files[dir_position];
-                pDesc->directory_table[dir_block].files_flags |= (1 << dir_position);
-                break;
-            }
-    }
+    fprintf(pOut, "Files: \n");
+    return treeDirectory(pHandle, path, 0, &page);
+}
 
-    if (file_entry == NULL) {
-        if (createDirectoryBlock(pDesc) != ST_OK)
-            return ST_NOT_ENOUGH_SPACE;
-        FS_directory_table* dir = &pDesc->directory_table[pDesc->info_block->directory_tables - 1];
-        file_entry = &dir->files[0];
-        dir->files_flags |= 1;
-    }
+//Every entry of pPath, pLength bytes long, and those under its directories; each level holds its own page
+int treeDirectory(FS_handle* pHandle, char* pPath, size_t pLength, FS_list_page* pPage) {
+    FS_list_item* items = malloc(TREE_PAGE * sizeof(FS_list_item));
+    char after[PART_MAX + 1] = "";
+    uint32_t count;
+    int result;
 
-    file_entry->size = size;
-    file_entry->created = (uint64_t) time(NULL);
-    strcpy((char*) file_entry->name, pFilename);
-
-    uint32_t freeBlock;
-    FS_allocation_unit* fsUnit;
-    FS_allocation_unit* lastUnit = NULL;
-
-    while (size != 0) {
-        freeBlock = findBlock(pDesc, FS_FREE);
-        if (freeBlock == FS_ENDPOINT)
-            return ST_NOT_ENOUGH_SPACE;
-
-        fsUnit = &pDesc->allocation_table[freeBlock / FS_ALLOC_UNITS].units[freeBlock % FS_ALLOC_UNITS];
-        if (fsUnit->size > size) {
-            if (findBlock(pDesc, FS_UNUSED) == FS_ENDPOINT) {
-                if (createAllocationBlock(pDesc) != ST_OK)
-                    return ST_NOT_ENOUGH_SPACE;
-                freeBlock = findBlock(pDesc, FS_FREE);
-                if (freeBlock == FS_ENDPOINT)
-                    return ST_NOT_ENOUGH_SPACE;
-                fsUnit = &pDesc->allocation_table[freeBlock / FS_ALLOC_UNITS].units[freeBlock % FS_ALLOC_UNITS];
-            }
+    if (items == NULL)
+        return ST_NOT_ENOUGH_SPACE;
+    do {
+        pPage->items = items;
+        pPage->count = 0;
+        result = gfsListDir(pHandle, pPath, after, TREE_PAGE, pageEntry, pPage);
+        count = pPage->count;
+        for (uint32_t i = 0; i < count && result == ST_OK; ++i) {
+            printEntry(pPage, pPath, &items[i]);
+            if (!items[i].directory)
+                continue;
+            int length = snprintf(pPath + pLength, PATH_MAX - pLength, "%s%s", pLength > 0 ? "/" : "", items[i].name);
+            if (length < 0 || pLength + length >= PATH_MAX)
+                result = ST_NOT_VALID_FILE;
+            else
+                result = treeDirectory(pHandle, pPath, pLength + length, pPage);
+            pPath[pLength] = 0;
         }
+        if (count > 0)
+            memcpy(after, items[count - 1].name, sizeof(after));
+    } while (result == ST_OK && count == TREE_PAGE);
+    free(items);
+    return result;
+}
 
-        if (lastUnit != NULL)
-            lastUnit->next_block = freeBlock;
-        else
-            file_entry->block = freeBlock;
-
-        if (fsUnit->size > size) {
-            blockCopy(pDesc->drive, file, fsUnit, size, DIR_FROM_FILE);
-            uint32_t unusedBlock = findBlock(pDesc, FS_UNUSED);
-            FS_allocation_unit* unusedUnit = &pDesc->allocation_table[unusedBlock / FS_ALLOC_UNITS].units[unusedBlock %
-                                                                                                          FS_ALLOC_UNITS];
-            unusedUnit->type = FS_FREE;
-            unusedUnit->size = fsUnit->size - size;
-            unusedUnit->offset = fsUnit->offset + size;
-            unusedUnit->next_block = FS_ENDPOINT;
-            pDesc->allocation_table[unusedBlock / FS_ALLOC_UNITS].unused_units -= 1;
-            fsUnit->size = size;
-        } else {
-            blockCopy(pDesc->drive, file, fsUnit, fsUnit->size, DIR_FROM_FILE);
-        }
-
-        fsUnit->type = FS_OCCUPIED;
-        fsUnit->next_block = FS_ENDPOINT;
-        size -= fsUnit->size;
-        lastUnit = fsUnit;
+int pageEntry(const char* pName, uint64_t pSize, uint64_t pCreated, void* pContext) {
+    FS_list_page* page = pContext;
+    FS_list_item* item = &page->items[page->count++];
+    size_t length = strlen(pName);
+
+    item->directory = length > 0 && pName[length - 1] == '/';
+    snprintf(item->name, sizeof(item->name), "%.*s", (int) (length - item->directory), pName);
+    item->size = pSize;
+    item->created = pCreated;
+    return 0;
+}
+
+void printEntry(FS_list_page* pPage, const char* pPath, FS_list_item* pItem) {
+    const char* slash = pPath != NULL && pPath[0] != 0 ? "/" : "";
+
+    if (pPath == NULL)
+        pPath = "";
+    if (pItem->directory) {
+        fprintf(pPage->out, "%s%s%s/\n", pPath, slash, pItem->name);
+        return;
     }
-    saveDescriptors(pDesc);
-    fclose(file);
-    return ST_OK;
+    if ((time_t) pItem->created != pPage->created) {
+        struct tm local;
+        pPage->created = (time_t) pItem->created;
+        if (localtime_r(&pPage->created, &local) == NULL ||
+            strftime(pPage->time, sizeof(pPage->time), "%H:%M:%S %d-%m-%Y", &local) == 0)
+            pPage->time[0] = 0;
+    }
+    fprintf(pPage->out, "%s%s%s\t\t%llu bytes\t\t%s\n", pPath, slash, pItem->name, (unsigned long long) pItem->size,
+            pPage->time);
 }
 
-int getFile(FS_descriptors* pDesc, char* pDest, char* pFilename) {
-    FS_file_entry file;
-    FILE* dest;
-    uint32_t block;
+//BATCH: one session and one flush for every name, a failed file does not stop the rest
+int batch(FS_handle* pHandle, uint8_t pOp, char** pArgs, int pCount, char* pDest) {
+    char** names;
+    uint32_t total;
+    uint32_t failed = 0;
+    int result;
+
+    result = collectNames(pArgs, pCount, &names, &total);
+    if (names == NULL)
+        return result;
+
+    for (uint32_t i = 0; i < total; ++i) {
+        int status = batchItem(pHandle, pOp, names[i], pDest);
+        if (status != ST_OK) {
+            if (total > 1)
+                printf("%s: %s\n", names[i], resultMessage(status));
+            result = status;
+            failed += 1;
+        }
+    }
+    if (pOp != BATCH_GET && gfsFlush(pHandle) != ST_OK)
+        result = ST_IO_ERROR;
+    if (total > 1)
+        printf("Files: %u\tFailed: %u\n", total, failed);
+
+    for (uint32_t i = 0; i < total; ++i)
+        free(names[i]);
+    free(names);
+    return result;
+}
 
-    if (findFile(&file, NULL, pDesc, pFilename))
-        return ST_NOT_FOUND;
+int batchItem(FS_handle* pHandle, uint8_t pOp, char* pName, char* pDest) {
+    char path[PATH_MAX];
 
-    dest = fopen(pDest, "wb+");
-    if (dest == NULL)
+    if (pOp == BATCH_ADD)
+        return gfsAddFile(pHandle, pName);
+    if (pOp == BATCH_REMOVE)
+        return gfsRemove(pHandle, pName);
+    if (pOp == BATCH_MKDIR)
+        return gfsMakeDir(pHandle, pName);
+    if (snprintf(path, sizeof(path), "%s/%s", pDest, pName) >= (int) sizeof(path) || makeParents(path) != ST_OK)
         return ST_CANT_OPEN;
+    return gfsGetFile(pHandle, pName, path);
+}
 
-    block = file.block;
-    while (block != FS_ENDPOINT) {
-        FS_allocation_unit* unit = &pDesc->allocation_table[block / FS_ALLOC_UNITS].units[block % FS_ALLOC_UNITS];
-        blockCopy(pDesc->drive, dest, unit, unit->size, DIR_TO_FILE);
-        block = unit->next_block;
-    }
+//Expands "-" (stdin) and "@manifest" into one name per non-empty line; a missing manifest is reported and skipped
+int collectNames(char** pArgs, int pCount, char*** pNames, uint32_t* pTotal) {
+    char line[PATH_MAX];
+    uint32_t capacity = (uint32_t) pCount;
+    uint32_t total = 0;
+    int result = ST_OK;
+    char** names = malloc(capacity * sizeof(char*));
+
+    *pNames = names;
+    *pTotal = 0;
+    if (names == NULL)
+        return ST_NOT_ENOUGH_SPACE;
+    for (int arg = 0; arg < pCount; ++arg) {
+        FILE* list = NULL;
+        char* name = pArgs[arg];
+
+        if (!strcmp(pArgs[arg], "-"))
+            list = stdin;
+        else if (pArgs[arg][0] == '@' && (list = fopen(pArgs[arg] + 1, "r")) == NULL) {
+            printf("%s: %s\n", pArgs[arg], resultMessage(ST_CANT_OPEN));
+            result = ST_CANT_OPEN;
+            continue;
+        }
 
-    fclose(dest);
-    return ST_OK;
+        while (list == NULL || fgets(line, sizeof(line), list) != NULL) {
+            if (list != NULL) {
+                line[strcspn(line, "\r\n")] = 0;
+                if (line[0] == 0)
+                    continue;
+                name = line;
+            }
+            if (total == capacity) {
+                void* grown = realloc(names, capacity * 2 * sizeof(char*));
+                if (grown == NULL)
+                    break;
+                names = grown;
+                capacity *= 2;
+            }
+            if ((names[total] = strdup(name)) != NULL)
+                total += 1;
+            if (list == NULL)
+                break;
+        }
+        if (list != NULL && list != stdin)
+            fclose(list);
+    }
+    *pNames = names;
+    *pTotal = total;
+    return result;
 }
 
-int removeFile(FS_descriptors* pDesc, char* pFile) {
-    FS_file_entry file;
-    uint32_t file_idx;
+const char* resultMessage(int pResult) {
+    switch (pResult) {
+        case ST_OK:
+            return "OK.";
+        case ST_NOT_ENOUGH_SPACE:
+            return "Failed, not enough space on drive.";
+        case ST_NOT_VALID_FILE:
+            return "Specified file is not a valid file!";
+        case ST_CANT_OPEN:
+            return "Can not open the file!";
+        case ST_EXISTS:
+            return "File already exists!";
+        case ST_NOT_FOUND:
+            return "File not found!";
+        case ST_IO_ERROR:
+            return "I/O error!";
+        case ST_OLD_FORMAT:
+            return "Drive was made by an older version, create it again and add its files back!";
+        case ST_CORRUPT:
+            return "Drive is damaged, FS fsck tells where!";
+        case ST_NOT_EMPTY:
+            return "Directory is not empty!";
+        default:
+            return "Something strange happened!";
+    }
+}
 
-    if (findFile(&file, &file_idx, pDesc, pFile))
-        return ST_NOT_FOUND;
+//EXTRACT: every file of the drive into pDest, pThreads workers copying by offset side by side
+int extract(FS_handle* pHandle, char* pDest, uint32_t pThreads) {
+    FS_extract_job job = {pHandle, pDest, NULL, 0, 0, 0, 0, ST_OK};
+    pthread_t* workers;
+    uint32_t started = 0;
+    struct stat st;
 
-    uint32_t block = file.block;
-    while (block != FS_ENDPOINT) {
-        FS_allocation_unit* fileUnit = &pDesc->allocation_table[block / FS_ALLOC_UNITS].units[block % FS_ALLOC_UNITS];
-        fileUnit->type = FS_FREE;
-        while(defragBlock(pDesc, block) != FS_ENDPOINT);
-    block = fileUnit->next_block;
-}
+    if ((mkdir(pDest, 0777) != 0 && errno != EEXIST) || stat(pDest, &st) != 0 || !S_ISDIR(st.st_mode))
+        return ST_CANT_OPEN;
+    gfsList(pHandle, extractEntry, &job);
+    if (job.result != ST_OK) {
+        for (uint32_t i = 0; i < job.total; ++i)
+            free(job.names[i]);
+        free(job.names);
+        return job.result;
+    }
 
-pDesc->directory_table[file_idx / FS_DIRECTORY_FILES].files_flags &=
-~(1 << (file_idx % FS_DIRECTORY_FILES));
-//    if (pDesc->directory_table[file_idx / FS_DIRECTORY_FILES].files_flags == 0 && file_idx / FS_DIRECTORY_FILES > 0) {
-//        if (pDesc->directory_table[(file_idx / FS_DIRECTORY_FILES)].offset_next != FS_ENDPOINT)
-//            pDesc->directory_table[(file_idx / FS_DIRECTORY_FILES) - 1].offset_next = pDesc->directory_table[(file_idx / FS_DIRECTORY_FILES)].offset_next;
-//        pDesc->info_block->directory_tables -= 1;
-//        uint32_t offset = pDesc->directory_table[(file_idx / FS_DIRECTORY_FILES) - 1].offset_next;
-//        pDesc->directory_table[(file_idx / FS_DIRECTORY_FILES) - 1].offset_next = FS_ENDPOINT;
-//        pDesc->allocation_table[offset / FS_ALLOC_UNITS].units[offset % FS_ALLOC_UNITS].type = FS_FREE;
-//    }
-
-pDesc->info_block->free += file.
-size;
-saveDescriptors(pDesc);
-
-return ST_OK;
+    if (pThreads > job.total)
+        pThreads = job.total > 0 ? job.total : 1;
+    workers = malloc(pThreads * sizeof(pthread_t));
+    if (workers != NULL)
+        for (; started < pThreads; ++started)
+            if (pthread_create(&workers[started], NULL, extractWorker, &job) != 0)
+                break;
+    //no thread at all still gets the work done, on this one
+    if (started == 0)
+        extractWorker(&job);
+    for (uint32_t i = 0; i < started; ++i)
+        pthread_join(workers[i], NULL);
+    free(workers);
+
+    printf("Files: %u\tFailed: %u\n", job.total, job.failed);
+    for (uint32_t i = 0; i < job.total; ++i)
+        free(job.names[i]);
+    free(job.names);
+    return job.result;
 }
 
-int tree(FS_descriptors* pDesc) {
-    char time[20];
+int extractEntry(const char* pName, uint64_t pSize, uint64_t pCreated, void* pContext) {
+    FS_extract_job* job = pContext;
 
-    printf("Files: \n");
-    for (uint32_t block = 0; block < pDesc->info_block->directory_tables; ++block) {
-        FS_directory_table* directory = &pDesc->directory_table[block];
-        for (uint32_t file = 0; file < FS_DIRECTORY_FILES; ++file) {
-            if ((directory->files_flags >> file) & 1) {
-                strftime(time, 20, "%H:%M:%S %d-%m-%Y", localtime((const time_t*) &directory->files[file].created));
-                printf("%s\t\t%d bytes\t\t%s\n", directory->files[file].name, directory->files[file].size, time);
-            }
+    if (job->total == job->capacity) {
+        uint32_t capacity = job->capacity > 0 ? job->capacity * 2 : 256;
+        void* grown = realloc(job->names, capacity * sizeof(char*));
+        if (grown == NULL) {
+            job->result = ST_NOT_ENOUGH_SPACE;
+            return 1;
         }
+        job->names = grown;
+        job->capacity = capacity;
     }
-    return ST_OK;
+    if ((job->names[job->total] = strdup(pName)) == NULL) {
+        job->result = ST_NOT_ENOUGH_SPACE;
+        return 1;
+    }
+    job->total += 1;
+    return 0;
 }
 
-int status(FS_descriptors* pDesc) {
-    uint8_t version[6];
+void* extractWorker(void* pJob) {
+    FS_extract_job* job = pJob;
+    char path[PATH_MAX];
+    uint32_t item;
+
+    while ((item = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->total) {
+        char* name = job->names[item];
+        int status = ST_CANT_OPEN;
+
+        if (snprintf(path, sizeof(path), "%s/%s", job->dest, name) < (int) sizeof(path) && makeParents(path) == ST_OK)
+            status = gfsGetFile(job->handle, name, path);
+        if (status != ST_OK) {
+            printf("%s: %s\n", name, resultMessage(status));
+            __atomic_fetch_add(&job->failed, 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&job->result, status, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
 
-    memcpy(version, pDesc->info_block->version, 5);
-    version[5] = 0;
+//Creates the directories leading to pPath; names climbing out with ".." are refused
+int makeParents(char* pPath) {
+    if (strstr(pPath, "/../") != NULL || (strlen(pPath) >= 3 && !strcmp(pPath + strlen(pPath) - 3, "/..")))
+        return ST_CANT_OPEN;
+    for (char* slash = strchr(pPath + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        *slash = 0;
+        int made = mkdir(pPath, 0777) == 0 || errno == EEXIST;
+        *slash = '/';
+        if (!made)
+            return ST_CANT_OPEN;
+    }
+    return ST_OK;
+}
 
-    printf("GFS File System\n");
-    printf("API Version: %s\n", FS_VERSION);
+//SERVER: the drive stays loaded, mutations of one poll round share a single commit
+static volatile sig_atomic_t serving;
 
-    printf("\nINFO SECTION\n");
-    printf("VERSION: %s\nSIZE: %d\nFREE: %d\nALLOCATION TABLES: %d\nDIRECTORY TABLES: %d\n", version,
-           pDesc->info_block->size, pDesc->info_block->free, pDesc->info_block->allocation_tables,
-           pDesc->info_block->directory_tables);
+int serve(FS_handle* pHandle, char* pSocket) {
+    struct sockaddr_un address;
+    struct pollfd polls[FS_MAX_CLIENTS + 1];
+    FS_client clients[FS_MAX_CLIENTS];
+    struct sigaction action;
+    uint32_t count = 0;
+    int listener;
+    int spool;
 
+    if (strlen(pSocket) >= sizeof(address.sun_path))
+        return ST_CANT_OPEN;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, pSocket);
 
-    for (uint32_t i = 0; i < pDesc->info_block->allocation_tables; ++i) {
-        printf("\nALLOCATION SECTION %d\n", i);
-        printf("UNITS: %d\tUNUSED_UNITS: %d\tNEXT: %d\n", FS_ALLOC_UNITS, pDesc->allocation_table[i].unused_units,
-               pDesc->allocation_table[i].offset_next);
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0)
+        return ST_CANT_OPEN;
+    unlink(pSocket);
+    if (bind(listener, (struct sockaddr*) &address, sizeof(address)) != 0 || listen(listener, FS_MAX_CLIENTS) != 0) {
+        close(listener);
+        return ST_CANT_OPEN;
+    }
+    //added files are received here first, so a failed add never leaves a client's data half read
+    spool = memfd_create("gfs-spool", 0);
+    if (spool < 0) {
+        close(listener);
+        unlink(pSocket);
+        return ST_IO_ERROR;
     }
 
-    for (uint32_t i = 0; i < pDesc->info_block->directory_tables; ++i) {
-        printf("\nDIRECTORY SECTION %d\n", i);
-        printf("FLAGS: 0x%04x\tNEXT: %d\n", pDesc->directory_table[i].files_flags,
-               pDesc->directory_table[i].offset_next);
-
-        printf("%-4s %-20s %-5s %-5s\n", "ID", "NAME", "SIZE", "BLOCK");
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stopServing;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    serving = 1;
+    printf("Serving on %s\n", pSocket);
+    fflush(stdout);
+
+    while (serving) {
+        polls[0].fd = listener;
+        polls[0].events = POLLIN;
+        for (uint32_t i = 0; i < count; ++i) {
+            polls[i + 1].fd = clients[i].fd;
+            polls[i + 1].events = POLLIN;
+        }
+        if (poll(polls, count + 1, -1) < 0)
+            continue;
 
-        for (uint32_t file = 0; file < FS_DIRECTORY_FILES; ++file) {
-            if ((pDesc->directory_table[i].files_flags >> file) & 1)
-                printf("%-4d %-20s %-5d %-5d\n", file, pDesc->directory_table[i].files[file].name,
-                       pDesc->directory_table[i].files[file].size,
-                       pDesc->directory_table[i].files[file].block);
+        for (uint32_t i = 0; i < count; ++i) {
+            char next;
+            if (!polls[i + 1].revents)
+                continue;
+            //PIPELINE: take whatever this client already sent, up to one window
+            for (uint32_t handled = 0; handled < FS_PIPELINE; ++handled) {
+                if (handled > 0 && recv(clients[i].fd, &next, 1, MSG_PEEK | MSG_DONTWAIT) <= 0)
+                    break;
+                if (serveRequest(pHandle, clients, count, i, spool) != ST_OK) {
+                    fclose(clients[i].stream);
+                    clients[i].fd = -1;
+                    break;
+                }
+            }
         }
-    }
-    for (uint32_t i = 0; i < pDesc->info_block->allocation_tables; ++i) {
-        printf("\nDATA SECTION \n");
-        printf("%-6s %-16s %-10s %-6s %-6s\n", "TYPE", "BLOCK", "OFFSET", "SIZE", "NEXT");
-        for (uint32_t unit = 0; unit < FS_ALLOC_UNITS; ++unit) {
-            if (pDesc->allocation_table[i].units[unit].type & FS_SYSTEM) {
-                printf("%-6s %-3d[%3d, %3d]    0x%04x   %6d\n", "SYS", FS_ALLOC_UNITS * i + unit, i, unit,
-                       pDesc->allocation_table[i].units[unit].offset,
-                       pDesc->allocation_table[i].units[unit].size);
-
-            } else if (pDesc->allocation_table[i].units[unit].type & FS_FREE) {
-                printf("%-6s %-3d[%3d, %3d]    0x%04x   %6d\n", "FREE", FS_ALLOC_UNITS * i + unit, i, unit,
-                       pDesc->allocation_table[i].units[unit].offset,
-                       pDesc->allocation_table[i].units[unit].size);
-
-            } else if (pDesc->allocation_table[i].units[unit].type & FS_OCCUPIED) {
-                if (pDesc->allocation_table[i].units[unit].next_block != FS_ENDPOINT)
-                    printf("%-6s %-3d[%3d, %3d]    0x%04x   %6d %6d\n", "DATA", FS_ALLOC_UNITS * i + unit, i, unit,
-                           pDesc->allocation_table[i].units[unit].offset,
-                           pDesc->allocation_table[i].units[unit].size,
-                           pDesc->allocation_table[i].units[unit].next_block);
+        serveCommit(pHandle, clients, count);
+
+        //DROP closed clients, keeping the order of the rest
+        uint32_t kept = 0;
+        for (uint32_t i = 0; i < count; ++i)
+            if (clients[i].fd >= 0)
+                clients[kept++] = clients[i];
+        count = kept;
+
+        if (polls[0].revents & POLLIN) {
+            int fd = accept(listener, NULL, NULL);
+            if (fd >= 0 && count == FS_MAX_CLIENTS)
+                close(fd);
+            else if (fd >= 0) {
+                clients[count].fd = fd;
+                clients[count].stream = fdopen(fd, "r+");
+                clients[count].pending = 0;
+                if (clients[count].stream == NULL)
+                    close(fd);
                 else
-                    printf("%-6s %-3d[%3d, %3d]    0x%04x   %6d\n", "DATA", FS_ALLOC_UNITS * i + unit, i, unit,
-                           pDesc->allocation_table[i].units[unit].offset,
-                           pDesc->allocation_table[i].units[unit].size);
+                    count += 1;
             }
         }
     }
-    return ST_OK;
-}
 
-int findFile(FS_file_entry* pFile, uint32_t* pIndex, FS_descriptors* pDesc, char* pFilename) {
-    for (uint32_t block = 0; block < pDesc->info_block->directory_tables; ++block) {
-        for (uint32_t file = 0; file < FS_DIRECTORY_FILES; ++file) {
-            FS_directory_table* dir = &pDesc->directory_table[block];
-            if ((dir->files_flags >> file) & 1 && strcmp((const char*) dir->files[file].name, pFilename) == 0) {
-                if (pFile != NULL)
-                    *pFile = pDesc->directory_table[block].files[file];
-                if (pIndex != NULL)
-                    *pIndex = block * FS_DIRECTORY_FILES + file;
-                return ST_OK;
-            }
-        }
-    }
-    return ST_NOT_FOUND;
+    for (uint32_t i = 0; i < count; ++i)
+        fclose(clients[i].stream);
+    close(spool);
+    close(listener);
+    unlink(pSocket);
+    return gfsFlush(pHandle);
 }
 
-int loadDescriptors(FILE* pDrive, FS_descriptors* pDest) {
-    pDest->drive = pDrive;
-    pDest->info_block = malloc(sizeof(FS_info));
-    fread(pDest->info_block, sizeof(FS_info), 1, pDrive);
-
-    if (memcmp(pDest->info_block->magic, "GFS", 3)) {
-        free(pDest->info_block);
-        pDest->info_block = NULL;
-        pDest->allocation_table = NULL;
-        pDest->directory_table = NULL;
-        return ST_NOT_VALID_FILE;
+//Answers one request; anything but ST_OK means the connection is no longer usable
+int serveRequest(FS_handle* pHandle, FS_client* pClients, uint32_t pCount, uint32_t pClient, int pSpool) {
+    FS_client* client = &pClients[pClient];
+    FS_request request;
+    FS_response response = {ST_OK, 0};
+    char name[FS_MAX_REQUEST_NAME + 1];
+
+    if (readAll(client->fd, &request, sizeof(request)) != ST_OK || request.name_length > FS_MAX_REQUEST_NAME)
+        return ST_IO_ERROR;
+    if (readAll(client->fd, name, request.name_length) != ST_OK)
+        return ST_IO_ERROR;
+    name[request.name_length] = 0;
+
+    if (request.op == FS_OP_ADD || request.op == FS_OP_REMOVE) {
+        if (request.op == FS_OP_ADD) {
+            uint8_t buffer[65536];
+            FILE* spool;
+            uint64_t left = request.size;
+            if (ftruncate(pSpool, 0) != 0 || lseek(pSpool, 0, SEEK_SET) != 0)
+                return ST_IO_ERROR;
+            while (left > 0) {
+                size_t size = left > sizeof(buffer) ? sizeof(buffer) : left;
+                if (readAll(client->fd, buffer, size) != ST_OK || writeAll(pSpool, buffer, size) != ST_OK)
+                    return ST_IO_ERROR;
+                left -= size;
+            }
+            lseek(pSpool, 0, SEEK_SET);
+            spool = fdopen(dup(pSpool), "rb");
+            if (spool == NULL)
+                return ST_IO_ERROR;
+            response.status = gfsAddStream(pHandle, spool, request.size, name);
+            fclose(spool);
+        } else
+            response.status = gfsRemove(pHandle, name);
+        client->statuses[client->pending++] = response.status;
+        return ST_OK;
     }
 
-    pDest->allocation_table = malloc((1 + pDest->info_block->allocation_tables) * sizeof(FS_allocation_table));
-    pDest->directory_table = malloc((1 + pDest->info_block->directory_tables) * sizeof(FS_directory_table));
+    //READS see every earlier mutation committed first
+    serveCommit(pHandle, pClients, pCount);
 
-    fread(&pDest->allocation_table[0], sizeof(FS_allocation_table), 1, pDrive);
-    for (uint32_t i = 1; i < pDest->info_block->allocation_tables; ++i) {
-        uint32_t block = pDest->allocation_table[i - 1].offset_next;
-        uint32_t offset = pDest->allocation_table[block / FS_ALLOC_UNITS].units[block % FS_ALLOC_UNITS].offset;
-        fseek(pDrive, FS_DATA_OFFSET + offset, SEEK_SET);
-        fread(&pDest->allocation_table[i], sizeof(FS_allocation_table), 1, pDrive);
+    if (request.op == FS_OP_GET) {
+        response.status = gfsSize(pHandle, name, &response.size);
+        if (writeAll(client->fd, &response, sizeof(response)) != ST_OK)
+            return ST_IO_ERROR;
+        return response.status == ST_OK ? gfsGetStream(pHandle, name, client->stream) : ST_OK;
     }
-    fseek(pDrive, FS_DIRECTORY_OFFSET, SEEK_SET);
-
-    fread(&pDest->directory_table[0], sizeof(FS_directory_table), 1, pDrive);
-    for (uint32_t i = 1; i < pDest->info_block->directory_tables; ++i) {
-        uint32_t block = pDest->directory_table[i - 1].offset_next;
-        uint32_t offset = pDest->allocation_table[block / FS_ALLOC_UNITS].units[block % FS_ALLOC_UNITS].offset;
-        fseek(pDrive, FS_DATA_OFFSET + offset, SEEK_SET);
-        fread(&pDest->directory_table[i], sizeof(FS_directory_table), 1, pDrive);
-    }
-    return ST_OK;
-}
 
-int saveDescriptors(FS_descriptors* pDesc) {
-    FILE* drive = pDesc->drive;
-    fseek(drive, 0, SEEK_SET);
-    fwrite(pDesc->info_block, sizeof(FS_info), 1, drive);
-
-    fwrite(&pDesc->allocation_table[0], sizeof(FS_allocation_table), 1, drive);
-    for (uint32_t i = 1; i < pDesc->info_block->allocation_tables; ++i) {
-        uint32_t block = pDesc->allocation_table[i - 1].offset_next;
-        uint32_t offset = pDesc->allocation_table[block / FS_ALLOC_UNITS].units[block % FS_ALLOC_UNITS].offset;
-        fseek(drive, FS_DATA_OFFSET + offset, SEEK_SET);
-        fwrite(&pDesc->allocation_table[i], sizeof(FS_allocation_table), 1, drive);
+    if (request.op == FS_OP_TREE || request.op == FS_OP_STATUS || request.op == FS_OP_STATS) {
+        char* text = NULL;
+        size_t size = 0;
+        FILE* out = open_memstream(&text, &size);
+        if (out == NULL)
+            return ST_IO_ERROR;
+        if (request.op == FS_OP_TREE)
+            response.status = tree(pHandle, out);
+        else if (request.op == FS_OP_STATUS)
+            response.status = gfsStatus(pHandle, out);
+        else
+            response.status = gfsStats(pHandle, out, STATS_JSON);
+        fclose(out);
+        response.size = size;
+        int result = writeAll(client->fd, &response, sizeof(response));
+        if (result == ST_OK)
+            result = writeAll(client->fd, text, size);
+        free(text);
+        return result;
     }
 
-    fseek(drive, FS_DIRECTORY_OFFSET, SEEK_SET);
-    fwrite(&pDesc->directory_table[0], sizeof(FS_directory_table), 1, drive);
-    for (uint32_t i = 1; i < pDesc->info_block->directory_tables; ++i) {
-        uint32_t block = pDesc->directory_table[i - 1].offset_next;
-        uint32_t offset = pDesc->allocation_table[block / FS_ALLOC_UNITS].units[block % FS_ALLOC_UNITS].offset;
-        fseek(drive, FS_DATA_OFFSET + offset, SEEK_SET);
-        fwrite(&pDesc->directory_table[i], sizeof(FS_directory_table), 1, drive);
+    response.status = ST_INVALID_COMMAND;
+    return writeAll(client->fd, &response, sizeof(response));
+}
+
+//Group commit: one save for every held-back answer, which then reports its outcome
+void serveCommit(FS_handle* pHandle, FS_client* pClients, uint32_t pCount) {
+    uint32_t pending = 0;
+    int result;
+
+    for (uint32_t i = 0; i < pCount; ++i)
+        pending += pClients[i].pending;
+    if (pending == 0)
+        return;
+    result = gfsFlush(pHandle);
+
+    for (uint32_t i = 0; i < pCount; ++i) {
+        for (uint32_t answer = 0; answer < pClients[i].pending; ++answer) {
+            FS_response response = {result != ST_OK ? result : pClients[i].statuses[answer], 0};
+            if (pClients[i].fd >= 0)
+                writeAll(pClients[i].fd, &response, sizeof(response));
+        }
+        pClients[i].pending = 0;
     }
-    return ST_OK;
 }
 
-int discardDescriptors(FS_descriptors* pDest) {
-    if (pDest->info_block)
-        free(pDest->info_block);
-    if (pDest->allocation_table)
-        free(pDest->allocation_table);
-    if (pDest->directory_table)
-        free(pDest->directory_table);
-    return ST_OK;
+void stopServing(int pSignal) {
+    (void) pSignal;
+    serving = 0;
 }
 
-void blockCopy(FILE* pDrive, FILE* pFile, FS_allocation_unit* pUnit, uint32_t pSize, uint8_t pDirection) {
-    uint8_t buf[1024];
-    fseek(pDrive, FS_DATA_OFFSET + pUnit->offset, SEEK_SET);
-    while (pSize > 0) {
-        uint32_t size;
-        if (pSize > 1024) size = 1024;
-        else size = pSize;
-        if (pDirection == DIR_FROM_FILE) {
-            fread(buf, sizeof(uint8_t), size, pFile);
-            fwrite(buf, sizeof(uint8_t), size, pDrive);
-        } else if (pDirection == DIR_TO_FILE) {
-            fread(buf, sizeof(uint8_t), size, pDrive);
-            fwrite(buf, sizeof(uint8_t), size, pFile);
-        }
-        pSize -= size;
+//CLIENT: the same commands sent to a server, up to FS_PIPELINE requests in flight
+int client(char* pSocket, char* pCommand, char** pArgs, int pCount) {
+    struct sockaddr_un address;
+    FS_response response;
+    char** names = NULL;
+    uint32_t total = 0;
+    uint32_t failed = 0;
+    uint32_t queue[FS_PIPELINE];
+    uint32_t head = 0;
+    uint32_t inflight = 0;
+    uint32_t sent = 0;
+    char* destDir = NULL;
+    char* destFile = NULL;
+    uint8_t op;
+    int result = ST_OK;
+    int fd;
+
+    if (!strcmp(pCommand, "add"))
+        op = FS_OP_ADD;
+    else if (!strcmp(pCommand, "get"))
+        op = FS_OP_GET;
+    else if (!strcmp(pCommand, "remove"))
+        op = FS_OP_REMOVE;
+    else if (!strcmp(pCommand, "tree"))
+        op = FS_OP_TREE;
+    else if (!strcmp(pCommand, "status"))
+        op = FS_OP_STATUS;
+    else if (!strcmp(pCommand, "stats"))
+        op = FS_OP_STATS;
+    else {
+        printf("%s is not available through a server\n", pCommand);
+        return ST_INVALID_COMMAND;
     }
-}
 
-int createAllocationBlock(FS_descriptors* pDesc) {
-    uint32_t freeBlock = findBlockSize(pDesc, FS_FREE, sizeof(FS_allocation_table));
-    if (freeBlock == FS_ENDPOINT)
-        return ST_NOT_ENOUGH_SPACE;
+    if (op == FS_OP_GET) {
+        struct stat st;
+        if (pCount < 2) {
+            printf("Provide correct arguments:\n");
+            printf("FS get <socket> <filename>... <destination>\n");
+            return ST_INVALID_COMMAND;
+        }
+        pCount -= 1;
+        if (stat(pArgs[pCount], &st) == 0 && S_ISDIR(st.st_mode))
+            destDir = pArgs[pCount];
+        else if (pCount == 1 && strcmp(pArgs[0], "-") && pArgs[0][0] != '@')
+            destFile = pArgs[pCount];
+        else {
+            printf("Destination of many files must be a directory!\n");
+            return ST_INVALID_COMMAND;
+        }
+    } else if ((op == FS_OP_ADD || op == FS_OP_REMOVE) && pCount < 1) {
+        printf("Provide correct arguments:\n");
+        printf("FS %s <socket> <filename>... | - | @manifest\n", pCommand);
+        return ST_INVALID_COMMAND;
+    }
 
-    memset(&pDesc->allocation_table[pDesc->info_block->allocation_tables], FS_UNUSED, sizeof(FS_allocation_table));
+    if (strlen(pSocket) >= sizeof(address.sun_path))
+        return ST_CANT_OPEN;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, pSocket);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*) &address, sizeof(address)) != 0) {
+        if (fd >= 0)
+            close(fd);
+        return ST_CANT_OPEN;
+    }
+    signal(SIGPIPE, SIG_IGN);
 
-    FS_allocation_unit* freeUnit = &pDesc->allocation_table[freeBlock / FS_ALLOC_UNITS].units[freeBlock %
-                                                                                              FS_ALLOC_UNITS];
-    FS_allocation_unit* newUnit = &pDesc->allocation_table[pDesc->info_block->allocation_tables].units[0];
+    //TEXT COMMANDS
+    if (op == FS_OP_TREE || op == FS_OP_STATUS || op == FS_OP_STATS) {
+        fflush(stdout);
+        if (clientSend(fd, op, NULL) != ST_OK || clientReceive(fd, stdout, &response) != ST_OK)
+            result = ST_IO_ERROR;
+        else
+            result = response.status;
+        close(fd);
+        return result;
+    }
 
+    result = collectNames(pArgs, pCount, &names, &total);
+    if (names == NULL) {
+        close(fd);
+        return result;
+    }
 
-    newUnit->type = FS_FREE;
-    newUnit->size = freeUnit->size - sizeof(FS_allocation_table);
-    newUnit->next_block = FS_ENDPOINT;
-    newUnit->offset = freeUnit->offset + sizeof(FS_allocation_table);
-    freeUnit->type = FS_SYSTEM;
-    freeUnit->size = sizeof(FS_allocation_table);
+    while (sent < total || inflight > 0) {
+        //FILL THE WINDOW, a file that can not be read locally fails without a round trip
+        while (sent < total && inflight < FS_PIPELINE) {
+            int status = clientSend(fd, op, names[sent]);
+            if (status == ST_CANT_OPEN) {
+                if (total > 1)
+                    printf("%s: %s\n", names[sent], resultMessage(status));
+                result = status;
+                failed += 1;
+            } else if (status != ST_OK) {
+                sent = total;
+                inflight = 0;
+                result = ST_IO_ERROR;
+                break;
+            } else
+                queue[(head + inflight++) % FS_PIPELINE] = sent;
+            sent += 1;
+        }
+        if (inflight == 0)
+            break;
 
-    printf("NEW ALLOc: %d\n", freeBlock);
-    pDesc->allocation_table[pDesc->info_block->allocation_tables].offset_next = FS_ENDPOINT;
-    pDesc->allocation_table[pDesc->info_block->allocation_tables].unused_units = FS_ALLOC_UNITS - 1;
-    pDesc->allocation_table[pDesc->info_block->allocation_tables - 1].offset_next = freeBlock;
-    pDesc->info_block->allocation_tables += 1;
-    return ST_OK;
-}
+        uint32_t item = queue[head];
+        FILE* dest = NULL;
+        head = (head + 1) % FS_PIPELINE;
+        inflight -= 1;
+        if (op == FS_OP_GET) {
+            char path[PATH_MAX];
+            if (destDir != NULL)
+                snprintf(path, sizeof(path), "%s/%s", destDir, names[item]);
+            else
+                snprintf(path, sizeof(path), "%s", destFile);
+            if (destDir == NULL || makeParents(path) == ST_OK)
+                dest = fopen(path, "wb");
+        }
+        int received = clientReceive(fd, dest, &response);
+        if (dest != NULL)
+            fclose(dest);
+        if (received != ST_OK) {
+            result = ST_IO_ERROR;
+            break;
+        }
+        if (op == FS_OP_GET && dest == NULL && response.status == ST_OK)
+            response.status = ST_CANT_OPEN;
+
+        if (response.status != ST_OK) {
+            if (total > 1)
+                printf("%s: %s\n", names[item], resultMessage(response.status));
+            result = response.status;
+            failed += 1;
+        }
+    }
+    if (total > 1)
+        printf("Files: %u\tFailed: %u\n", total, failed);
 
-int createDirectoryBlock(FS_descriptors* pDesc) {
-    uint32_t nextBlock = allocateSystemBlock(pDesc, sizeof(FS_directory_table));
-    if (nextBlock == FS_ENDPOINT)
-        return ST_NOT_ENOUGH_SPACE;
-    printf("AHA: %d\n", nextBlock);
-    memset(&pDesc->directory_table[pDesc->info_block->directory_tables], 0, sizeof(FS_directory_table));
-    pDesc->directory_table[pDesc->info_block->directory_tables].offset_next = FS_ENDPOINT;
-    pDesc->directory_table[pDesc->info_block->directory_tables - 1].offset_next = nextBlock;
-    pDesc->info_block->directory_tables += 1;
-    return ST_OK;
+    close(fd);
+    for (uint32_t i = 0; i < total; ++i)
+        free(names[i]);
+    free(names);
+    return result;
 }
 
-uint32_t allocateSystemBlock(FS_descriptors* pDesc, uint32_t pSize) {
-    uint32_t block;
-    uint32_t unusedBlock;
-    FS_allocation_unit* unit;
-    FS_allocation_unit* unusedUnit;
-
-    if (pSize > pDesc->info_block->size)
-        return FS_ENDPOINT;
+//Sends one request; for FS_OP_ADD pName is also the local file whose contents follow
+int clientSend(int pSocket, uint8_t pOp, char* pName) {
+    FS_request request = {pOp, 0, 0, 0};
+    size_t length = pName != NULL ? strlen(pName) : 0;
+    int file = -1;
+    int result;
 
-    block = findBlockSize(pDesc, FS_FREE, pSize);
-    if (block == FS_ENDPOINT) {
-        //TODO: DEFRAG
-        return FS_ENDPOINT;
+    if (length > FS_MAX_REQUEST_NAME)
+        return ST_CANT_OPEN;
+    request.name_length = (uint16_t) length;
+    if (pOp == FS_OP_ADD) {
+        struct stat st;
+        file = open(pName, O_RDONLY);
+        if (file < 0 || fstat(file, &st) != 0) {
+            if (file >= 0)
+                close(file);
+            return ST_CANT_OPEN;
+        }
+        request.size = (uint64_t) st.st_size;
     }
 
-    unit = &pDesc->allocation_table[block / FS_ALLOC_UNITS].units[block % FS_ALLOC_UNITS];
-    unit->type = FS_SYSTEM;
-    unit->next_block = FS_ENDPOINT;
-    if (unit->size > pSize) {
-        unusedBlock = findBlock(pDesc, FS_UNUSED);
-        if (unusedBlock == FS_ENDPOINT) {
-            if (createAllocationBlock(pDesc) != ST_OK)
-                return FS_ENDPOINT;
-            unusedUnit = &pDesc->allocation_table[pDesc->info_block->allocation_tables - 1].units[0];
-        } else {
-            unusedUnit = &pDesc->allocation_table[unusedBlock / FS_ALLOC_UNITS].units[unusedBlock % FS_ALLOC_UNITS];
-        }
-
-        unusedUnit->type = FS_FREE;
-        unusedUnit->size = unit->size - pSize;
-        unusedUnit->next_block = FS_ENDPOINT;
-        unusedUnit->offset = unit->offset + pSize;
+    result = writeAll(pSocket, &request, sizeof(request));
+    if (result == ST_OK)
+        result = writeAll(pSocket, pName, length);
+    for (uint64_t left = request.size; result == ST_OK && left > 0;) {
+        ssize_t done = sendfile(pSocket, file, NULL, left);
+        if (done <= 0)
+            result = ST_IO_ERROR;
+        else
+            left -= (uint64_t) done;
     }
-    unit->size = pSize;
-    pDesc->info_block->free -= pSize;
-    return block;
+    if (file >= 0)
+        close(file);
+    return result;
 }
 
-uint32_t findBlock(FS_descriptors* pDesc, uint8_t pType) {
-    for (uint32_t block = 0; block < pDesc->info_block->allocation_tables; ++block) {
-        for (uint32_t unit = 0; unit < FS_ALLOC_UNITS; ++unit) {
-            FS_allocation_unit* fsUnit = &pDesc->allocation_table[block].units[unit];
-            if (fsUnit->type == pType)
-                return block * FS_ALLOC_UNITS + unit;
-        }
+//Reads one response, its data goes to pDest or is dropped when pDest is NULL
+int clientReceive(int pSocket, FILE* pDest, FS_response* pResponse) {
+    uint8_t buffer[65536];
+    uint64_t left;
+
+    if (readAll(pSocket, pResponse, sizeof(FS_response)) != ST_OK)
+        return ST_IO_ERROR;
+    left = pResponse->size;
+    while (left > 0) {
+        size_t size = left > sizeof(buffer) ? sizeof(buffer) : left;
+        if (readAll(pSocket, buffer, size) != ST_OK)
+            return ST_IO_ERROR;
+        if (pDest != NULL && fwrite(buffer, 1, size, pDest) != size)
+            pDest = NULL;
+        left -= size;
     }
-    return FS_ENDPOINT;
+    return ST_OK;
 }
 
-uint32_t findBlockSize(FS_descriptors* pDesc, uint8_t pType, uint32_t pSize) {
-    for (uint32_t block = 0; block < pDesc->info_block->allocation_tables; ++block) {
-        for (uint32_t unit = 0; unit < FS_ALLOC_UNITS; ++unit) {
-            FS_allocation_unit* fsUnit = &pDesc->allocation_table[block].units[unit];
-            if (fsUnit->type == pType && fsUnit->size >= pSize)
-                return block * FS_ALLOC_UNITS + unit;
-        }
+int readAll(int pFd, void* pData, size_t pSize) {
+    uint8_t* data = pData;
+    while (pSize > 0) {
+        ssize_t done = read(pFd, data, pSize);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0)
+            return ST_IO_ERROR;
+        data += done;
+        pSize -= (size_t) done;
     }
-    return FS_ENDPOINT;
-}
-
-size_t fsize(FILE* pFile) {
-    size_t size;
-    fpos_t pos;
-    fgetpos(pFile, &pos);
-    fseek(pFile, 0, SEEK_END);
-    size = (uint32_t) ftell(pFile);
-    fsetpos(pFile, &pos);
-    return size;
+    return ST_OK;
 }
 
-uint32_t defragBlock(FS_descriptors* pDesc, uint32_t pBlock) {
-    uint8_t flag = 0;
-    FS_allocation_unit* fileUnit = &pDesc->allocation_table[pBlock / FS_ALLOC_UNITS].units[pBlock % FS_ALLOC_UNITS];
-    for (uint32_t adjBlock = 0; adjBlock < pDesc->info_block->allocation_tables; ++adjBlock) {
-        if (flag & 0x03) break;
-        for (uint32_t adjUnit = 0; adjUnit < FS_ALLOC_UNITS; ++adjUnit) {
-            FS_allocation_unit* unit = &pDesc->allocation_table[adjBlock].units[adjUnit];
-            if (flag & 0x03) break;
-            if (unit->type == FS_FREE) {
-                //LEFT:
-                if (fileUnit->offset == unit->offset + unit->size) {
-                    fileUnit->type = FS_UNUSED;
-                    unit->size += fileUnit->size;
-                    pDesc->allocation_table[pBlock / FS_ALLOC_UNITS].unused_units += 1;
-                    flag |= 0x01;
-                    fileUnit = unit;
-                    pBlock = adjBlock * FS_ALLOC_UNITS + adjUnit;
-                }
-                //RIGHT:
-                if (fileUnit->offset + fileUnit->size == unit->offset) {
-                    unit->type = FS_UNUSED;
-                    fileUnit->size += unit->size;
-                    pDesc->allocation_table[adjBlock / FS_ALLOC_UNITS].unused_units += 1;
-                    flag |= 0x02;
-                }
-            }
-        }
+int writeAll(int pFd, const void* pData, size_t pSize) {
+    const uint8_t* data = pData;
+    while (pSize > 0) {
+        ssize_t done = write(pFd, data, pSize);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0)
+            return ST_IO_ERROR;
+        data += done;
+        pSize -= (size_t) done;
     }
-    if (flag == 0)
-        return FS_ENDPOINT;
-    return pBlock;
-}
\ No newline at end of file
+    return ST_OK;
+}
@@ -0,0 +1,157 @@
+#include <string.h>
+#include <time.h>
+#include "gfs.h"
+#include "metrics.h"
+
+static const char* phaseNames[FS_METRIC_PHASES] = {"open", "add", "read", "remove", "list", "flush", "defrag",
+                                                   "scrub", "mkdir", "load", "find", "allocate", "merge", "save",
+                                                   "sync", "copy"};
+static const char* counterNames[FS_METRIC_COUNTERS] = {"tables", "units", "read", "written", "syscalls"};
+static __thread FS_metric_frame frame;
+
+//First n with pNanos under 2^n
+static uint32_t bucketOf(uint64_t pNanos) {
+    uint32_t bucket = pNanos == 0 ? 0 : 64 - (uint32_t) __builtin_clzll(pNanos);
+
+    return bucket < FS_METRIC_BUCKETS ? bucket : FS_METRIC_BUCKETS - 1;
+}
+
+static void record(FS_metric* pMetric, uint64_t pNanos) {
+    pMetric->calls += 1;
+    pMetric->nanos += pNanos;
+    pMetric->buckets[bucketOf(pNanos)] += 1;
+    if (pNanos > pMetric->max)
+        pMetric->max = pNanos;
+}
+
+//Upper bound of the bucket holding the call at pShare of all, at most the slowest call, in nanoseconds
+static uint64_t percentile(FS_metric* pMetric, double pShare) {
+    uint64_t seen = 0;
+
+    for (uint32_t bucket = 0; bucket < FS_METRIC_BUCKETS; ++bucket) {
+        seen += pMetric->buckets[bucket];
+        if (seen > 0 && (double) seen >= pShare * (double) pMetric->calls)
+            return bucket == FS_METRIC_BUCKETS - 1 || (1ull << bucket) > pMetric->max ? pMetric->max : 1ull << bucket;
+    }
+    return 0;
+}
+
+uint64_t metricClock(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + (uint64_t) now.tv_nsec;
+}
+
+uint64_t metricBegin(void) {
+    for (uint32_t phase = 0; phase < FS_METRIC_PHASES; ++phase)
+        if ((frame.touched >> phase) & 1)
+            memset(&frame.phases[phase], 0, sizeof(FS_metric));
+    memset(frame.counters, 0, sizeof(frame.counters));
+    frame.touched = 0;
+    return metricClock();
+}
+
+void metricTime(uint8_t pPhase, uint64_t pStart) {
+    record(&frame.phases[pPhase], metricClock() - pStart);
+    frame.touched |= 1u << pPhase;
+}
+
+void metricCount(uint8_t pCounter, uint64_t pAmount) {
+    frame.counters[pCounter] += pAmount;
+}
+
+void metricEnd(FS_metrics* pMetrics, uint8_t pOperation, uint64_t pStart, const char* pName) {
+    metricTime(pOperation, pStart);
+    pthread_mutex_lock(&pMetrics->lock);
+    for (uint32_t phase = 0; phase < FS_METRIC_PHASES; ++phase) {
+        FS_metric* into = &pMetrics->phases[phase];
+        FS_metric* from = &frame.phases[phase];
+        if (!((frame.touched >> phase) & 1))
+            continue;
+        into->calls += from->calls;
+        into->nanos += from->nanos;
+        if (from->max > into->max)
+            into->max = from->max;
+        for (uint32_t bucket = 0, top = bucketOf(from->max); bucket <= top; ++bucket)
+            into->buckets[bucket] += from->buckets[bucket];
+    }
+    for (uint32_t counter = 0; counter < FS_METRIC_COUNTERS; ++counter)
+        pMetrics->counters[counter] += frame.counters[counter];
+
+    //TRACE: the operation, where its time went and what it cost
+    if (pMetrics->trace != NULL) {
+        fprintf(pMetrics->trace, "TRACE %s %s %.1f us |", phaseNames[pOperation], pName != NULL ? pName : "-",
+                (double) frame.phases[pOperation].nanos / 1000);
+        for (uint32_t phase = METRIC_OPERATIONS; phase < FS_METRIC_PHASES; ++phase)
+            if ((frame.touched >> phase) & 1)
+                fprintf(pMetrics->trace, " %s %.1f", phaseNames[phase], (double) frame.phases[phase].nanos / 1000);
+        fprintf(pMetrics->trace, " |");
+        for (uint32_t counter = 0; counter < FS_METRIC_COUNTERS; ++counter)
+            fprintf(pMetrics->trace, " %s %llu", counterNames[counter], (unsigned long long) frame.counters[counter]);
+        fprintf(pMetrics->trace, "\n");
+    }
+    pthread_mutex_unlock(&pMetrics->lock);
+}
+
+int metricInit(FS_metrics* pMetrics) {
+    memset(pMetrics->phases, 0, sizeof(pMetrics->phases));
+    memset(pMetrics->counters, 0, sizeof(pMetrics->counters));
+    pMetrics->trace = NULL;
+    return pthread_mutex_init(&pMetrics->lock, NULL) == 0 ? ST_OK : ST_NOT_ENOUGH_SPACE;
+}
+
+void metricRelease(FS_metrics* pMetrics) {
+    pthread_mutex_destroy(&pMetrics->lock);
+}
+
+void metricWrite(FS_metrics* pMetrics, FILE* pOut, uint8_t pFormat) {
+    FS_metric phases[FS_METRIC_PHASES];
+    uint64_t counters[FS_METRIC_COUNTERS];
+
+    pthread_mutex_lock(&pMetrics->lock);
+    memcpy(phases, pMetrics->phases, sizeof(phases));
+    memcpy(counters, pMetrics->counters, sizeof(counters));
+    pthread_mutex_unlock(&pMetrics->lock);
+
+    if (pFormat == STATS_TEXT) {
+        fprintf(pOut, "%-10s %10s %12s %10s %10s %10s %10s\n", "PHASE", "CALLS", "TOTAL MS", "AVG US", "P50 US",
+                "P99 US", "MAX US");
+        for (uint32_t phase = 0; phase < FS_METRIC_PHASES; ++phase) {
+            FS_metric* metric = &phases[phase];
+            if (metric->calls == 0)
+                continue;
+            fprintf(pOut, "%-10s %10llu %12.3f %10.1f %10.1f %10.1f %10.1f\n", phaseNames[phase],
+                    (unsigned long long) metric->calls, (double) metric->nanos / 1e6,
+                    (double) metric->nanos / 1e3 / (double) metric->calls, (double) percentile(metric, 0.5) / 1e3,
+                    (double) percentile(metric, 0.99) / 1e3, (double) metric->max / 1e3);
+        }
+        for (uint32_t counter = 0; counter < FS_METRIC_COUNTERS; ++counter)
+            fprintf(pOut, "%s%s %llu", counter == 0 ? "COUNTERS: " : ", ", counterNames[counter],
+                    (unsigned long long) counters[counter]);
+        fprintf(pOut, "\n");
+        return;
+    }
+
+    //JSON: histogram[n] counts calls under 2^n nanoseconds, cut after the last one that is not empty
+    fprintf(pOut, "{\"phases\": {");
+    for (uint32_t phase = 0; phase < FS_METRIC_PHASES; ++phase) {
+        FS_metric* metric = &phases[phase];
+        uint32_t used = FS_METRIC_BUCKETS;
+        while (used > 0 && metric->buckets[used - 1] == 0)
+            --used;
+        fprintf(pOut, "%s\"%s\": {\"calls\": %llu, \"total_ns\": %llu, \"max_ns\": %llu, \"p50_ns\": %llu, "
+                      "\"p99_ns\": %llu, \"histogram\": [", phase == 0 ? "" : ", ", phaseNames[phase],
+                (unsigned long long) metric->calls, (unsigned long long) metric->nanos,
+                (unsigned long long) metric->max, (unsigned long long) percentile(metric, 0.5),
+                (unsigned long long) percentile(metric, 0.99));
+        for (uint32_t bucket = 0; bucket < used; ++bucket)
+            fprintf(pOut, "%s%llu", bucket == 0 ? "" : ", ", (unsigned long long) metric->buckets[bucket]);
+        fprintf(pOut, "]}");
+    }
+    fprintf(pOut, "}, \"counters\": {");
+    for (uint32_t counter = 0; counter < FS_METRIC_COUNTERS; ++counter)
+        fprintf(pOut, "%s\"%s\": %llu", counter == 0 ? "" : ", ", counterNames[counter],
+                (unsigned long long) counters[counter]);
+    fprintf(pOut, "}}\n");
+}
@@ -0,0 +1,56 @@
+#ifndef FS_METRICS_H
+#define FS_METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "descriptors.h"
+
+//PHASES: the public operations, then the work inside them; SAVE includes SYNC, operations include everything
+#define METRIC_OPEN 0
+#define METRIC_ADD 1
+#define METRIC_READ 2       //gfsRead, gfsPread and every get
+#define METRIC_REMOVE 3
+#define METRIC_LIST 4
+#define METRIC_FLUSH 5
+#define METRIC_DEFRAG 6
+#define METRIC_SCRUB 7
+#define METRIC_MKDIR 8
+#define METRIC_OPERATIONS 9
+#define METRIC_LOAD 9       //loadDescriptors
+#define METRIC_FIND 10      //findFile
+#define METRIC_ALLOCATE 11  //pickBlock
+#define METRIC_MERGE 12     //free neighbours merged as a block is released
+#define METRIC_SAVE 13      //saveDescriptors
+#define METRIC_SYNC 14      //fdatasync and msync
+#define METRIC_COPY 15      //data moved between the drive and a file, a buffer or itself
+
+//COUNTERS
+#define COUNT_TABLES 0      //directory tables scanned entry by entry and B+tree nodes searched
+#define COUNT_UNITS 1       //allocation units looked at
+#define COUNT_READ 2        //bytes read from the drive
+#define COUNT_WRITTEN 3     //bytes written to it
+#define COUNT_SYSCALLS 4    //issued for the drive; a stdio call counts as one
+
+//CLOCK_MONOTONIC nanoseconds
+uint64_t metricClock(void);
+
+//Starts a new operation on this thread, returns its start
+uint64_t metricBegin(void);
+
+//Adds the time since pStart to pPhase of this thread's operation
+void metricTime(uint8_t pPhase, uint64_t pStart);
+
+void metricCount(uint8_t pCounter, uint64_t pAmount);
+
+//Ends this thread's operation: merges it into pMetrics and traces it as pOperation on pName
+void metricEnd(FS_metrics* pMetrics, uint8_t pOperation, uint64_t pStart, const char* pName);
+
+int metricInit(FS_metrics* pMetrics);
+
+void metricRelease(FS_metrics* pMetrics);
+
+//Every phase and counter, STATS_TEXT or STATS_JSON
+void metricWrite(FS_metrics* pMetrics, FILE* pOut, uint8_t pFormat);
+
+#endif //FS_METRICS_H
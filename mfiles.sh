@@ -3,7 +3,9 @@
 x=0
 while [ ${x} -le $2 ] ; do
 dd if=/dev/urandom of=dummy${x} bs=1 count=1
-./FS add $1 dummy${x}
-rm dummy${x}
+echo dummy${x}
 x=$((x+1))
-done
+done > dummy.list
+./FS add $1 @dummy.list
+xargs rm < dummy.list
+rm dummy.list
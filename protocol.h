@@ -0,0 +1,36 @@
+#ifndef FS_PROTOCOL_H
+#define FS_PROTOCOL_H
+
+#define FS_OP_ADD 0x01
+#define FS_OP_GET 0x02
+#define FS_OP_REMOVE 0x03
+#define FS_OP_TREE 0x04
+#define FS_OP_STATUS 0x05
+#define FS_OP_STATS 0x06
+
+#define FS_MAX_CLIENTS 64
+#define FS_PIPELINE 64      //requests a client keeps in flight, and a server takes from one client per round
+#define FS_MAX_REQUEST_NAME 4096
+
+//followed by name_length bytes of name, then size bytes of data for FS_OP_ADD
+typedef struct {
+    uint8_t op;
+    uint8_t reserved;
+    uint16_t name_length;
+    uint64_t size;
+} FS_request;
+
+//followed by size bytes of file data (FS_OP_GET) or text (FS_OP_TREE, FS_OP_STATUS, FS_OP_STATS)
+typedef struct {
+    int32_t status;
+    uint64_t size;
+} FS_response;
+
+typedef struct {
+    int fd;
+    FILE* stream;       //same socket, for gfsGetStream
+    uint32_t pending;   //answers held back until the round's commit
+    int32_t statuses[FS_PIPELINE];
+} FS_client;
+
+#endif //FS_PROTOCOL_H
@@ -0,0 +1,33 @@
+#!/usr/bin/env bash
+# Adds log-like text files with and without --compress and reports the space they take and the time of an add
+# and a get of all of them.
+# Usage: ./bench_compress.sh [files] [file size]   (run from the directory containing FS)
+
+total=${1:-200}
+size=${2:-262144}
+
+mkdir bench.src
+for i in $(seq 1 $total); do
+    seq -f "%g INFO request served in 12 ms from 10.0.0.1 path /api/v1/items" $((i * 1000)) $((i * 1000 + size / 40)) |
+        head -c $size > bench.src/log$i
+done
+
+printf "%-12s %-12s %-12s %-12s\n" "MODE" "USED BYTES" "ADD MS" "GET MS"
+for mode in "" --compress ; do
+mkdir -p bench.out/bench.src
+./FS create bench.fs $((total * size + 1048576)) >> /dev/null
+
+start=$(date +%s%N)
+ls bench.src/log* | ./FS add bench.fs - $mode >> /dev/null
+middle=$(date +%s%N)
+ls bench.src/log* | ./FS get bench.fs - bench.out >> /dev/null
+end=$(date +%s%N)
+
+free=$(./FS status bench.fs | grep "^FREE:" | awk '{print $2}')
+printf "%-12s %-12s %-12s %-12s\n" ${mode:-plain} $((total * size + 1048576 - free)) \
+    $(( (middle - start) / 1000000 )) $(( (end - middle) / 1000000 ))
+cmp -s bench.src/log1 bench.out/bench.src/log1 || echo "log1 differs after get"
+rm -r bench.fs bench.out
+done
+
+rm -r bench.src
@@ -0,0 +1,34 @@
+#!/usr/bin/env bash
+# Measures add/get throughput for large payloads.
+# Usage: ./bench_copy.sh [payload sizes in MB...]   (run from the directory containing FS)
+
+sizes="$@"
+if [ -z "$sizes" ] ; then
+sizes="1 100 1024"
+fi
+
+rate() {
+awk "BEGIN {t = $3 - $2; if (t <= 0) t = 0.000001; printf \"%.3fs %10.1f MB/s\", t, $1 / t}"
+}
+
+printf "%-10s %-30s %-30s\n" "PAYLOAD" "ADD" "GET"
+for mb in $sizes
+do
+dd if=/dev/urandom of=payload bs=1M count=$mb 2>> /dev/null
+./FS create bench.fs $((mb * 1048576 + 1048576)) >> /dev/null
+sync
+
+start=$(date +%s.%N)
+./FS add bench.fs payload >> /dev/null
+end=$(date +%s.%N)
+add=$(rate $mb $start $end)
+
+start=$(date +%s.%N)
+./FS get bench.fs payload payload.out >> /dev/null
+end=$(date +%s.%N)
+get=$(rate $mb $start $end)
+
+cmp -s payload payload.out || echo "payload mismatch for ${mb} MB!"
+printf "%-10s %-30s %-30s\n" "${mb}MB" "$add" "$get"
+rm payload payload.out bench.fs
+done
@@ -0,0 +1,22 @@
+#!/usr/bin/env bash
+# Compares image creation time of the sparse, prealloc and zero modes.
+# Usage: ./bench_create.sh [sizes...]   (run from the directory containing FS)
+
+sizes="$@"
+if [ -z "$sizes" ] ; then
+sizes="1048576 16777216 268435456 1073741824 4294967295"
+fi
+
+printf "%-12s %-10s %-10s %-12s\n" "SIZE" "MODE" "SECONDS" "DISK USAGE"
+for size in $sizes
+do
+for mode in sparse prealloc zero
+do
+start=$(date +%s.%N)
+./FS create bench.fs $size $mode >> /dev/null
+end=$(date +%s.%N)
+usage=$(du -h bench.fs | awk '{print $1}')
+printf "%-12s %-10s %-10s %-12s\n" $size $mode $(awk "BEGIN {printf \"%.3f\", $end - $start}") $usage
+rm bench.fs
+done
+done
@@ -0,0 +1,34 @@
+#!/usr/bin/env bash
+# Adds near-identical artifacts, one base with a few bytes inserted at a different place in each copy, with and
+# without --dedup. Reports the space they take and the time of an add and a get of all of them.
+# Usage: ./bench_dedup.sh [copies] [artifact size]   (run from the directory containing FS)
+
+total=${1:-50}
+size=${2:-1048576}
+
+mkdir bench.src
+head -c $size /dev/urandom > bench.base
+for i in $(seq 1 $total); do
+    at=$(( (RANDOM * 32768 + RANDOM) % size ))
+    (head -c $at bench.base; echo "build $i"; tail -c +$((at + 1)) bench.base) > bench.src/artifact$i
+done
+
+printf "%-12s %-12s %-12s %-12s\n" "MODE" "USED BYTES" "ADD MS" "GET MS"
+for mode in "" --dedup ; do
+mkdir -p bench.out/bench.src
+./FS create bench.fs $((total * (size + 64) + 1048576)) >> /dev/null
+
+start=$(date +%s%N)
+ls bench.src/artifact* | ./FS add bench.fs - $mode >> /dev/null
+middle=$(date +%s%N)
+ls bench.src/artifact* | ./FS get bench.fs - bench.out >> /dev/null
+end=$(date +%s%N)
+
+free=$(./FS status bench.fs | grep "^FREE:" | awk '{print $2}')
+printf "%-12s %-12s %-12s %-12s\n" ${mode:-plain} $((total * (size + 64) + 1048576 - free)) \
+    $(( (middle - start) / 1000000 )) $(( (end - middle) / 1000000 ))
+cmp -s bench.src/artifact1 bench.out/bench.src/artifact1 || echo "artifact1 differs after get"
+rm -r bench.fs bench.out
+done
+
+rm -r bench.src bench.base
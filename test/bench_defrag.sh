@@ -0,0 +1,36 @@
+#!/usr/bin/env bash
+# Fragments an image the way bench_policy.sh does, then defragments it and reports what the get of every
+# large file costs before and after, with the time the defrag took.
+# Usage: ./bench_defrag.sh [files] [small file size] [defrag seconds]   (run from the directory containing FS)
+
+total=${1:-2000}
+small=${2:-4096}
+limit=${3:-}
+
+mkdir bench.src
+mkdir -p bench.out/bench.src
+head -c $((total * small)) /dev/urandom | split -b $small -a 6 -d - bench.src/s
+head -c $((total / 8 * small * 3)) /dev/urandom | split -b $((small * 3)) -a 6 -d - bench.src/l
+
+./FS create bench.fs $((total * small * 11 / 10)) >> /dev/null
+seq -f "bench.src/s%06.0f" 0 $((total - 1)) | ./FS add bench.fs - >> /dev/null
+seq -f "bench.src/s%06.0f" 0 2 $((total - 1)) | ./FS remove bench.fs - >> /dev/null
+seq -f "bench.src/l%06.0f" 0 $((total / 8 - 1)) | ./FS add bench.fs - >> /dev/null
+
+get() {
+    start=$(date +%s%N)
+    seq -f "bench.src/l%06.0f" 0 $((total / 8 - 1)) | ./FS get bench.fs - bench.out >> /dev/null
+    end=$(date +%s%N)
+    awk "BEGIN {printf \"%.4f\", $(( (end - start) / (total / 8) )) / 1000000}"
+}
+
+before=$(get)
+start=$(date +%s%N)
+./FS defrag bench.fs $limit
+end=$(date +%s%N)
+after=$(get)
+
+echo "DEFRAG MS: $(( (end - start) / 1000000 ))"
+echo "MS PER GET: $before -> $after"
+
+rm -r bench.fs bench.src bench.out
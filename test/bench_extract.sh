@@ -0,0 +1,37 @@
+#!/usr/bin/env bash
+# Fills an image with small files and times extracting all of them with 1, 2, 4...
+# workers up to the core count, dropping the page cache between runs when allowed.
+# Usage: ./bench_extract.sh [files] [file size] [max threads]   (run from the directory containing FS)
+
+total=${1:-10000}
+size=${2:-16384}
+cores=${3:-$(nproc)}
+
+mkdir bench.src
+head -c $((total * size)) /dev/urandom | split -b $size -a 6 -d - bench.src/f
+seq -f "bench.src/f%06.0f" 0 $((total - 1)) > bench.list
+./FS create bench.fs $((total * (size + 256) + 1048576)) >> /dev/null
+./FS add bench.fs @bench.list >> /dev/null
+rm -r bench.src bench.list
+
+printf "%-8s %-10s %-14s\n" "THREADS" "MS TOTAL" "FILES PER SEC"
+threads=1
+while true ; do
+sync
+echo 3 2> /dev/null > /proc/sys/vm/drop_caches
+start=$(date +%s%N)
+./FS extract bench.fs bench.out --threads=$threads >> /dev/null
+end=$(date +%s%N)
+ms=$(( (end - start) / 1000000 ))
+printf "%-8s %-10s %-14s\n" $threads $ms $(awk "BEGIN {printf \"%.0f\", $total * 1000 / ($ms + 1)}")
+rm -r bench.out
+if [ $threads -ge $cores ] ; then
+break
+fi
+threads=$((threads * 2))
+if [ $threads -gt $cores ] ; then
+threads=$cores
+fi
+done
+
+rm bench.fs
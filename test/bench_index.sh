@@ -0,0 +1,44 @@
+#!/usr/bin/env bash
+# Bulk-loads empty files and reports the average cost of add and of a lookup
+# (get of the first file) per round, to show that name lookups stay flat.
+# With "batch" every round is added by a single FS invocation.
+# Usage: ./bench_index.sh [files] [files per round] [single|batch]   (run from the directory containing FS)
+
+total=${1:-10000}
+round=${2:-1000}
+mode=${3:-single}
+
+./FS create bench.fs $((total * 256 + 1048576)) >> /dev/null
+
+printf "%-10s %-14s %-14s\n" "FILES" "MS PER ADD" "MS PER GET"
+x=0
+while [ $x -lt $total ] ; do
+first=$x
+y=0
+while [ $y -lt $round ] ; do
+touch f$x
+x=$((x+1))
+y=$((y+1))
+done
+start=$(date +%s%N)
+if [ "$mode" = "batch" ] ; then
+seq -f "f%.0f" $first $((x-1)) | ./FS add bench.fs - >> /dev/null
+else
+for y in $(seq $first $((x-1))) ; do
+./FS add bench.fs f$y >> /dev/null
+done
+fi
+end=$(date +%s%N)
+seq -f "f%.0f" $first $((x-1)) | xargs rm
+add=$(( (end - start) / round ))
+
+start=$(date +%s%N)
+./FS get bench.fs f0 out >> /dev/null
+end=$(date +%s%N)
+get=$(( end - start ))
+
+printf "%-10s %-14s %-14s\n" $x $(awk "BEGIN {printf \"%.3f\", $add / 1000000}") $(awk "BEGIN {printf \"%.3f\", $get / 1000000}")
+done
+
+./FS status bench.fs | grep "NAME INDEX"
+rm out bench.fs
@@ -0,0 +1,123 @@
+//Opens a fragmented drive and reads its large files through each I/O engine, with the drive's pages dropped from
+//the page cache first so the reads reach the device. Opening follows the chains of allocation and directory tables,
+//every large file lies in a few hundred extents.
+//Usage: ./bench_io [large files] [large file size in bytes] [fillers]
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "gfs.h"
+
+#define BENCH_DRIVE "bench_io.fs"
+#define BENCH_FILLER 16384
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//Clean pages only leave the cache, so the drive is synced first
+void dropCache() {
+    int fd = open(BENCH_DRIVE, O_RDONLY);
+    if (fd < 0)
+        return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+int readAll(FS_handle* pHandle, uint32_t pFiles, uint8_t* pBuffer, uint32_t pSize) {
+    char name[24];
+    uint64_t size;
+    int result = ST_OK;
+
+    for (uint32_t i = 0; i < pFiles && result == ST_OK; ++i) {
+        snprintf(name, sizeof(name), "large%04u", i);
+        result = gfsRead(pHandle, name, pBuffer, pSize, &size);
+        if (result == ST_OK && (size != pSize || pBuffer[0] != (uint8_t) i || pBuffer[pSize - 1] != (uint8_t) i))
+            result = ST_IO_ERROR;
+    }
+    return result;
+}
+
+int main(int argc, char** argv) {
+    uint32_t files = argc > 1 ? (uint32_t) atoi(argv[1]) : 16;
+    uint32_t size = argc > 2 ? (uint32_t) atoi(argv[2]) : 4194304;
+    uint32_t fillers = argc > 3 ? (uint32_t) atoi(argv[3]) : 8192;
+    uint8_t engines[] = {IO_SYNC, IO_THREADS, IO_URING};
+    const char* names[] = {"sync", "threads", "io_uring"};
+    uint8_t* data = malloc(size > BENCH_FILLER ? size : BENCH_FILLER);
+    FS_handle* handle;
+    char name[24];
+    int result;
+
+    //FRAGMENTS: every other filler removed, so the large files fill the holes first
+    if (data == NULL ||
+        gfsCreate(BENCH_DRIVE, (uint64_t) fillers * BENCH_FILLER + (uint64_t) files * size + 16777216, CREATE_SPARSE,
+                  POLICY_FIRST) != ST_OK || (handle = gfsOpen(BENCH_DRIVE, MMAP_OFF, IO_SYNC, &result)) == NULL) {
+        printf("Can not create %s\n", BENCH_DRIVE);
+        return ST_CANT_OPEN;
+    }
+    memset(data, 0xAA, BENCH_FILLER);
+    for (uint32_t i = 0; i < fillers; ++i) {
+        snprintf(name, sizeof(name), "filler%05u", i);
+        if ((result = gfsAdd(handle, name, data, BENCH_FILLER)) != ST_OK) {
+            printf("Add of %s failed: %d\n", name, result);
+            return result;
+        }
+    }
+    for (uint32_t i = 0; i < fillers; i += 2) {
+        snprintf(name, sizeof(name), "filler%05u", i);
+        gfsRemove(handle, name);
+    }
+    for (uint32_t i = 0; i < files; ++i) {
+        snprintf(name, sizeof(name), "large%04u", i);
+        memset(data, (uint8_t) i, size);
+        if ((result = gfsAdd(handle, name, data, size)) != ST_OK) {
+            printf("Add of %s failed: %d\n", name, result);
+            return result;
+        }
+    }
+    gfsClose(handle);
+
+    printf("%-10s %-10s %-16s %-16s\n", "ENGINE", "OPEN MS", "COLD READ MB/S", "WARM READ MB/S");
+    for (uint32_t e = 0; e < sizeof(engines); ++e) {
+        double start;
+        double opened;
+        double cold;
+        double warm;
+
+        dropCache();
+        start = now();
+        handle = gfsOpen(BENCH_DRIVE, MMAP_OFF, engines[e], &result);
+        opened = now() - start;
+        if (handle == NULL) {
+            printf("Open with %s failed: %d\n", names[e], result);
+            return result;
+        }
+        dropCache();
+        start = now();
+        result = readAll(handle, files, data, size);
+        cold = now() - start;
+        start = now();
+        if (result == ST_OK)
+            result = readAll(handle, files, data, size);
+        warm = now() - start;
+        gfsClose(handle);
+        if (result != ST_OK) {
+            printf("Reads with %s failed: %d\n", names[e], result);
+            return result;
+        }
+        printf("%-10s %-10.1f %-16.1f %-16.1f\n", names[e], opened * 1000, (double) files * size / 1048576 / cold,
+               (double) files * size / 1048576 / warm);
+    }
+
+    free(data);
+    remove(BENCH_DRIVE);
+    return ST_OK;
+}
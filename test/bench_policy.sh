@@ -0,0 +1,33 @@
+#!/usr/bin/env bash
+# Ages an image under each allocation policy: small files with every other one removed,
+# then larger files added into the holes and the little space left at the end. Reports the extents per file status counts
+# and the time a get of every large file takes.
+# Usage: ./bench_policy.sh [files] [small file size]   (run from the directory containing FS)
+
+total=${1:-2000}
+small=${2:-4096}
+
+mkdir bench.src
+head -c $((total * small)) /dev/urandom | split -b $small -a 6 -d - bench.src/s
+head -c $((total / 8 * small * 3)) /dev/urandom | split -b $((small * 3)) -a 6 -d - bench.src/l
+
+printf "%-12s %-10s %-10s %-14s\n" "POLICY" "EXTENTS" "PER FILE" "MS PER GET"
+for policy in contiguous first ; do
+mkdir -p bench.out/bench.src
+./FS create bench.fs $((total * small * 11 / 10)) --policy=$policy >> /dev/null
+seq -f "bench.src/s%06.0f" 0 $((total - 1)) | ./FS add bench.fs - >> /dev/null
+seq -f "bench.src/s%06.0f" 0 2 $((total - 1)) | ./FS remove bench.fs - >> /dev/null
+seq -f "bench.src/l%06.0f" 0 $((total / 8 - 1)) | ./FS add bench.fs - >> /dev/null
+
+start=$(date +%s%N)
+seq -f "bench.src/l%06.0f" 0 $((total / 8 - 1)) | ./FS get bench.fs - bench.out >> /dev/null
+end=$(date +%s%N)
+get=$(( (end - start) / (total / 8) ))
+
+line=$(./FS status bench.fs | grep "^POLICY:")
+printf "%-12s %-10s %-10s %-14s\n" $policy $(echo "$line" | awk '{print $6}') $(echo "$line" | awk '{print $9}') \
+    $(awk "BEGIN {printf \"%.4f\", $get / 1000000}")
+rm -r bench.fs bench.out/bench.src
+done
+
+rm -r bench.src bench.out
@@ -0,0 +1,30 @@
+#!/usr/bin/env bash
+# Reads the last 4 KiB of one large file with cat, plain and compressed, against getting all of it,
+# to show that a ranged read does not pay for the bytes before it.
+# Usage: ./bench_range.sh [file size] [reads]   (run from the directory containing FS)
+
+size=${1:-67108864}
+reads=${2:-100}
+
+seq -f "%g INFO request served in 12 ms from 10.0.0.1 path /api/v1/items" 1 $((size / 40)) | head -c $size > bench.log
+
+printf "%-12s %-14s %-14s\n" "MODE" "GET MS" "TAIL CAT MS"
+for mode in "" --compress ; do
+./FS create bench.fs $((size + 1048576)) >> /dev/null
+./FS add bench.fs bench.log $mode >> /dev/null
+
+start=$(date +%s%N)
+./FS get bench.fs bench.log bench.out >> /dev/null
+middle=$(date +%s%N)
+for i in $(seq 1 $reads); do
+    ./FS cat bench.fs bench.log $((size - 4096)) 4096 > bench.tail
+done
+end=$(date +%s%N)
+
+printf "%-12s %-14s %-14s\n" ${mode:-plain} $(( (middle - start) / 1000000 )) \
+    $(( (end - middle) / 1000000 / reads ))
+tail -c 4096 bench.log | cmp -s - bench.tail || echo "tail differs after cat"
+rm bench.fs bench.out bench.tail
+done
+
+rm bench.log
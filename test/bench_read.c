@@ -0,0 +1,102 @@
+//Reads random files through one shared handle from 1, 2, 4... threads up to the core count,
+//to show that readers scale. Every thread does the same number of reads.
+//Usage: ./bench_read [--mmap] [files] [file size in bytes] [reads per thread] [max threads]
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "gfs.h"
+
+#define BENCH_DRIVE "bench_read.fs"
+
+typedef struct {
+    FS_handle* handle;
+    uint32_t files;
+    uint32_t size;
+    uint32_t reads;
+    unsigned int seed;
+    int result;
+} FS_bench_reader;
+
+void* readRandom(void* pReader) {
+    FS_bench_reader* reader = pReader;
+    uint8_t* buffer = malloc(reader->size);
+    char name[16];
+    uint64_t size;
+
+    reader->result = buffer != NULL ? ST_OK : ST_NOT_ENOUGH_SPACE;
+    for (uint32_t i = 0; i < reader->reads && reader->result == ST_OK; ++i) {
+        snprintf(name, sizeof(name), "f%06u", rand_r(&reader->seed) % reader->files);
+        reader->result = gfsRead(reader->handle, name, buffer, reader->size, &size);
+    }
+    free(buffer);
+    return NULL;
+}
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv) {
+    uint8_t map = argc > 1 && !strcmp(argv[1], "--mmap") ? MMAP_ASYNC : MMAP_OFF;
+    int arg = map != MMAP_OFF ? 2 : 1;
+    uint32_t files = argc > arg ? (uint32_t) atoi(argv[arg]) : 1000;
+    uint32_t size = argc > arg + 1 ? (uint32_t) atoi(argv[arg + 1]) : 65536;
+    uint32_t reads = argc > arg + 2 ? (uint32_t) atoi(argv[arg + 2]) : 20000;
+    uint32_t cores = argc > arg + 3 ? (uint32_t) atoi(argv[arg + 3]) : (uint32_t) sysconf(_SC_NPROCESSORS_ONLN);
+    uint8_t* data = malloc(size);
+    FS_handle* handle;
+    char name[16];
+    double single = 0;
+    int result;
+
+    if (data == NULL || gfsCreate(BENCH_DRIVE, (uint64_t) files * (size + 256) + 1048576, CREATE_SPARSE, POLICY_CONTIGUOUS) != ST_OK ||
+        (handle = gfsOpen(BENCH_DRIVE, map, IO_AUTO, &result)) == NULL) {
+        printf("Can not create %s\n", BENCH_DRIVE);
+        return ST_CANT_OPEN;
+    }
+    for (uint32_t i = 0; i < size; ++i)
+        data[i] = (uint8_t) rand();
+    for (uint32_t i = 0; i < files; ++i) {
+        snprintf(name, sizeof(name), "f%06u", i);
+        if ((result = gfsAdd(handle, name, data, size)) != ST_OK) {
+            printf("Add of %s failed: %d\n", name, result);
+            return result;
+        }
+    }
+    gfsFlush(handle);
+    free(data);
+
+    printf("%-8s %-14s %-10s %-8s\n", "THREADS", "READS PER SEC", "MB/S", "SPEEDUP");
+    for (uint32_t threads = 1; threads <= cores; threads = threads < cores && threads * 2 > cores ? cores : threads * 2) {
+        pthread_t* ids = malloc(threads * sizeof(pthread_t));
+        FS_bench_reader* readers = malloc(threads * sizeof(FS_bench_reader));
+        double start = now();
+
+        for (uint32_t i = 0; i < threads; ++i) {
+            readers[i] = (FS_bench_reader) {handle, files, size, reads, i + 1, ST_OK};
+            pthread_create(&ids[i], NULL, readRandom, &readers[i]);
+        }
+        for (uint32_t i = 0; i < threads; ++i) {
+            pthread_join(ids[i], NULL);
+            if (readers[i].result != ST_OK)
+                printf("Reader %u failed: %d\n", i, readers[i].result);
+        }
+        double rate = (double) threads * reads / (now() - start);
+        if (threads == 1)
+            single = rate;
+        printf("%-8u %-14.0f %-10.1f %-8.2f\n", threads, rate, rate * size / 1048576, rate / single);
+        free(ids);
+        free(readers);
+    }
+
+    gfsClose(handle);
+    remove(BENCH_DRIVE);
+    return ST_OK;
+}
@@ -0,0 +1,45 @@
+#!/usr/bin/env bash
+# Fills an image with small files, punches a hole after every other one and refills
+# the holes with two-extent files, then times removing those fragmented files.
+# Every freed extent has free neighbours on both sides, so each remove coalesces.
+# Each round is removed by a single FS invocation, so the figure excludes loading.
+# Usage: ./bench_remove.sh [files] [files per round]   (run from the directory containing FS)
+
+total=${1:-10000}
+round=${2:-1000}
+chunk=1024
+
+./FS create bench.fs $((total * (chunk + 128) + 1048576)) >> /dev/null
+
+mkdir bench.src
+head -c $((total * chunk)) /dev/zero | split -b $chunk -a 6 -d - bench.src/s
+seq -f "bench.src/s%06.0f" 0 $((total - 1)) | ./FS add bench.fs - >> /dev/null
+
+#fill the tail so nothing but the holes is left
+free=$(./FS status bench.fs | grep "^FREE:" | awk '{print $2}')
+head -c $((free - 512)) /dev/zero > bench.src/filler
+./FS add bench.fs bench.src/filler >> /dev/null
+
+seq -f "bench.src/s%06.0f" 0 2 $((total - 1)) | ./FS remove bench.fs - >> /dev/null
+head -c $((total / 4 * chunk * 2)) /dev/zero | split -b $((chunk * 2)) -a 6 -d - bench.src/b
+seq -f "bench.src/b%06.0f" 0 $((total / 4 - 1)) | ./FS add bench.fs - >> /dev/null
+rm -r bench.src
+
+printf "%-10s %-14s\n" "REMOVED" "MS PER REMOVE"
+x=0
+while [ $x -lt $((total / 4)) ] ; do
+last=$((x + round))
+if [ $last -gt $((total / 4)) ] ; then
+last=$((total / 4))
+fi
+start=$(date +%s%N)
+seq -f "bench.src/b%06.0f" $x $((last - 1)) | ./FS remove bench.fs - >> /dev/null
+end=$(date +%s%N)
+remove=$(( (end - start) / (last - x) ))
+x=$last
+
+printf "%-10s %-14s\n" $x $(awk "BEGIN {printf \"%.4f\", $remove / 1000000}")
+done
+
+./FS status bench.fs | grep "^FREE:"
+rm bench.fs
@@ -0,0 +1,48 @@
+#!/usr/bin/env bash
+# Compares per-file invocations against the drive with the same invocations sent to
+# a running server, and a pipelined batch through the server.
+# Usage: ./bench_serve.sh [files]   (run from the directory containing FS)
+
+total=${1:-2000}
+
+mkdir bench.src
+head -c $((total * 4096)) /dev/urandom | split -b 4096 -a 6 -d - bench.src/f
+seq -f "bench.src/f%06.0f" 0 $((total - 1)) > bench.list
+
+run() {
+start=$(date +%s%N)
+"$@"
+end=$(date +%s%N)
+echo $(( (end - start) / total ))
+}
+
+single() {
+while read name ; do
+./FS $1 $2 $name >> /dev/null
+done < bench.list
+}
+
+pipelined() {
+./FS add bench.sock @bench.list >> /dev/null
+}
+
+printf "%-24s %-14s\n" "MODE" "MS PER FILE"
+./FS create bench.fs $((total * 8192 + 1048576)) >> /dev/null
+add=$(run single add bench.fs)
+remove=$(run single remove bench.fs)
+printf "%-24s %-14s\n" "drive add" $(awk "BEGIN {printf \"%.3f\", $add / 1000000}")
+printf "%-24s %-14s\n" "drive remove" $(awk "BEGIN {printf \"%.3f\", $remove / 1000000}")
+
+./FS serve bench.fs bench.sock >> /dev/null &
+server=$!
+while [ ! -S bench.sock ] ; do sleep 0.1 ; done
+add=$(run single add bench.sock)
+remove=$(run single remove bench.sock)
+batch=$(run pipelined)
+printf "%-24s %-14s\n" "server add" $(awk "BEGIN {printf \"%.3f\", $add / 1000000}")
+printf "%-24s %-14s\n" "server remove" $(awk "BEGIN {printf \"%.3f\", $remove / 1000000}")
+printf "%-24s %-14s\n" "server pipelined add" $(awk "BEGIN {printf \"%.3f\", $batch / 1000000}")
+kill -INT $server
+wait $server
+
+rm -r bench.src bench.list bench.fs
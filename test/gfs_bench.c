@@ -0,0 +1,324 @@
+//Scripted workloads through the library, to track performance between versions: a bulk ingest of small files, a
+//listing of all of them, random removes and re-adds that fragment the image, then large files streamed in and out of
+//it. Every workload reports its throughput, the p50 and p99 latency of its calls and the image's fragmentation after
+//it. The seed is fixed, so every run repeats the same operations; --json prints the run as one JSON object, with the
+//library's own statistics.
+//Usage: ./gfs_bench [--mmap] [--json] [small files] [small file size in bytes] [churn operations] [large files]
+//       [large file size in bytes]
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include "gfs.h"
+#include "version.h"
+
+#define BENCH_DRIVE "gfs_bench.fs"
+#define BENCH_SOURCE "gfs_bench.src"
+#define BENCH_DEST "gfs_bench.out"
+#define BENCH_SEED 2017u
+#define BENCH_LISTINGS 5
+#define BENCH_WORKLOADS 5
+#define BENCH_CHUNK 1048576
+#define BENCH_COUNTS 5
+
+typedef struct {
+    const char* name;
+    uint32_t calls;     //timed, the latencies are theirs
+    uint64_t items;     //files added, removed, listed or copied
+    uint64_t bytes;
+    double seconds;     //wall time, with the flush that commits the workload
+    double p50;         //milliseconds
+    double p99;
+    FS_fragmentation after;
+} FS_bench_result;
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int compareLatencies(const void* pA, const void* pB) {
+    double a = *(const double*) pA;
+    double b = *(const double*) pB;
+    return a < b ? -1 : a > b;
+}
+
+void summarize(FS_handle* pHandle, FS_bench_result* pResult, double* pLatencies, uint32_t pCalls, double pStart) {
+    pResult->seconds = now() - pStart;
+    pResult->calls = pCalls;
+    qsort(pLatencies, pCalls, sizeof(double), compareLatencies);
+    pResult->p50 = pCalls > 0 ? pLatencies[(pCalls - 1) / 2] * 1000 : 0;
+    pResult->p99 = pCalls > 0 ? pLatencies[(uint64_t) (pCalls - 1) * 99 / 100] * 1000 : 0;
+    gfsFragmentation(pHandle, &pResult->after);
+}
+
+int ingest(FS_handle* pHandle, uint32_t pFiles, const uint8_t* pData, uint32_t pSize, double* pLatencies,
+           FS_bench_result* pResult) {
+    double start = now();
+    char name[24];
+    int result;
+
+    *pResult = (FS_bench_result) {"ingest", 0, pFiles, (uint64_t) pFiles * pSize};
+    for (uint32_t i = 0; i < pFiles; ++i) {
+        double began = now();
+        snprintf(name, sizeof(name), "small%07u", i);
+        if ((result = gfsAdd(pHandle, name, pData, pSize)) != ST_OK) {
+            fprintf(stderr, "Add of %s failed: %d\n", name, result);
+            return result;
+        }
+        pLatencies[i] = now() - began;
+    }
+    result = gfsFlush(pHandle);
+    summarize(pHandle, pResult, pLatencies, pFiles, start);
+    return result;
+}
+
+int countFile(const char* pName, uint64_t pSize, uint64_t pCreated, void* pContext) {
+    (void) pName;
+    (void) pSize;
+    (void) pCreated;
+    *(uint64_t*) pContext += 1;
+    return 0;
+}
+
+int listing(FS_handle* pHandle, double* pLatencies, FS_bench_result* pResult) {
+    double start = now();
+    int result;
+
+    *pResult = (FS_bench_result) {"tree"};
+    for (uint32_t i = 0; i < BENCH_LISTINGS; ++i) {
+        double began = now();
+        if ((result = gfsList(pHandle, countFile, &pResult->items)) != ST_OK) {
+            fprintf(stderr, "Listing failed: %d\n", result);
+            return result;
+        }
+        pLatencies[i] = now() - began;
+    }
+    summarize(pHandle, pResult, pLatencies, BENCH_LISTINGS, start);
+    return ST_OK;
+}
+
+//FRAGMENTS: a random small file goes, and comes back anywhere from 1 byte to twice its size
+int churn(FS_handle* pHandle, uint32_t pFiles, uint32_t pOperations, const uint8_t* pData, uint32_t pSize,
+          double* pLatencies, FS_bench_result* pResult) {
+    unsigned int seed = BENCH_SEED;
+    double start = now();
+    char name[24];
+    int result;
+
+    *pResult = (FS_bench_result) {"churn", 0, (uint64_t) pOperations * 2};
+    for (uint32_t i = 0; i < pOperations; ++i) {
+        uint32_t size = 1 + (uint32_t) rand_r(&seed) % (pSize * 2);
+        double began = now();
+        snprintf(name, sizeof(name), "small%07u", (uint32_t) rand_r(&seed) % pFiles);
+        if ((result = gfsRemove(pHandle, name)) != ST_OK) {
+            fprintf(stderr, "Remove of %s failed: %d\n", name, result);
+            return result;
+        }
+        pLatencies[2 * i] = now() - began;
+        began = now();
+        if ((result = gfsAdd(pHandle, name, pData, size)) != ST_OK) {
+            fprintf(stderr, "Add of %s failed: %d\n", name, result);
+            return result;
+        }
+        pLatencies[2 * i + 1] = now() - began;
+        pResult->bytes += size;
+    }
+    result = gfsFlush(pHandle);
+    summarize(pHandle, pResult, pLatencies, pOperations * 2, start);
+    return result;
+}
+
+//STREAMS: large files added from one host file into the fragmented image, then written back out to another
+int stream(FS_handle* pHandle, uint32_t pFiles, uint64_t pSize, double* pLatencies, FS_bench_result* pResults) {
+    FILE* source = fopen(BENCH_SOURCE, "w+b");
+    FILE* dest = fopen(BENCH_DEST, "w+b");
+    uint8_t* chunk = malloc(BENCH_CHUNK);
+    unsigned int seed = BENCH_SEED;
+    char name[24];
+    double start;
+    int result = ST_OK;
+
+    if (source == NULL || dest == NULL || chunk == NULL)
+        result = ST_CANT_OPEN;
+    for (uint32_t i = 0; i < BENCH_CHUNK && result == ST_OK; ++i)
+        chunk[i] = (uint8_t) rand_r(&seed);
+    for (uint64_t written = 0; written < pSize && result == ST_OK; written += BENCH_CHUNK) {
+        size_t size = pSize - written > BENCH_CHUNK ? BENCH_CHUNK : (size_t) (pSize - written);
+        if (fwrite(chunk, 1, size, source) != size)
+            result = ST_IO_ERROR;
+    }
+    if (result == ST_OK && fflush(source) != 0)
+        result = ST_IO_ERROR;
+
+    pResults[0] = (FS_bench_result) {"stream add", 0, pFiles, (uint64_t) pFiles * pSize};
+    start = now();
+    for (uint32_t i = 0; i < pFiles && result == ST_OK; ++i) {
+        double began = now();
+        snprintf(name, sizeof(name), "large%04u", i);
+        fseeko(source, 0, SEEK_SET);
+        if ((result = gfsAddStream(pHandle, source, pSize, name)) != ST_OK)
+            fprintf(stderr, "Add of %s failed: %d\n", name, result);
+        pLatencies[i] = now() - began;
+    }
+    if (result == ST_OK)
+        result = gfsFlush(pHandle);
+    summarize(pHandle, &pResults[0], pLatencies, result == ST_OK ? pFiles : 0, start);
+
+    pResults[1] = (FS_bench_result) {"stream get", 0, pFiles, (uint64_t) pFiles * pSize};
+    start = now();
+    for (uint32_t i = 0; i < pFiles && result == ST_OK; ++i) {
+        double began = now();
+        snprintf(name, sizeof(name), "large%04u", i);
+        fseeko(dest, 0, SEEK_SET);
+        result = gfsGetStream(pHandle, name, dest);
+        if (result == ST_OK && fflush(dest) != 0)
+            result = ST_IO_ERROR;
+        if (result != ST_OK)
+            fprintf(stderr, "Get of %s failed: %d\n", name, result);
+        pLatencies[i] = now() - began;
+    }
+    summarize(pHandle, &pResults[1], pLatencies, result == ST_OK ? pFiles : 0, start);
+
+    if (source != NULL)
+        fclose(source);
+    if (dest != NULL)
+        fclose(dest);
+    free(chunk);
+    remove(BENCH_SOURCE);
+    remove(BENCH_DEST);
+    return result;
+}
+
+void printText(FS_bench_result* pResults, uint32_t pCount) {
+    printf("%-11s %-8s %-11s %-9s %-9s %-9s %-8s %-9s %-9s %-12s\n", "WORKLOAD", "CALLS", "ITEMS/S", "MB/S",
+           "P50 MS", "P99 MS", "FILES", "EXTENTS", "FREE EXT", "LARGEST FREE");
+    for (uint32_t i = 0; i < pCount; ++i) {
+        FS_bench_result* r = &pResults[i];
+        printf("%-11s %-8u %-11.0f %-9.1f %-9.3f %-9.3f %-8u %-9u %-9u %-12llu\n", r->name, r->calls,
+               (double) r->items / r->seconds, (double) r->bytes / 1048576 / r->seconds, r->p50, r->p99,
+               r->after.files, r->after.file_extents, r->after.free_extents,
+               (unsigned long long) r->after.largest_free);
+    }
+}
+
+void printJson(FS_handle* pHandle, uint8_t pMap, FS_bench_result* pResults, uint32_t pCount) {
+    printf("{\"version\": \"%d.%d\", \"seed\": %u, \"mmap\": %s, \"workloads\": [", MAJOR_VERSION, MINOR_VERSION,
+           BENCH_SEED, pMap != MMAP_OFF ? "true" : "false");
+    for (uint32_t i = 0; i < pCount; ++i) {
+        FS_bench_result* r = &pResults[i];
+        printf("%s{\"name\": \"%s\", \"calls\": %u, \"items\": %llu, \"bytes\": %llu, \"seconds\": %.6f, "
+               "\"items_per_sec\": %.1f, \"mb_per_sec\": %.2f, \"p50_ms\": %.4f, \"p99_ms\": %.4f, "
+               "\"fragmentation\": {\"files\": %u, \"file_extents\": %u, \"free_extents\": %u, "
+               "\"largest_free\": %llu}}", i > 0 ? ", " : "", r->name, r->calls, (unsigned long long) r->items,
+               (unsigned long long) r->bytes, r->seconds, (double) r->items / r->seconds,
+               (double) r->bytes / 1048576 / r->seconds, r->p50, r->p99, r->after.files, r->after.file_extents,
+               r->after.free_extents, (unsigned long long) r->after.largest_free);
+    }
+    printf("], \"library\": ");
+    fflush(stdout);
+    gfsStats(pHandle, stdout, STATS_JSON);
+    printf("}\n");
+}
+
+int usage() {
+    fprintf(stderr, "Usage: ./gfs_bench [--mmap] [--json] [small files] [small file size in bytes] [churn operations]\n");
+    fprintf(stderr, "       [large files] [large file size in bytes]\n");
+    return ST_INVALID_COMMAND;
+}
+
+//Digits only, from 1 up to pMax
+int parseCount(const char* pArg, uint64_t pMax, uint64_t* pCount) {
+    char* end;
+
+    if (*pArg < '0' || *pArg > '9')
+        return ST_INVALID_COMMAND;
+    errno = 0;
+    *pCount = strtoull(pArg, &end, 10);
+    return *end == 0 && errno == 0 && *pCount >= 1 && *pCount <= pMax ? ST_OK : ST_INVALID_COMMAND;
+}
+
+int main(int argc, char** argv) {
+    uint8_t map = MMAP_OFF;
+    uint8_t json = 0;
+    int arg = 1;
+    uint32_t files;
+    uint32_t size;
+    uint32_t operations;
+    uint32_t large;
+    uint64_t largeSize;
+    uint32_t latencies;
+    uint64_t counts[BENCH_COUNTS] = {100000, 1024, 20000, 8, 16777216};
+    //sizes and operations are doubled in 32 bits
+    const uint64_t limits[BENCH_COUNTS] = {UINT32_MAX, UINT32_MAX / 2, UINT32_MAX / 2, UINT32_MAX, UINT64_MAX};
+    FS_bench_result results[BENCH_WORKLOADS];
+    FS_handle* handle;
+    uint8_t* data;
+    double* latency;
+    int result;
+
+    for (; arg < argc && !strncmp(argv[arg], "--", 2); ++arg) {
+        if (!strcmp(argv[arg], "--mmap"))
+            map = MMAP_ASYNC;
+        else if (!strcmp(argv[arg], "--json"))
+            json = 1;
+        else {
+            fprintf(stderr, "Unknown option: %s\n", argv[arg]);
+            return usage();
+        }
+    }
+    if (argc - arg > BENCH_COUNTS) {
+        fprintf(stderr, "Too many arguments\n");
+        return usage();
+    }
+    for (int i = 0; arg + i < argc; ++i) {
+        if (parseCount(argv[arg + i], limits[i], &counts[i]) != ST_OK) {
+            fprintf(stderr, "Provide a count from 1 to %llu: %s\n", (unsigned long long) limits[i], argv[arg + i]);
+            return usage();
+        }
+    }
+    files = (uint32_t) counts[0];
+    size = (uint32_t) counts[1];
+    operations = (uint32_t) counts[2];
+    large = (uint32_t) counts[3];
+    largeSize = counts[4];
+
+    latencies = files > operations * 2 ? files : operations * 2;
+    latencies = latencies > large ? latencies : large;
+    latencies = latencies > BENCH_LISTINGS ? latencies : BENCH_LISTINGS;
+    data = malloc((size_t) size * 2);
+    latency = malloc(latencies * sizeof(double));
+    if (data == NULL || latency == NULL ||
+        gfsCreate(BENCH_DRIVE, (uint64_t) files * (size * 2 + 512) + (uint64_t) large * largeSize + 67108864,
+                  CREATE_SPARSE, POLICY_CONTIGUOUS) != ST_OK ||
+        (handle = gfsOpen(BENCH_DRIVE, map, IO_AUTO, &result)) == NULL) {
+        fprintf(stderr, "Can not create %s\n", BENCH_DRIVE);
+        return ST_CANT_OPEN;
+    }
+    for (uint32_t i = 0; i < size * 2; ++i)
+        data[i] = (uint8_t) (i * 2654435761u >> 24);
+
+    result = ingest(handle, files, data, size, latency, &results[0]);
+    if (result == ST_OK)
+        result = listing(handle, latency, &results[1]);
+    if (result == ST_OK)
+        result = churn(handle, files, operations, data, size, latency, &results[2]);
+    if (result == ST_OK)
+        result = stream(handle, large, largeSize, latency, &results[3]);
+
+    if (result == ST_OK) {
+        if (json)
+            printJson(handle, map, results, BENCH_WORKLOADS);
+        else
+            printText(results, BENCH_WORKLOADS);
+    }
+    gfsClose(handle);
+    free(data);
+    free(latency);
+    remove(BENCH_DRIVE);
+    return result;
+}
@@ -167,3 +167,86 @@ md5sum test.png
 md5sum test.out.png
 
 
+
+echo
+echo "Interrupted commit: the journal holds it, the tables do not"
+echo
+./FS create journal.fs 80960
+echo "first" > first
+echo "second" > second
+./FS add journal.fs first
+cp journal.fs before.fs
+./FS add journal.fs second
+journal=$(./FS status journal.fs | sed -n 's/^JOURNAL: \([0-9]*\).*/\1/p')
+size=$(stat -c %s journal.fs)
+head -c $((size - journal)) before.fs > crashed.fs
+tail -c $journal journal.fs >> crashed.fs
+echo "Both first and second should be listed"
+./FS ls crashed.fs
+./FS fsck crashed.fs
+./FS get crashed.fs second second.out
+md5sum second
+md5sum second.out
+rm first second second.out before.fs crashed.fs journal.fs
+
+echo
+echo "Corrupted directory table, in place and in the journal"
+echo
+./FS create corrupt.fs 80960
+echo "victim" > victim.txt
+./FS add corrupt.fs victim.txt
+for offset in $(grep -obUa "victim.txt" corrupt.fs | cut -d: -f1)
+do
+printf 'XXXXXX' | dd of=corrupt.fs bs=1 seek=$offset conv=notrunc 2> /dev/null
+done
+echo "Open should refuse the drive and fsck should count problems"
+./FS ls corrupt.fs
+./FS fsck corrupt.fs
+rm victim.txt corrupt.fs
+
+echo
+echo "Adding the same 200000-byte file twice with --dedup"
+echo
+./FS create dedup.fs 800000
+dd if=/dev/urandom of=shared1 bs=1000 count=200 2> /dev/null
+cp shared1 shared2
+./FS --dedup add dedup.fs shared1 shared2
+echo "FREE should have dropped by about 200000 bytes, not 400000"
+./FS status dedup.fs | grep -E "^FREE:|^DEDUP INDEX"
+./FS get dedup.fs shared1 shared1.out
+./FS get dedup.fs shared2 shared2.out
+md5sum shared1 shared1.out shared2.out
+echo "Removing shared1, shared2 keeps the chunks"
+./FS remove dedup.fs shared1
+./FS get dedup.fs shared2 shared2.out
+md5sum shared2 shared2.out
+./FS fsck dedup.fs
+echo "Removing shared2, the chunks go free"
+./FS remove dedup.fs shared2
+./FS status dedup.fs | grep -E "^FREE:|^DEDUP INDEX"
+./FS fsck dedup.fs
+rm shared1 shared2 shared1.out shared2.out dedup.fs
+
+echo
+echo "Nested directories"
+echo
+./FS create dirs.fs 80960
+./FS mkdir dirs.fs docs/notes docs/old
+mkdir -p docs/notes
+for x in 0 1 2 3 4 5
+do
+echo "note $x" > docs/notes/n$x
+done
+./FS add dirs.fs docs/notes/n0 docs/notes/n1 docs/notes/n2 docs/notes/n3 docs/notes/n4 docs/notes/n5
+./FS ls dirs.fs
+./FS ls dirs.fs docs
+./FS ls dirs.fs docs/notes
+echo "Two entries after n1: n2 and n3"
+./FS ls dirs.fs docs/notes n1 2
+echo "Removing docs/notes should fail, it is not empty"
+./FS remove dirs.fs docs/notes
+echo "Removing docs/old, which is empty"
+./FS remove dirs.fs docs/old
+./FS tree dirs.fs
+./FS fsck dirs.fs
+rm -r docs dirs.fs